@@ -34,6 +34,7 @@ int BasicAudioRender::Open(int64_t wanted_channel_layout,
   audio_hw_buf_size = buf_size;
   audio_buf_size = 0;
   audio_buf_index = 0;
+  pending_buf_us_ = 0;
 
   audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
   audio_diff_avg_count = 0;
@@ -89,6 +90,10 @@ void BasicAudioRender::ReadAudioData(uint8_t* stream, int len) {
   }
 
   audio_write_buf_size = audio_buf_size - audio_buf_index;
+  // silence output on underrun is not buffered audio.
+  pending_buf_us_ = audio_buf ? (int64_t)audio_write_buf_size * 1000000 /
+                                    audio_tgt.bytes_per_sec
+                              : 0;
   if (!isnan(audio_clock_from_pts)) {
     clock_ctx_->GetAudioClock()->SetClockAt(
         audio_clock_from_pts -
@@ -161,6 +166,5 @@ void BasicAudioRender::MixAudioVolume(uint8_t* dst,
 }
 
 bool BasicAudioRender::IsReady() {
-  return sample_queue->NbRemaining() > 0 ||
-         (audio_buf_size > 0 && audio_buf_index < audio_buf_size);
+  return GetBufferedDurationMs() > 0;
 }
@@ -0,0 +1,164 @@
+//
+// Created by boyan on 2021/3/6.
+//
+
+#include "buffering_policy.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+/* packets needed to start playback, and to stop reading a stream */
+#define MIN_PLAY_PACKETS 2
+#define MIN_READ_PACKETS 25
+
+/* watermarks of a fast source */
+#define DEFAULT_HIGH_MS 1000
+
+/* watermarks of a slow source, low is doubled on every recent rebuffer */
+#define SLOW_LOW_MS 500
+#define MAX_LOW_MS 20000
+#define MAX_HIGH_MS 60000
+#define MAX_REBUFFER_SHIFT 5
+
+/* throughput is sampled over this much read time or bytes */
+#define THROUGHPUT_WINDOW_US 200000
+#define THROUGHPUT_WINDOW_BYTES (512 * 1024)
+
+/* a rebuffer is forgotten after a minute without one */
+#define REBUFFER_DECAY_US (60 * 1000000LL)
+
+AdaptiveBufferingPolicy::AdaptiveBufferingPolicy() {
+  watermarks_.high_ms = DEFAULT_HIGH_MS;
+}
+
+bool AdaptiveBufferingPolicy::HasEnoughBuffered(const BufferLevel& level) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (level.packets <= MIN_READ_PACKETS) {
+    return false;
+  }
+  if (level.duration_ms > 0) {
+    return level.duration_ms > watermarks_.high_ms;
+  }
+  return !watermarks_.high_bytes || level.bytes >= watermarks_.high_bytes;
+}
+
+bool AdaptiveBufferingPolicy::IsReadyToPlay(const BufferLevel& level) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (level.packets <= MIN_PLAY_PACKETS) {
+    return false;
+  }
+  if (level.duration_ms > 0) {
+    return level.duration_ms >= watermarks_.low_ms;
+  }
+  return !watermarks_.low_bytes || level.bytes >= watermarks_.low_bytes;
+}
+
+void AdaptiveBufferingPolicy::OnPacketRead(int64_t bytes,
+                                           int64_t duration_ms,
+                                           int64_t read_time_us) {
+  BufferWatermarks watermarks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    media_bytes_ += bytes;
+    media_duration_ms_ += duration_ms;
+    window_bytes_ += bytes;
+    window_time_us_ += read_time_us;
+    if (window_time_us_ < THROUGHPUT_WINDOW_US &&
+        window_bytes_ < THROUGHPUT_WINDOW_BYTES) {
+      return;
+    }
+    auto sample =
+        (double)window_bytes_ * 1000000 / (double)FFMAX(window_time_us_, 1);
+    throughput_ = throughput_ == 0 ? sample : 0.7 * throughput_ + 0.3 * sample;
+    window_bytes_ = 0;
+    window_time_us_ = 0;
+    if (!UpdateWatermarks()) {
+      return;
+    }
+    watermarks = watermarks_;
+  }
+  NotifyWatermarksChanged(watermarks);
+}
+
+void AdaptiveBufferingPolicy::SetSourceBitRate(int64_t bit_rate) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  source_bit_rate_ = bit_rate;
+}
+
+void AdaptiveBufferingPolicy::OnRebuffer() {
+  BufferWatermarks watermarks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rebuffer_count_++;
+    last_rebuffer_time_ = av_gettime_relative();
+    if (!UpdateWatermarks()) {
+      return;
+    }
+    watermarks = watermarks_;
+  }
+  av_log(nullptr, AV_LOG_INFO,
+         "rebuffered, watermarks low %" PRId64 " ms high %" PRId64 " ms.\n",
+         watermarks.low_ms, watermarks.high_ms);
+  NotifyWatermarksChanged(watermarks);
+}
+
+BufferWatermarks AdaptiveBufferingPolicy::GetWatermarks() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return watermarks_;
+}
+
+double AdaptiveBufferingPolicy::MediaByteRate() const {
+  if (source_bit_rate_ > 0) {
+    return source_bit_rate_ / 8.0;
+  }
+  if (media_duration_ms_ >= 1000) {
+    return (double)media_bytes_ * 1000 / (double)media_duration_ms_;
+  }
+  return 0;
+}
+
+bool AdaptiveBufferingPolicy::UpdateWatermarks() {
+  auto now = av_gettime_relative();
+  if (rebuffer_count_ > 0 && now - last_rebuffer_time_ > REBUFFER_DECAY_US) {
+    rebuffer_count_--;
+    last_rebuffer_time_ = now;
+  }
+
+  auto byte_rate = MediaByteRate();
+  // how many times faster than playback the source delivers, 0 if unknown.
+  auto speed = throughput_ > 0 && byte_rate > 0 ? throughput_ / byte_rate : 0;
+  int slow_factor = 0;
+  if (speed > 0 && speed < 1.2) {
+    slow_factor = 4;
+  } else if (speed > 0 && speed < 2) {
+    slow_factor = 2;
+  } else if (speed > 0 && speed < 4) {
+    slow_factor = 1;
+  }
+
+  BufferWatermarks watermarks;
+  if (slow_factor == 0 && rebuffer_count_ == 0) {
+    watermarks.low_ms = 0;
+    watermarks.high_ms = DEFAULT_HIGH_MS;
+  } else {
+    auto low_ms = (int64_t)SLOW_LOW_MS * FFMAX(slow_factor, 1)
+                  << FFMIN(rebuffer_count_, MAX_REBUFFER_SHIFT);
+    watermarks.low_ms = FFMIN(low_ms, MAX_LOW_MS);
+    watermarks.high_ms = FFMIN(
+        FFMAX((int64_t)DEFAULT_HIGH_MS, 4 * watermarks.low_ms), MAX_HIGH_MS);
+  }
+  if (byte_rate > 0) {
+    watermarks.low_bytes = (int64_t)(watermarks.low_ms * byte_rate / 1000);
+    watermarks.high_bytes = (int64_t)(watermarks.high_ms * byte_rate / 1000);
+  }
+
+  auto changed = watermarks.low_ms != watermarks_.low_ms ||
+                 watermarks.high_ms != watermarks_.high_ms;
+  watermarks_ = watermarks;
+  return changed;
+}
@@ -0,0 +1,139 @@
+//
+// Created by boyan on 2021/3/6.
+//
+
+#ifndef FFPLAYER_BUFFERING_POLICY_H
+#define FFPLAYER_BUFFERING_POLICY_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+/* Packets buffered for one stream. */
+struct BufferLevel {
+  int packets = 0;
+  int64_t bytes = 0;
+  // 0 if the packets carry no duration.
+  int64_t duration_ms = 0;
+};
+
+/* Thresholds of a BufferingPolicy, 0 for not known. */
+struct BufferWatermarks {
+  // buffered before playback starts or resumes.
+  int64_t low_ms = 0;
+  int64_t low_bytes = 0;
+  // buffered before the source stops reading.
+  int64_t high_ms = 0;
+  int64_t high_bytes = 0;
+};
+
+/**
+ * Decides when DataSource reads ahead and when MediaPlayer leaves buffering.
+ *
+ * DataSource reports every packet it reads, MediaPlayer reports rebuffering,
+ * the policy adapts its watermarks from that. Methods can be called from any
+ * thread.
+ */
+class BufferingPolicy {
+ public:
+  virtual ~BufferingPolicy() = default;
+
+  /**
+   * @return true if |level| is enough for the source to stop reading that
+   * stream.
+   */
+  virtual bool HasEnoughBuffered(const BufferLevel& level) = 0;
+
+  /**
+   * @return true if |level| is enough to start or resume playback.
+   */
+  virtual bool IsReadyToPlay(const BufferLevel& level) = 0;
+
+  /**
+   * Called after a packet is read.
+   *
+   * @param bytes size of the packet.
+   * @param duration_ms media duration of the packet, 0 if unknown.
+   * @param read_time_us time spent reading it.
+   */
+  virtual void OnPacketRead(int64_t bytes,
+                            int64_t duration_ms,
+                            int64_t read_time_us) = 0;
+
+  /** @param bit_rate bit rate of the source in bits/s, 0 if unknown. */
+  virtual void SetSourceBitRate(int64_t bit_rate) = 0;
+
+  /** Called when playback stalls because the buffer ran dry. */
+  virtual void OnRebuffer() = 0;
+
+  virtual BufferWatermarks GetWatermarks() = 0;
+
+  /** Called with the new watermarks when the policy changes them. */
+  void SetWatermarksListener(
+      std::function<void(const BufferWatermarks&)> listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex_);
+    watermarks_listener_ = std::move(listener);
+  }
+
+ protected:
+  void NotifyWatermarksChanged(const BufferWatermarks& watermarks) {
+    std::lock_guard<std::mutex> lock(listener_mutex_);
+    if (watermarks_listener_) {
+      watermarks_listener_(watermarks);
+    }
+  }
+
+ private:
+  std::mutex listener_mutex_;
+  std::function<void(const BufferWatermarks&)> watermarks_listener_;
+};
+
+/**
+ * Default policy. Fast sources, such as local files, keep the classic ffplay
+ * thresholds (2 packets to play, 1 second to stop reading). When the measured
+ * read throughput gets close to the media bit rate, or playback rebuffers,
+ * the watermarks grow so that playback resumes with more data buffered.
+ * Without rebuffering they decay back.
+ */
+class AdaptiveBufferingPolicy : public BufferingPolicy {
+ public:
+  AdaptiveBufferingPolicy();
+
+  bool HasEnoughBuffered(const BufferLevel& level) override;
+
+  bool IsReadyToPlay(const BufferLevel& level) override;
+
+  void OnPacketRead(int64_t bytes,
+                    int64_t duration_ms,
+                    int64_t read_time_us) override;
+
+  void SetSourceBitRate(int64_t bit_rate) override;
+
+  void OnRebuffer() override;
+
+  BufferWatermarks GetWatermarks() override;
+
+ private:
+  std::mutex mutex_;
+  BufferWatermarks watermarks_;
+
+  // read throughput, bytes/s, 0 until measured.
+  double throughput_ = 0;
+  int64_t window_bytes_ = 0;
+  int64_t window_time_us_ = 0;
+
+  int64_t source_bit_rate_ = 0;
+  int64_t media_bytes_ = 0;
+  int64_t media_duration_ms_ = 0;
+
+  int rebuffer_count_ = 0;
+  int64_t last_rebuffer_time_ = 0;
+
+  // bytes per second of media, 0 if unknown.
+  double MediaByteRate() const;
+
+  // must be called with |mutex_| held, returns true if watermarks changed.
+  bool UpdateWatermarks();
+};
+
+#endif  // FFPLAYER_BUFFERING_POLICY_H
@@ -0,0 +1,153 @@
+//
+// Created by boyan on 2021/3/8.
+//
+
+#include "cache_io.h"
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+}
+
+std::unique_ptr<CacheIO> CacheIO::Create(
+    const char* url,
+    SourceFactory open_source,
+    std::unique_ptr<MediaIO>* uncached_source) {
+  auto entry = MediaCache::Get()->Open(url);
+  if (!entry) {
+    return nullptr;
+  }
+  std::unique_ptr<CacheIO> io(new CacheIO(entry, std::move(open_source)));
+  if (!entry->IsComplete() && io->OpenSource(uncached_source) < 0) {
+    return nullptr;
+  }
+  return io;
+}
+
+CacheIO::CacheIO(std::shared_ptr<CacheEntry> entry, SourceFactory open_source)
+    : entry_(std::move(entry)), open_source_(std::move(open_source)) {}
+
+CacheIO::~CacheIO() = default;
+
+int CacheIO::OpenSource(std::unique_ptr<MediaIO>* unsized_source) {
+  {
+    std::lock_guard<std::mutex> lock(source_mutex_);
+    if (abort_) {
+      return AVERROR_EXIT;
+    }
+    if (source_) {
+      return 0;
+    }
+  }
+  auto source = open_source_();
+  if (!source) {
+    return AVERROR(EIO);
+  }
+  auto size = source->Seek(0, AVSEEK_SIZE);
+  if (size <= 0) {
+    av_log(nullptr, AV_LOG_INFO, "cache: size of source is unknown.\n");
+    if (unsized_source) {
+      *unsized_source = std::move(source);
+    }
+    return AVERROR(ENOSYS);
+  }
+  entry_->SetContentSize(size);
+
+  std::lock_guard<std::mutex> lock(source_mutex_);
+  if (abort_) {
+    return AVERROR_EXIT;
+  }
+  source_ = std::move(source);
+  source_position_ = 0;
+  return 0;
+}
+
+int CacheIO::Read(uint8_t* buf, int size) {
+  int64_t position = position_;
+  auto content_size = entry_->GetContentSize();
+  if (content_size >= 0 && position >= content_size) {
+    return AVERROR_EOF;
+  }
+  auto ret = entry_->Read(position, buf, size);
+  if (ret != 0) {
+    if (ret > 0) {
+      position_ += ret;
+    }
+    return ret;
+  }
+
+  // do not fetch again what is cached right after the missing range.
+  auto missing = entry_->GetNextCachedStart(position) - position;
+  ret = ReadSource(buf, (int)FFMIN((int64_t)size, missing));
+  if (ret <= 0) {
+    return ret;
+  }
+  if (entry_->Write(position, buf, ret) < 0) {
+    av_log(nullptr, AV_LOG_WARNING, "cache: failed to write %d bytes.\n", ret);
+  }
+  position_ += ret;
+  return ret;
+}
+
+int CacheIO::ReadSource(uint8_t* buf, int size) {
+  auto ret = OpenSource();
+  if (ret < 0) {
+    return ret;
+  }
+  int64_t position = position_;
+  if (source_position_ != position) {
+    auto seek_ret = source_->Seek(position, SEEK_SET);
+    if (seek_ret < 0) {
+      source_position_ = -1;
+      return (int)seek_ret;
+    }
+    source_position_ = position;
+  }
+  ret = source_->Read(buf, size);
+  if (ret > 0) {
+    source_position_ += ret;
+  }
+  return ret;
+}
+
+int64_t CacheIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  auto content_size = entry_->GetContentSize();
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return content_size >= 0 ? content_size : AVERROR(ENOSYS);
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      if (content_size < 0) {
+        return AVERROR(ENOSYS);
+      }
+      target = content_size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  // the source seeks lazily, on the next missing byte.
+  position_ = target;
+  return target;
+}
+
+void CacheIO::Abort() {
+  std::lock_guard<std::mutex> lock(source_mutex_);
+  abort_ = true;
+  if (source_) {
+    source_->Abort();
+  }
+}
+
+int64_t CacheIO::GetCachedForwards() const {
+  return entry_->GetCachedForwards(position_);
+}
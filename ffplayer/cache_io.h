@@ -0,0 +1,92 @@
+//
+// Created by boyan on 2021/3/8.
+//
+
+#ifndef FFPLAYER_CACHE_IO_H
+#define FFPLAYER_CACHE_IO_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "media_cache.h"
+#include "media_io.h"
+
+/**
+ * Reads a network stream through the MediaCache: cached ranges are read from
+ * the cache file, the others are fetched from the source and written to the
+ * cache.
+ *
+ * The source is only opened when a byte is missing, a fully cached url never
+ * touches the network.
+ */
+class CacheIO : public MediaIO {
+ public:
+  typedef std::function<std::unique_ptr<MediaIO>()> SourceFactory;
+
+  /**
+   * @param open_source opens the source on the read thread, returns null on
+   * failure.
+   * @param uncached_source set to the source opened by |open_source| when it
+   * has no known size, read it directly instead of opening it again.
+   * @return null if the cache is disabled, or the source has no known size,
+   * such as a live stream.
+   */
+  static std::unique_ptr<CacheIO> Create(
+      const char* url,
+      SourceFactory open_source,
+      std::unique_ptr<MediaIO>* uncached_source);
+
+  ~CacheIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+  /** @return position of the source, -1 if it is not opened. */
+  int64_t GetPhysicalPosition() const { return source_position_; }
+
+  /** @return read position. */
+  int64_t GetPosition() const { return position_; }
+
+  /** @return bytes cached contiguously from the read position. */
+  int64_t GetCachedForwards() const;
+
+  /** @return bytes cached for this url. */
+  int64_t GetCachedBytes() const { return entry_->GetCachedBytes(); }
+
+  /** @return size of the stream, negative if unknown. */
+  int64_t GetContentSize() const { return entry_->GetContentSize(); }
+
+  /** @return true if the cache of this url is shared with another player. */
+  bool IsShared() const { return entry_->IsShared(); }
+
+ private:
+  std::shared_ptr<CacheEntry> entry_;
+  SourceFactory open_source_;
+
+  // guards |source_| against Abort().
+  std::mutex source_mutex_;
+  std::unique_ptr<MediaIO> source_;
+  bool abort_ = false;
+
+  std::atomic<int64_t> position_{0};
+  std::atomic<int64_t> source_position_{-1};
+
+  CacheIO(std::shared_ptr<CacheEntry> entry, SourceFactory open_source);
+
+  /**
+   * Open the source if needed, checking that the content did not change.
+   *
+   * @param unsized_source set to the source if its size is unknown, it is
+   * closed if null.
+   */
+  int OpenSource(std::unique_ptr<MediaIO>* unsized_source = nullptr);
+
+  int ReadSource(uint8_t* buf, int size);
+};
+
+#endif  // FFPLAYER_CACHE_IO_H
@@ -3,25 +3,41 @@
 //
 
 #include "data_source.h"
+
+#include <cinttypes>
+#include <vector>
+
+#include "decrypt_io.h"
 #include "ffp_utils.h"
 #include "ffplayer.h"
+#include "http_io.h"
+#include "mmap_io.h"
+#include "network_emulation_io.h"
+#include "prefetch_scheduler.h"
+#include "probe_cache.h"
+#include "read_ahead_io.h"
+#include "segmented_io.h"
 
 #include "logging.h"
 
-#define MIN_FRAMES 25
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+// retry delays of reads failing with something else than the end of file.
+#define READ_RETRY_MIN_DELAY_US 10000
+#define READ_RETRY_MAX_DELAY_US 1000000
+
+// the player is asked to check its state this often while the read thread
+// sleeps, see WaitReadEvent().
+#define DO_SOME_WORK_INTERVAL_US 100000
 
 static const AVRational av_time_base_q_ = {1, AV_TIME_BASE};
 
 static inline int stream_has_enough_packets(
+    BufferingPolicy* policy,
     AVStream* st,
     int stream_id,
     const std::shared_ptr<PacketQueue>& queue) {
   return stream_id < 0 || queue->abort_request ||
          (st->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
-         queue->nb_packets > MIN_FRAMES &&
-             (!queue->duration ||
-              av_q2d(st->time_base) * queue->duration > 1.0);
+         policy->HasEnoughBuffered(queue->GetBufferLevel());
 }
 
 static int is_realtime(AVFormatContext* s) {
@@ -37,8 +53,16 @@ static int is_realtime(AVFormatContext* s) {
 DataSource::DataSource(const char* filename, AVInputFormat* format)
     : in_format(format) {
   memset(wanted_stream_spec, 0, sizeof wanted_stream_spec);
-  this->filename = av_strdup(filename);
-  continue_read_thread_ = std::make_shared<std::condition_variable_any>();
+  auto* emulated_url =
+      network_emulation_strip_url(filename, &network_emulation_);
+  this->filename = av_strdup(emulated_url ? emulated_url : filename);
+  read_event_ = std::make_shared<ReadEvent>();
+}
+
+DataSource::DataSource(std::shared_ptr<MemorySource> source,
+                       AVInputFormat* format)
+    : DataSource("memory:", format) {
+  memory_source_ = std::move(source);
 }
 
 int DataSource::Open() {
@@ -54,39 +78,131 @@ int DataSource::Open() {
 }
 
 DataSource::~DataSource() {
-  av_free(filename);
   if (read_tid && read_tid->joinable()) {
     abort_request = true;
-    continue_read_thread_->notify_all();
+    if (io_ctx_) {
+      GetMediaIO(io_ctx_)->Abort();
+    }
+    read_event_->Notify();
     read_tid->join();
   }
   if (format_ctx_) {
     avformat_free_context(format_ctx_);
     format_ctx_ = nullptr;
   }
+  FreeAVIOContext(&io_ctx_);
+  av_dict_free(&protocol_options_);
+  // reopened by the io until the read thread is gone.
+  av_free(filename);
 }
 
 void DataSource::ReadThread() {
   update_thread_name("read_source");
   av_log(nullptr, AV_LOG_DEBUG, "DataSource Read OnStart: %s \n", filename);
   int st_index[AVMEDIA_TYPE_NB] = {-1, -1, -1, -1, -1};
-  std::mutex wait_mutex;
 
-  if (PrepareFormatContext() < 0) {
-    return;
+  // a prepared source resumes reading where its preparation stopped.
+  if (!prepared_) {
+    if (PrepareFormatContext() < 0) {
+      return;
+    }
+    OnFormatContextOpen();
+
+    ReadStreamInfo(st_index);
+    OnStreamInfoLoad(st_index);
+
+    if (prepare_only_) {
+      if (PrepareStreams(st_index) < 0) {
+        return;
+      }
+    } else {
+      InstallLowWatermarkListeners();
+      if (OpenStreams(st_index) < 0) {
+        // todo destroy streams;
+        return;
+      }
+    }
+  }
+  auto read_start = av_gettime_relative();
+  ReadStreams();
+  if (starving_) {
+    starving_ = false;
+    PrefetchScheduler::Get()->SetSourceStarving(this, false);
   }
-  OnFormatContextOpen();
 
-  ReadStreamInfo(st_index);
-  OnStreamInfoLoad(st_index);
+  auto seconds = (double)(av_gettime_relative() - read_start) / AV_TIME_BASE;
+  auto wakeups = read_event_->GetWakeupCount();
+  av_log(nullptr, AV_LOG_INFO,
+         "thread: read_source done. woke %" PRId64 " times in %.1f s, "
+         "%.2f/s.\n",
+         wakeups, seconds, seconds > 0 ? wakeups / seconds : 0.0);
+}
 
-  if (OpenStreams(st_index) < 0) {
-    // todo destroy streams;
-    return;
+// true if every audio stream has what the decoder and the audio render need.
+static bool audio_parameters_known(AVFormatContext* format_ctx) {
+  auto found = false;
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* par = format_ctx->streams[i]->codecpar;
+    if (par->codec_type != AVMEDIA_TYPE_AUDIO) {
+      continue;
+    }
+    if (par->codec_id == AV_CODEC_ID_NONE || !par->sample_rate ||
+        !par->channels) {
+      return false;
+    }
+    found = true;
+  }
+  return found;
+}
+
+static void discard_non_audio_streams(AVFormatContext* format_ctx) {
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* st = format_ctx->streams[i];
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+      st->discard = AVDISCARD_ALL;
+    }
   }
-  ReadStreams(wait_mutex);
+}
 
-  av_log(nullptr, AV_LOG_INFO, "thread: read_source done.\n");
+// what avformat_find_stream_info() would derive from the audio streams when
+// the container does not give it. a stream without a duration, such as a CBR
+// mp3 without a Xing header, is estimated from the file size and bit rate.
+//
+// @return false if a duration can not be known without find_stream_info.
+static bool fill_timings_from_streams(AVFormatContext* format_ctx) {
+  int64_t start_time = AV_NOPTS_VALUE;
+  int64_t duration = AV_NOPTS_VALUE;
+  auto file_size = format_ctx->pb ? avio_size(format_ctx->pb) : -1;
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* st = format_ctx->streams[i];
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+      continue;
+    }
+    if (st->start_time != AV_NOPTS_VALUE) {
+      auto start = av_rescale_q(st->start_time, st->time_base, AV_TIME_BASE_Q);
+      if (start_time == AV_NOPTS_VALUE || start < start_time) {
+        start_time = start;
+      }
+    }
+    if (st->duration == AV_NOPTS_VALUE) {
+      auto bit_rate = st->codecpar->bit_rate > 0 ? st->codecpar->bit_rate
+                                                 : format_ctx->bit_rate;
+      if (file_size <= 0 || bit_rate <= 0) {
+        return false;
+      }
+      st->duration = av_rescale(8 * file_size, st->time_base.den,
+                                bit_rate * (int64_t)st->time_base.num);
+    }
+    duration = FFMAX(duration, av_rescale_q(st->duration, st->time_base,
+                                            AV_TIME_BASE_Q));
+  }
+  if (format_ctx->start_time == AV_NOPTS_VALUE) {
+    format_ctx->start_time = start_time;
+  }
+  if (format_ctx->duration == AV_NOPTS_VALUE) {
+    format_ctx->duration = duration;
+  }
+  return true;
 }
 
 int DataSource::PrepareFormatContext() {
@@ -100,7 +216,47 @@ int DataSource::PrepareFormatContext() {
     auto* source = static_cast<DataSource*>(ctx);
     return source->abort_request;
   };
-  auto err = avformat_open_input(&format_ctx_, filename, in_format, nullptr);
+  if (OpenMediaIO() < 0) {
+    return -1;
+  }
+  if (io_ctx_) {
+    format_ctx_->pb = io_ctx_;
+    format_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+  auto open_start = av_gettime_relative();
+  AVDictionary* format_opts = nullptr;
+  auto* input_format = in_format;
+  for (auto& option : configuration.format_options) {
+    if (option.first == "format") {
+      if (!input_format) {
+        input_format = av_find_input_format(option.second.c_str());
+      }
+      continue;
+    }
+    if (io_ctx_ && http_io_is_protocol_option(option.first.c_str())) {
+      // taken by the io, see OpenMediaIO().
+      continue;
+    }
+    av_dict_set(&format_opts, option.first.c_str(), option.second.c_str(), 0);
+  }
+
+  ProbeResult probe_result;
+  auto probe_cache_hit = !input_format && configuration.probe_cache &&
+                         ProbeCache::Get()->Find(filename, &probe_result);
+  if (probe_cache_hit) {
+    input_format = av_find_input_format(probe_result.format_name.c_str());
+    probe_cache_hit = input_format != nullptr;
+  }
+
+  auto err =
+      avformat_open_input(&format_ctx_, filename, input_format, &format_opts);
+  AVDictionaryEntry* option =
+      av_dict_get(format_opts, "", nullptr, AV_DICT_IGNORE_SUFFIX);
+  if (option) {
+    av_log(nullptr, AV_LOG_WARNING, "format option %s not found.\n",
+           option->key);
+  }
+  av_dict_free(&format_opts);
   if (err < 0) {
     LOG(ERROR) << "can not open file " << filename << ": " << av_err_to_str(err);
     return -1;
@@ -113,12 +269,38 @@ int DataSource::PrepareFormatContext() {
   av_format_inject_global_side_data(format_ctx_);
 
   // find stream info for av file. this is useful for formats with no headers
-  // such as MPEG.
-  if (find_stream_info && avformat_find_stream_info(format_ctx_, nullptr) < 0) {
-    avformat_free_context(format_ctx_);
-    format_ctx_ = nullptr;
-    return -1;
+  // such as MPEG. skipped if the probe cache knows the file, or if only audio
+  // is played and the headers describe it: find_stream_info would decode
+  // video frames only to learn their pixel format.
+  if (probe_cache_hit) {
+    probe_cache_hit = ProbeCache::Apply(probe_result, format_ctx_);
   }
+  auto audio_only = configuration.video_disable && !configuration.audio_disable;
+  auto headers_only = !probe_cache_hit && audio_only &&
+                      audio_parameters_known(format_ctx_) &&
+                      fill_timings_from_streams(format_ctx_);
+  if (headers_only) {
+    // the demuxer skips packets of discarded streams where the container
+    // allows it, without reading them.
+    discard_non_audio_streams(format_ctx_);
+  }
+  if (find_stream_info && !probe_cache_hit && !headers_only) {
+    auto header_info = ProbeCache::GetHeaderInfo(format_ctx_);
+    if (avformat_find_stream_info(format_ctx_, nullptr) < 0) {
+      avformat_free_context(format_ctx_);
+      format_ctx_ = nullptr;
+      return -1;
+    }
+    if (configuration.probe_cache) {
+      ProbeCache::Get()->Put(filename, format_ctx_, header_info);
+    }
+  }
+  if (audio_only) {
+    discard_non_audio_streams(format_ctx_);
+  }
+  av_log(nullptr, AV_LOG_INFO, "%s: opened in %.1f ms, probe %s.\n", filename,
+         (double)(av_gettime_relative() - open_start) / 1000,
+         probe_cache_hit ? "cache hit" : headers_only ? "skipped" : "done");
 
   if (format_ctx_->pb) {
     format_ctx_->pb->eof_reached = 0;  // FIXME hack, ffplay maybe should not
@@ -133,8 +315,151 @@ int DataSource::PrepareFormatContext() {
   return 0;
 }
 
+static bool is_http_url(const char* url) {
+  auto* protocol = avio_find_protocol_name(url);
+  return protocol &&
+         (!strcmp(protocol, "http") || !strcmp(protocol, "https"));
+}
+
+int DataSource::OpenMediaIO() {
+  for (auto& option : configuration.format_options) {
+    if (http_io_is_protocol_option(option.first.c_str())) {
+      av_dict_set(&protocol_options_, option.first.c_str(),
+                  option.second.c_str(), 0);
+    }
+  }
+  std::unique_ptr<MediaIO> io;
+  auto open_http = [this]() -> std::unique_ptr<MediaIO> {
+    if (configuration.http_connections > 1) {
+      return SegmentedIO::Open(filename, &format_ctx_->interrupt_callback,
+                               protocol_options_,
+                               configuration.http_connections);
+    }
+    return http_io_open(filename, &format_ctx_->interrupt_callback, 0,
+                        protocol_options_, nullptr);
+  };
+  auto open_network = [this, open_http]() -> std::unique_ptr<MediaIO> {
+    if (configuration.reconnect_timeout_ms <= 0) {
+      return open_http();
+    }
+    auto io = ReconnectIO::Create(
+        open_http, (int64_t)configuration.reconnect_timeout_ms * 1000);
+    reconnect_io_ = io.get();
+    return io;
+  };
+  network_source_ = !memory_source_ && is_http_url(filename);
+  if (network_source_) {
+    PrefetchScheduler::Get()->OnSourceOpened(filename);
+  }
+  auto& emulation = !network_emulation_.empty()
+                        ? network_emulation_
+                        : configuration.network_emulation;
+  if (memory_source_) {
+    io.reset(new MemoryIO(memory_source_));
+  } else if (!emulation.empty()) {
+    io = OpenEmulatedIO(emulation);
+    if (!io) {
+      return -1;
+    }
+  } else if (configuration.cache_network_streams && is_http_url(filename)) {
+    std::unique_ptr<MediaIO> uncached_source;
+    auto cache_io = CacheIO::Create(filename, open_network, &uncached_source);
+    if (cache_io) {
+      cache_io_ = cache_io.get();
+      io = std::move(cache_io);
+    } else if (uncached_source) {
+      // the size is unknown, read the opened source without the cache.
+      io = std::move(uncached_source);
+    } else {
+      // the source it opened, if any, is gone.
+      reconnect_io_ = nullptr;
+    }
+  } else if (media_io_is_local_file(filename)) {
+    if (configuration.mmap_local_files) {
+      io = MmapIO::Create(filename);
+    }
+    if (!io && configuration.read_ahead_window_mb > 0) {
+      io = ReadAheadIO::Create(
+          filename, &format_ctx_->interrupt_callback,
+          (int64_t)configuration.read_ahead_window_mb * 1024 * 1024);
+      if (!io) {
+        LOG(ERROR) << "can not open file " << filename;
+        return -1;
+      }
+    }
+  }
+  if (!io && is_http_url(filename) &&
+      (configuration.http_connections > 1 ||
+       HttpConnectionPool::Get()->IsEnabled())) {
+    // not cached, the cache is disabled or failed to open the source.
+    io = open_network();
+    if (!io) {
+      return -1;
+    }
+  }
+  if (configuration.decrypt_aes_ctr) {
+    if (!io) {
+      AVDictionary* url_options = nullptr;
+      av_dict_copy(&url_options, protocol_options_, 0);
+      io = UrlIO::Open(filename, &format_ctx_->interrupt_callback,
+                       &url_options);
+      av_dict_free(&url_options);
+      if (!io) {
+        return -1;
+      }
+    }
+    io = DecryptIO::Create(std::move(io), configuration.decryption_key,
+                           configuration.decryption_iv);
+    if (!io) {
+      return -1;
+    }
+  }
+  if (!io) {
+    // let ffmpeg open the url itself.
+    return 0;
+  }
+  io_ctx_ = CreateAVIOContext(std::move(io));
+  if (!io_ctx_) {
+    // they went with |io|.
+    cache_io_ = nullptr;
+    reconnect_io_ = nullptr;
+    av_log(nullptr, AV_LOG_FATAL, "Could not allocate io context.\n");
+    return -1;
+  }
+  return 0;
+}
+
+std::unique_ptr<MediaIO> DataSource::OpenEmulatedIO(
+    const std::string& options) {
+  NetworkProfile profile;
+  if (NetworkProfile::Parse(options, &profile) < 0) {
+    return nullptr;
+  }
+  av_log(nullptr, AV_LOG_INFO, "%s: emulating network %s.\n", filename,
+         options.c_str());
+  auto emulator = std::make_shared<NetworkEmulator>(profile);
+  auto open_emulated = [this, emulator]() -> std::unique_ptr<MediaIO> {
+    auto source =
+        UrlIO::Open(filename, &format_ctx_->interrupt_callback, nullptr);
+    if (!source) {
+      return nullptr;
+    }
+    return NetworkEmulationIO::Create(std::move(source), emulator);
+  };
+  if (configuration.reconnect_timeout_ms <= 0) {
+    return open_emulated();
+  }
+  // emulated disconnects are recovered like real ones.
+  auto io = ReconnectIO::Create(
+      open_emulated, (int64_t)configuration.reconnect_timeout_ms * 1000);
+  reconnect_io_ = io.get();
+  return io;
+}
+
 void DataSource::OnFormatContextOpen() {
-  msg_ctx->NotifyMsg(FFP_MSG_AV_METADATA_LOADED);
+  if (msg_ctx) {
+    msg_ctx->NotifyMsg(FFP_MSG_AV_METADATA_LOADED);
+  }
 
   /* if seeking requested, we execute it */
   if (start_time != AV_NOPTS_VALUE) {
@@ -155,6 +480,7 @@ void DataSource::OnFormatContextOpen() {
   if (!infinite_buffer && realtime_) {
     infinite_buffer = true;
   }
+  buffering_policy->SetSourceBitRate(format_ctx_->bit_rate);
 
   if (configuration.show_status) {
     av_dump_format(format_ctx_, 0, filename, 0);
@@ -233,6 +559,129 @@ int DataSource::OpenStreams(const int st_index[AVMEDIA_TYPE_NB]) {
   return 0;
 }
 
+int DataSource::Prepare(int64_t buffer_ms, int64_t max_bytes) {
+  prepare_only_ = true;
+  prepare_buffer_ms_ = buffer_ms;
+  prepare_max_bytes_ = max_bytes;
+  audio_queue = std::make_shared<PacketQueue>();
+  video_queue = std::make_shared<PacketQueue>();
+  subtitle_queue = std::make_shared<PacketQueue>();
+  prepared_queues_[AVMEDIA_TYPE_AUDIO] = audio_queue;
+  prepared_queues_[AVMEDIA_TYPE_VIDEO] = video_queue;
+  if (memory_account) {
+    for (auto& queue : {audio_queue, video_queue, subtitle_queue}) {
+      memory_account->AddUsage([queue]() -> int64_t { return queue->size; });
+    }
+  }
+  if (!buffering_policy) {
+    buffering_policy = std::make_shared<AdaptiveBufferingPolicy>();
+  }
+  return Open();
+}
+
+int DataSource::PrepareStreams(const int st_index[AVMEDIA_TYPE_NB]) {
+  // subtitles are not rendered, no decoder to prepare.
+  for (auto type : {AVMEDIA_TYPE_AUDIO, AVMEDIA_TYPE_VIDEO}) {
+    auto index = st_index[type];
+    if (index < 0 || index >= (int)format_ctx_->nb_streams) {
+      continue;
+    }
+    auto* stream = format_ctx_->streams[index];
+    unique_ptr_d<AVCodecContext> codec_ctx(nullptr, nullptr);
+    if (DecoderContext::OpenCodec(stream, 0, false, &codec_ctx) < 0) {
+      continue;
+    }
+    stream->discard = AVDISCARD_DEFAULT;
+    prepared_codecs_.emplace(index, std::move(codec_ctx));
+    auto& queue = prepared_queues_[type];
+    queue->time_base = stream->time_base;
+    queue->Start();
+    if (type == AVMEDIA_TYPE_AUDIO) {
+      audio_stream_index = index;
+      audio_stream_ = stream;
+    } else {
+      video_stream_index = index;
+      video_stream_ = stream;
+    }
+  }
+  if (prepared_codecs_.empty()) {
+    av_log(nullptr, AV_LOG_ERROR, "%s: no stream to prepare.\n", filename);
+    return -1;
+  }
+  queue_attachments_req_ = true;
+  return 0;
+}
+
+int DataSource::OpenPrepared() {
+  if (read_tid) {
+    // already stopped by itself.
+    read_tid->join();
+    delete read_tid;
+    read_tid = nullptr;
+  }
+  prepare_only_ = false;
+  if (msg_ctx) {
+    msg_ctx->NotifyMsg(FFP_MSG_AV_METADATA_LOADED);
+  }
+  buffering_policy->SetSourceBitRate(format_ctx_->bit_rate);
+  InstallLowWatermarkListeners();
+
+  std::pair<AVMediaType, int> streams[] = {
+      {AVMEDIA_TYPE_AUDIO, audio_stream_index},
+      {AVMEDIA_TYPE_VIDEO, video_stream_index}};
+  audio_stream_index = video_stream_index = -1;
+  audio_stream_ = video_stream_ = nullptr;
+  for (auto& item : streams) {
+    if (item.second < 0) {
+      continue;
+    }
+    OpenComponentStream(item.second, item.first);
+    auto started = item.first == AVMEDIA_TYPE_AUDIO
+                       ? audio_stream_index >= 0
+                       : video_stream_index >= 0;
+    if (!started) {
+      format_ctx_->streams[item.second]->discard = AVDISCARD_ALL;
+      continue;
+    }
+    // the decoder started the player's queue, hand it what was buffered.
+    auto& queue = item.first == AVMEDIA_TYPE_AUDIO ? audio_queue : video_queue;
+    Packet pkt;
+    int serial;
+    while (prepared_queues_[item.first]->DequeuePacket(pkt, &serial) == 0) {
+      if (!pkt.IsFlush()) {
+        queue->Put(std::move(pkt));
+      }
+    }
+  }
+  prepared_codecs_.clear();
+  for (auto& queue : prepared_queues_) {
+    queue = nullptr;
+  }
+  if (video_stream_index < 0 && audio_stream_index < 0) {
+    av_log(nullptr, AV_LOG_FATAL, "%s: can not open prepared streams.\n",
+           filename);
+    return -1;
+  }
+  read_tid = new std::thread(&DataSource::ReadThread, this);
+  return 0;
+}
+
+int64_t DataSource::GetBufferedBytes() {
+  return (int64_t)audio_queue->size + video_queue->size + subtitle_queue->size;
+}
+
+void DataSource::InstallLowWatermarkListeners() {
+  auto read_event = read_event_;
+  auto policy = buffering_policy;
+  for (auto& queue : {audio_queue, video_queue, subtitle_queue}) {
+    queue->SetLowWatermarkListener(
+        [policy](const BufferLevel& level) {
+          return policy->HasEnoughBuffered(level);
+        },
+        [read_event]() { read_event->Notify(); });
+  }
+}
+
 int DataSource::OpenComponentStream(int stream_index, AVMediaType media_type) {
   if (decoder_ctx == nullptr) {
     av_log(nullptr, AV_LOG_ERROR,
@@ -249,11 +698,11 @@ int DataSource::OpenComponentStream(int stream_index, AVMediaType media_type) {
   switch (media_type) {
     case AVMEDIA_TYPE_VIDEO:
       params = std::make_unique<DecodeParams>(
-          video_queue, continue_read_thread_, &format_ctx_, stream_index);
+          video_queue, read_event_, &format_ctx_, stream_index);
       break;
     case AVMEDIA_TYPE_AUDIO:
       params = std::make_unique<DecodeParams>(
-          audio_queue, continue_read_thread_, &format_ctx_, stream_index);
+          audio_queue, read_event_, &format_ctx_, stream_index);
       params->audio_follow_stream_start_pts =
           (format_ctx_->iformat->flags &
            (AVFMT_NOBINSEARCH | AVFMT_NOGENSEARCH | AVFMT_NO_BYTE_SEEK)) &&
@@ -261,13 +710,22 @@ int DataSource::OpenComponentStream(int stream_index, AVMediaType media_type) {
       break;
     case AVMEDIA_TYPE_SUBTITLE:
       params = std::make_unique<DecodeParams>(
-          subtitle_queue, continue_read_thread_, &format_ctx_, stream_index);
+          subtitle_queue, read_event_, &format_ctx_, stream_index);
       break;
     default:
       return -1;
   }
 
-  if (decoder_ctx->StartDecoder(std::move(params)) >= 0) {
+  auto prepared_codec = prepared_codecs_.find(stream_index);
+  int ret;
+  if (prepared_codec != prepared_codecs_.end()) {
+    ret = decoder_ctx->StartDecoder(std::move(prepared_codec->second),
+                                    std::move(params));
+    prepared_codecs_.erase(prepared_codec);
+  } else {
+    ret = decoder_ctx->StartDecoder(std::move(params));
+  }
+  if (ret >= 0) {
     switch (media_type) {
       case AVMEDIA_TYPE_VIDEO: {
         video_stream_index = stream_index;
@@ -294,9 +752,9 @@ int DataSource::OpenComponentStream(int stream_index, AVMediaType media_type) {
   return 0;
 }
 
-void DataSource::ReadStreams(std::mutex& read_mutex) {
+void DataSource::ReadStreams() {
   bool last_paused = false;
-  AVPacket pkt_data, *pkt = &pkt_data;
+  Packet pkt;
   for (;;) {
     if (abort_request) {
       DLOG(INFO) << "abort_request";
@@ -322,9 +780,18 @@ void DataSource::ReadStreams(std::mutex& read_mutex) {
 #endif
     ProcessSeekRequest();
     ProcessAttachedPicture();
+    ReportStarving();
+    if (prepare_only_ && (eof || !isNeedReadMore())) {
+      // buffered enough, OpenPrepared() resumes on a new thread.
+      prepared_ = true;
+      break;
+    }
     if (!isNeedReadMore()) {
-      std::unique_lock<std::mutex> lock(read_mutex);
-      continue_read_thread_->wait(lock);
+      // check again once armed, the queues may have drained in between.
+      ArmLowWatermarks();
+      if (!isNeedReadMore()) {
+        WaitReadEvent();
+      }
       continue;
     }
     if (IsReadComplete()) {
@@ -340,9 +807,11 @@ void DataSource::ReadStreams(std::mutex& read_mutex) {
       //        stream_toggle_pause(player->is);
       //      }
     }
-    msg_ctx->NotifyMsg(MEDIA_MSG_DO_SOME_WORK);
+    if (msg_ctx) {
+      msg_ctx->NotifyMsg(MEDIA_MSG_DO_SOME_WORK);
+    }
     {
-      auto ret = ProcessReadFrame(pkt, read_mutex);
+      auto ret = ProcessReadFrame(&pkt);
       if (ret < 0) {
         DLOG(INFO) << "ProcessReadFrame failed";
         break;
@@ -351,7 +820,13 @@ void DataSource::ReadStreams(std::mutex& read_mutex) {
       }
     }
 
-    ProcessQueuePacket(pkt);
+    ProcessQueuePacket(std::move(pkt));
+  }
+}
+
+void DataSource::WaitReadEvent() {
+  if (!read_event_->WaitFor(DO_SOME_WORK_INTERVAL_US) && msg_ctx) {
+    msg_ctx->NotifyMsg(MEDIA_MSG_DO_SOME_WORK);
   }
 }
 
@@ -360,6 +835,29 @@ void DataSource::ProcessSeekRequest() {
     return;
   }
   auto seek_target = seek_position;
+  auto seek_start = av_gettime_relative();
+  seek_count_++;
+  // a trim must not keep the packets it is meant to drop.
+  auto trim = trim_req_;
+  trim_req_ = false;
+  if (!trim && SeekInBufferedPackets(seek_target)) {
+    auto cost = av_gettime_relative() - seek_start;
+    seek_buffer_hits_++;
+    buffer_seek_time_ += cost;
+    auto demuxer_seeks = seek_count_ - seek_buffer_hits_;
+    av_log(nullptr, AV_LOG_INFO,
+           "seek served from buffer in %.3f ms. hit %d/%d, avg %.3f ms "
+           "(demuxer seek avg %.3f ms)\n",
+           cost / 1000.0, seek_buffer_hits_, seek_count_,
+           buffer_seek_time_ / 1000.0 / seek_buffer_hits_,
+           demuxer_seeks ? demuxer_seek_time_ / 1000.0 / demuxer_seeks : 0.0);
+    if (ext_clock) {
+      ext_clock->SetClock(seek_target / (double)AV_TIME_BASE, 0);
+    }
+    seek_req_ = false;
+    queue_attachments_req_ = true;
+    return;
+  }
   auto ret =
       avformat_seek_file(format_ctx_, -1, INT64_MIN, seek_target, INT64_MAX, 0);
   if (ret < 0) {
@@ -367,16 +865,13 @@ void DataSource::ProcessSeekRequest() {
            filename, av_err_to_str(ret));
   } else {
     if (audio_stream_index >= 0 && audio_queue) {
-      audio_queue->Flush();
-      audio_queue->Put(PacketQueue::GetFlushPacket());
+      audio_queue->BumpSerial();
     }
     if (subtitle_stream_index >= 0 && subtitle_queue) {
-      subtitle_queue->Flush();
-      subtitle_queue->Put(PacketQueue::GetFlushPacket());
+      subtitle_queue->BumpSerial();
     }
     if (video_stream_index >= 0 && video_queue) {
-      video_queue->Flush();
-      video_queue->Put(PacketQueue::GetFlushPacket());
+      video_queue->BumpSerial();
     }
     if (ext_clock) {
       ext_clock->SetClock(seek_target / (double)AV_TIME_BASE, 0);
@@ -385,23 +880,57 @@ void DataSource::ProcessSeekRequest() {
   seek_req_ = false;
   queue_attachments_req_ = true;
   eof = false;
+  demuxer_seek_time_ += av_gettime_relative() - seek_start;
 
   // TODO notify on seek complete.
 }
 
+bool DataSource::SeekInBufferedPackets(int64_t target) {
+  std::vector<std::pair<AVStream*, std::shared_ptr<PacketQueue>>> streams;
+  if (audio_stream_index >= 0) {
+    streams.emplace_back(audio_stream_, audio_queue);
+  }
+  if (video_stream_index >= 0 && !VideoStreamIsAttachedPic()) {
+    streams.emplace_back(video_stream_, video_queue);
+  }
+  if (subtitle_stream_index >= 0) {
+    streams.emplace_back(subtitle_stream_, subtitle_queue);
+  }
+  if (streams.empty()) {
+    return false;
+  }
+  for (auto& item : streams) {
+    auto ts = av_rescale_q(target, av_time_base_q_, item.first->time_base);
+    if (!item.second->CanSeekInBuffer(ts)) {
+      return false;
+    }
+  }
+  for (auto& item : streams) {
+    auto ts = av_rescale_q(target, av_time_base_q_, item.first->time_base);
+    if (!item.second->SeekInBuffer(ts)) {
+      // fallback to demuxer seek, which flushes all queues anyway.
+      return false;
+    }
+  }
+  if (VideoStreamIsAttachedPic()) {
+    video_queue->BumpSerial();
+  }
+  return true;
+}
+
 void DataSource::ProcessAttachedPicture() {
   if (!queue_attachments_req_) {
     return;
   }
   if (video_stream_ &&
       video_stream_->disposition & AV_DISPOSITION_ATTACHED_PIC) {
-    AVPacket copy;
-    auto ret = av_packet_ref(&copy, &video_stream_->attached_pic);
+    Packet copy;
+    auto ret = copy.Ref(&video_stream_->attached_pic);
     if (ret < 0) {
       av_log(nullptr, AV_LOG_ERROR, "%s: error to read attached pic. error: %s",
              filename, av_err_to_str(ret));
     } else {
-      video_queue->Put(&copy);
+      video_queue->Put(std::move(copy));
       video_queue->PutNullPacket(video_stream_index);
     }
   }
@@ -409,24 +938,73 @@ void DataSource::ProcessAttachedPicture() {
 }
 
 bool DataSource::isNeedReadMore() {
+  // applies to realtime sources too, |infinite_buffer| only skips the
+  // per stream limits below.
+  if (memory_account &&
+      memory_account->IsOverBudget(audio_queue->size + video_queue->size +
+                                   subtitle_queue->size)) {
+    return false;
+  }
+  if (prepare_only_) {
+    auto* main_queue = audio_stream_ ? audio_queue.get() : video_queue.get();
+    return GetBufferedBytes() < prepare_max_bytes_ &&
+           main_queue->GetBufferLevel().duration_ms < prepare_buffer_ms_;
+  }
   if (infinite_buffer) {
     return true;
   }
-  if (audio_queue->size + video_queue->size + subtitle_queue->size >
-      MAX_QUEUE_SIZE) {
-    return false;
-  }
-  if (stream_has_enough_packets(audio_stream_, audio_stream_index,
+  auto* policy = buffering_policy.get();
+  if (stream_has_enough_packets(policy, audio_stream_, audio_stream_index,
                                 audio_queue) &&
-      stream_has_enough_packets(video_stream_, video_stream_index,
+      stream_has_enough_packets(policy, video_stream_, video_stream_index,
                                 video_queue) &&
-      stream_has_enough_packets(subtitle_stream_, subtitle_stream_index,
-                                subtitle_queue)) {
+      stream_has_enough_packets(policy, subtitle_stream_,
+                                subtitle_stream_index, subtitle_queue)) {
     return false;
   }
   return true;
 }
 
+void DataSource::ReportStarving() {
+  if (!network_source_) {
+    return;
+  }
+  auto* queue = audio_stream_   ? audio_queue.get()
+                : video_stream_ ? video_queue.get()
+                                : nullptr;
+  auto starving = queue && buffering_policy && !prepare_only_ && !paused &&
+                  !eof &&
+                  !buffering_policy->IsReadyToPlay(queue->GetBufferLevel());
+  if (starving != starving_) {
+    starving_ = starving;
+    PrefetchScheduler::Get()->SetSourceStarving(this, starving);
+  }
+}
+
+void DataSource::ArmLowWatermarks() {
+  auto over_budget =
+      memory_account &&
+      memory_account->IsOverBudget(audio_queue->size + video_queue->size +
+                                   subtitle_queue->size);
+  std::pair<AVStream*, std::shared_ptr<PacketQueue>> streams[] = {
+      {audio_stream_, audio_queue},
+      {video_stream_, video_queue},
+      {subtitle_stream_, subtitle_queue}};
+  for (auto& item : streams) {
+    auto* st = item.first;
+    auto& queue = item.second;
+    if (!st || (st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+      continue;
+    }
+    if (!over_budget) {
+      queue->ArmLowWatermark();
+    } else if (queue->size > 0) {
+      // the watermark may be far below, wake once half of it is played.
+      queue->ArmLowWatermark(queue->size / 2);
+    }
+  }
+}
+
 bool DataSource::IsReadComplete() const {
   if (paused) {
     return false;
@@ -434,8 +1012,24 @@ bool DataSource::IsReadComplete() const {
   return eof;
 }
 
-int DataSource::ProcessReadFrame(AVPacket* pkt, std::mutex& read_mutex) {
-  auto ret = av_read_frame(format_ctx_, pkt);
+int DataSource::ProcessReadFrame(Packet* pkt) {
+  auto read_start = av_gettime_relative();
+  auto ret = av_read_frame(format_ctx_, pkt->get());
+  if (ret >= 0) {
+    // only the main stream counts media duration, streams play in parallel.
+    auto main_stream_index =
+        video_stream_index >= 0 && !VideoStreamIsAttachedPic()
+            ? video_stream_index
+            : audio_stream_index;
+    int64_t duration_ms = 0;
+    if ((*pkt)->stream_index == main_stream_index) {
+      duration_ms = av_rescale_q(
+          (*pkt)->duration,
+          format_ctx_->streams[main_stream_index]->time_base, {1, 1000});
+    }
+    buffering_policy->OnPacketRead((*pkt)->size, duration_ms,
+                                   av_gettime_relative() - read_start);
+  }
   if (ret < 0) {
     if ((ret == AVERROR_EOF || avio_feof(format_ctx_->pb)) && !eof) {
       if (video_stream_index >= 0) {
@@ -452,16 +1046,28 @@ int DataSource::ProcessReadFrame(AVPacket* pkt, std::mutex& read_mutex) {
     if (format_ctx_->pb && format_ctx_->pb->error) {
       return -1;
     }
-    std::unique_lock<std::mutex> lock(read_mutex);
-    continue_read_thread_->wait_for(lock, std::chrono::milliseconds(10));
+    if (eof && prepare_only_) {
+      return 1;
+    }
+    if (eof) {
+      // nothing to read until a seek, the decoders draining the queues wake
+      // us too so that the player sees the end.
+      WaitReadEvent();
+    } else {
+      read_retry_delay_us_ = FFMIN(
+          FFMAX(read_retry_delay_us_ * 2, READ_RETRY_MIN_DELAY_US),
+          READ_RETRY_MAX_DELAY_US);
+      read_event_->WaitFor(read_retry_delay_us_);
+    }
     return 1;
   } else {
     eof = false;
+    read_retry_delay_us_ = 0;
   }
   return 0;
 }
 
-void DataSource::ProcessQueuePacket(AVPacket* pkt) {
+void DataSource::ProcessQueuePacket(Packet pkt) {
   auto stream_start_time = format_ctx_->streams[pkt->stream_index]->start_time;
   if (stream_start_time == AV_NOPTS_VALUE) {
     stream_start_time = 0;
@@ -474,14 +1080,12 @@ void DataSource::ProcessQueuePacket(AVPacket* pkt) {
   bool pkt_in_play_range =
       duration == AV_NOPTS_VALUE || diff <= duration / (double)AV_TIME_BASE;
   if (pkt->stream_index == audio_stream_index && pkt_in_play_range) {
-    audio_queue->Put(pkt);
+    audio_queue->Put(std::move(pkt));
   } else if (pkt->stream_index == video_stream_index && pkt_in_play_range &&
              !(video_stream_->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
-    video_queue->Put(pkt);
+    video_queue->Put(std::move(pkt));
   } else if (pkt->stream_index == subtitle_stream_index && pkt_in_play_range) {
-    subtitle_queue->Put(pkt);
-  } else {
-    av_packet_unref(pkt);
+    subtitle_queue->Put(std::move(pkt));
   }
 }
 
@@ -508,7 +1112,9 @@ void DataSource::Seek(double position) {
     position = (double)FFMAX(format_ctx_->start_time, target);
   }
   target = FFMAX(0, target);
-  target = FFMIN(target, format_ctx_->duration);
+  if (format_ctx_->duration != AV_NOPTS_VALUE) {
+    target = FFMIN(target, format_ctx_->duration);
+  }
   av_log(nullptr, AV_LOG_INFO, "data source seek to %0.2f \n", position);
 
   if (!seek_req_) {
@@ -518,16 +1124,34 @@ void DataSource::Seek(double position) {
     // TODO update buffered position
     //        player->buffered_position = -1;
     //        change_player_state(player, BUFFERING);
-    continue_read_thread_->notify_all();
+    read_event_->Notify();
   }
 }
 
+void DataSource::TrimBuffers(double position) {
+  if (!format_ctx_ || realtime_ || seek_req_) {
+    return;
+  }
+  av_log(nullptr, AV_LOG_INFO, "%s: dropping buffers over memory budget.\n",
+         filename);
+  trim_req_ = true;
+  Seek(position);
+}
+
+void DataSource::SetPaused(bool pause) {
+  paused = pause;
+  read_event_->Notify();
+}
+
 double DataSource::GetSeekPosition() const {
   return double_t(seek_position) / (AV_TIME_BASE);
 }
 
 double DataSource::GetDuration() {
   CHECK_VALUE_WITH_RETURN(format_ctx_, -1);
+  if (format_ctx_->duration == AV_NOPTS_VALUE) {
+    return -1;
+  }
   return format_ctx_->duration / (double)AV_TIME_BASE;
 }
 
@@ -574,6 +1198,43 @@ const char* DataSource::GetMetadataDict(const char* key) {
   return nullptr;
 }
 
+int64_t DataSource::GetPropertyInt64(int property, int64_t default_value) {
+  auto* cache_io = cache_io_.load();
+  if (!cache_io) {
+    return default_value;
+  }
+  switch (property) {
+    case FFP_PROP_INT64_CACHE_STATISTIC_PHYSICAL_POS:
+      return cache_io->GetPhysicalPosition();
+    case FFP_PROP_INT64_CACHE_STATISTIC_FILE_FORWARDS:
+      return cache_io->GetCachedForwards();
+    case FFP_PROP_INT64_CACHE_STATISTIC_FILE_POS:
+      return cache_io->GetPosition();
+    case FFP_PROP_INT64_CACHE_STATISTIC_COUNT_BYTES:
+      return cache_io->GetCachedBytes();
+    case FFP_PROP_INT64_LOGICAL_FILE_SIZE:
+      return cache_io->GetContentSize();
+    case FFP_PROP_INT64_SHARE_CACHE_DATA:
+      return cache_io->IsShared();
+    default:
+      return default_value;
+  }
+}
+
+void DataSource::SetPropertyInt64(int property, int64_t value) {
+  switch (property) {
+    case FFP_PROP_INT64_IMMEDIATE_RECONNECT: {
+      auto* reconnect_io = reconnect_io_.load();
+      if (reconnect_io && value) {
+        reconnect_io->ReconnectNow();
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
 bool DataSource::VideoStreamIsAttachedPic() {
   return video_stream_ != nullptr && video_stream_->disposition & AV_DISPOSITION_ATTACHED_PIC;
 }
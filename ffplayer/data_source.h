@@ -5,14 +5,23 @@
 #ifndef FFPLAYER_FFP_DATA_SOURCE_H
 #define FFPLAYER_FFP_DATA_SOURCE_H
 
+#include <atomic>
 #include <condition_variable>
 #include <functional>
+#include <map>
+#include <string>
 #include <thread>
 
+#include "buffering_policy.h"
+#include "cache_io.h"
 #include "decoder_ctx.h"
 #include "ffp_packet_queue.h"
 #include "ffplayer.h"
 #include "media_clock.h"
+#include "memory_io.h"
+#include "memory_governor.h"
+#include "read_event.h"
+#include "reconnect_io.h"
 
 extern "C" {
 #include "libavformat/avformat.h"
@@ -36,16 +45,29 @@ class DataSource {
 
   std::shared_ptr<MessageContext> msg_ctx;
 
-  Clock* ext_clock;
+  Clock* ext_clock = nullptr;
 
   std::shared_ptr<DecoderContext> decoder_ctx;
 
+  std::shared_ptr<MemoryAccount> memory_account;
+
+  std::shared_ptr<BufferingPolicy> buffering_policy;
+
   int read_pause_return;
 
-  bool paused = false;
+  std::atomic<bool> paused{false};
 
   void Seek(double position);
 
+  /** Pause or resume reading network sources, wakes the read thread. */
+  void SetPaused(bool pause);
+
+  /**
+   * Drop the buffered packets and frames to release memory, and read again
+   * from |position| in seconds. Not done for realtime streams.
+   */
+  void TrimBuffers(double position);
+
   double GetDuration();
 
   int GetChapterCount();
@@ -56,27 +78,68 @@ class DataSource {
 
   const char* GetMetadataDict(const char* key);
 
+  /**
+   * @return value of a FFP_PROP_INT64_* property of the source, such as the
+   * cache statistic, |default_value| if not available.
+   */
+  int64_t GetPropertyInt64(int property, int64_t default_value);
+
+  /**
+   * Set a FFP_PROP_INT64_* property of the source. A non zero
+   * FFP_PROP_INT64_IMMEDIATE_RECONNECT drops the network connection and
+   * reconnects at once.
+   */
+  void SetPropertyInt64(int property, int64_t value);
+
  private:
   char* filename;
   AVInputFormat* in_format;
-  std::shared_ptr<std::condition_variable_any> continue_read_thread_;
+  std::shared_ptr<ReadEvent> read_event_;
   std::thread* read_tid = nullptr;
   bool abort_request = false;
   AVFormatContext* format_ctx_ = nullptr;
+  // custom io of |format_ctx_|, null if ffmpeg opens the url itself.
+  AVIOContext* io_ctx_ = nullptr;
+  // read instead of |filename| if not null.
+  std::shared_ptr<MemorySource> memory_source_;
+  // part of |io_ctx_|, null if the source is not cached.
+  std::atomic<CacheIO*> cache_io_{nullptr};
+  // part of |io_ctx_|, null if the source does not reconnect.
+  std::atomic<ReconnectIO*> reconnect_io_{nullptr};
+  // options of |configuration.format_options| for the http protocol, given
+  // to the io opened in OpenMediaIO().
+  AVDictionary* protocol_options_ = nullptr;
+  // NetworkProfile options of a "netem:" url, |filename| is read through the
+  // emulated link.
+  std::string network_emulation_;
   bool realtime_ = false;
 
+  // preparation, see Prepare().
+  bool prepare_only_ = false;
+  int64_t prepare_buffer_ms_ = 0;
+  int64_t prepare_max_bytes_ = 0;
+  std::atomic<bool> prepared_{false};
+  // stream index -> codec opened by Prepare().
+  std::map<int, unique_ptr_d<AVCodecContext>> prepared_codecs_;
+  // queues filled by Prepare(), by media type.
+  std::shared_ptr<PacketQueue> prepared_queues_[AVMEDIA_TYPE_NB];
+
   int audio_stream_index = -1;
   int video_stream_index = -1;
   int subtitle_stream_index = -1;
 
   // request for seek.
   bool seek_req_ = false;
+  // the requested seek drops the buffers, see TrimBuffers().
+  bool trim_req_ = false;
   int64_t seek_position = 0;
 
   // request for attached_pic.
   bool queue_attachments_req_ = false;
 
   bool eof = false;
+  // wait before retrying a failed read, doubled on each failure.
+  int64_t read_retry_delay_us_ = 0;
 
   AVStream* video_stream_ = nullptr;
   AVStream* audio_stream_ = nullptr;
@@ -84,16 +147,54 @@ class DataSource {
 
   int64_t duration = AV_NOPTS_VALUE;
 
+  // read over http, prefetching yields while it is |starving_|.
+  bool network_source_ = false;
+  bool starving_ = false;
+
+  // seek statistic.
+  int seek_count_ = 0;
+  int seek_buffer_hits_ = 0;
+  int64_t demuxer_seek_time_ = 0;
+  int64_t buffer_seek_time_ = 0;
+
   // buffer infinite.
   bool infinite_buffer = false;
 
  public:
   DataSource(const char* filename, AVInputFormat* format);
 
+  /**
+   * Play media held in memory by the caller.
+   */
+  DataSource(std::shared_ptr<MemorySource> source, AVInputFormat* format);
+
   ~DataSource();
 
   int Open();
 
+  /**
+   * Open the source and buffer its first packets on the read thread, without
+   * decoders or renders, until OpenPrepared(). Only |configuration|,
+   * |memory_account| and |buffering_policy| need to be set before.
+   *
+   * @param buffer_ms media duration to buffer.
+   * @param max_bytes bytes of packets to buffer at most.
+   */
+  int Prepare(int64_t buffer_ms, int64_t max_bytes);
+
+  /** @return true once Prepare() buffered enough and stopped reading. */
+  bool IsPrepared() const { return prepared_; }
+
+  /**
+   * Start playing a prepared source once the player set its fields: the
+   * buffered packets move to the player's queues, the decoders start with
+   * the codecs opened by Prepare() and reading resumes.
+   */
+  int OpenPrepared();
+
+  /** @return bytes of packets waiting for the decoders. */
+  int64_t GetBufferedBytes();
+
   bool ContainVideoStream();
 
   bool ContainAudioStream();
@@ -111,6 +212,12 @@ class DataSource {
  private:
   int PrepareFormatContext();
 
+  // create |io_ctx_| if |filename| is read through a MediaIO.
+  int OpenMediaIO();
+
+  // read |filename| through a NetworkEmulationIO configured by |options|.
+  std::unique_ptr<MediaIO> OpenEmulatedIO(const std::string& options);
+
   void OnFormatContextOpen();
 
   int ReadStreamInfo(int st_index[AVMEDIA_TYPE_NB]);
@@ -121,19 +228,39 @@ class DataSource {
 
   int OpenStreams(const int st_index[AVMEDIA_TYPE_NB]);
 
+  // open the codecs of the selected streams without starting decoders.
+  int PrepareStreams(const int st_index[AVMEDIA_TYPE_NB]);
+
+  void InstallLowWatermarkListeners();
+
   int OpenComponentStream(int stream_index, AVMediaType media_type);
 
-  void ReadStreams(std::mutex& read_mutex);
+  void ReadStreams();
 
   void ProcessSeekRequest();
 
+  // Try to serve seek from packets already in (or retained by) queues.
+  bool SeekInBufferedPackets(int64_t target);
+
   void ProcessAttachedPicture();
 
   bool isNeedReadMore();
 
-  int ProcessReadFrame(AVPacket* pkt, std::mutex& read_mutex);
+  // let the decoders wake the read thread once the queues need more packets.
+  void ArmLowWatermarks();
+
+  // tell the PrefetchScheduler whether the buffer is below the level needed
+  // to play.
+  void ReportStarving();
+
+  // sleep until |read_event_| is notified. the player is meanwhile kept
+  // checking for its end and for rebuffering: without an audio render, the
+  // read loop is all that drives MediaPlayer::DoSomeWork().
+  void WaitReadEvent();
+
+  int ProcessReadFrame(Packet* pkt);
 
-  void ProcessQueuePacket(AVPacket* pkt);
+  void ProcessQueuePacket(Packet pkt);
 };
 
 #endif  // FFPLAYER_FFP_DATA_SOURCE_H
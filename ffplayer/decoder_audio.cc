@@ -11,23 +11,22 @@ const char* AudioDecoder::debug_label() {
 }
 
 int AudioDecoder::DecodeThread() {
-  AVFrame* frame = av_frame_alloc();
+  auto frame = MakeFrame();
   if (!frame) {
     return AVERROR(ENOMEM);
   }
   audio_render_->audio_queue_serial = &queue()->serial;
   do {
-    auto got_frame = DecodeFrame(frame, nullptr);
+    auto got_frame = DecodeFrame(frame.get(), nullptr);
     if (got_frame < 0) {
       break;
     }
     if (got_frame) {
-      if (audio_render_->PushFrame(frame, pkt_serial) < 0) {
+      if (audio_render_->PushFrame(frame.get(), pkt_serial) < 0) {
         break;
       }
     }
   } while (true);
-  av_frame_free(&frame);
   return 0;
 }
 
@@ -8,11 +8,11 @@
 
 DecodeParams::DecodeParams(
     std::shared_ptr<PacketQueue> pkt_queue_,
-    std::shared_ptr<std::condition_variable_any> read_condition_,
+    std::shared_ptr<ReadEvent> read_event_,
     AVFormatContext* const* format_ctx_,
     int stream_index_)
     : pkt_queue(std::move(pkt_queue_)),
-      read_condition(std::move(read_condition_)),
+      read_event(std::move(read_event_)),
       format_ctx(format_ctx_),
       stream_index(stream_index_) {}
 
@@ -41,9 +41,10 @@ int Decoder::DecodeFrame(AVFrame* frame, AVSubtitle* sub) {
   int ret = AVERROR(EAGAIN);
 
   while (!abort_decoder) {
-    AVPacket temp_pkt;
+    Packet temp_pkt;
 
-    if (d->queue()->serial == d->pkt_serial) {
+    if (d->queue()->serial.load(std::memory_order_acquire) ==
+        d->pkt_serial) {
       do {
         if (d->queue()->abort_request || abort_decoder)
           return -1;
@@ -90,36 +91,32 @@ int Decoder::DecodeFrame(AVFrame* frame, AVSubtitle* sub) {
     }
 
     do {
-      if (d->queue()->nb_packets == 0) {
-        NotifyQueueEmpty();
-      }
       if (d->packet_pending) {
-        av_packet_move_ref(&temp_pkt, &d->pkt);
+        temp_pkt = std::move(d->pkt);
         d->packet_pending = 0;
       } else {
-        while (!abort_decoder && !queue()->abort_request &&
-               queue()->DequeuePacket(temp_pkt, &d->pkt_serial) < 0) {
-          std::unique_lock<std::mutex> lock(queue()->mutex);
-          NotifyQueueEmpty();
+        auto on_block = [](void* opacity) {
+          auto* decoder = static_cast<Decoder*>(opacity);
+          decoder->NotifyQueueEmpty();
           av_log(nullptr, AV_LOG_DEBUG, "%s pending for waiting packets.\n",
-                 debug_label());
-          queue()->cond.wait(lock);
-        }
-
-        if (abort_decoder || queue()->abort_request) {
+                 decoder->debug_label());
+        };
+        if (abort_decoder ||
+            queue()->Get(&temp_pkt, 1, &d->pkt_serial, this, on_block) < 0 ||
+            abort_decoder) {
           return -1;
         }
-        NotifyQueueEmpty();
       }
-      if (d->queue()->serial == d->pkt_serial) {
+      if (d->queue()->serial.load(std::memory_order_acquire) ==
+          d->pkt_serial) {
         // we got the correct pkt.
         break;
       } else {
-        av_packet_unref(&temp_pkt);
+        temp_pkt.Reset();
       }
     } while (true);
 
-    if (temp_pkt.data == PacketQueue::GetFlushPacket()->data) {
+    if (temp_pkt.IsFlush()) {
       avcodec_flush_buffers(d->avctx.get());
       d->finished = 0;
       d->next_pts = d->start_pts;
@@ -128,26 +125,27 @@ int Decoder::DecodeFrame(AVFrame* frame, AVSubtitle* sub) {
       if (d->avctx->codec_type == AVMEDIA_TYPE_SUBTITLE) {
         int got_frame = 0;
         ret = avcodec_decode_subtitle2(d->avctx.get(), sub, &got_frame,
-                                       &temp_pkt);
+                                       temp_pkt.get());
         if (ret < 0) {
           ret = AVERROR(EAGAIN);
         } else {
-          if (got_frame && !temp_pkt.data) {
+          auto has_data = temp_pkt->data != nullptr;
+          if (got_frame && !has_data) {
             d->packet_pending = 1;
-            av_packet_move_ref(&d->pkt, &temp_pkt);
+            d->pkt = std::move(temp_pkt);
           }
-          ret = got_frame ? 0 : (temp_pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
+          ret = got_frame ? 0 : (has_data ? AVERROR(EAGAIN) : AVERROR_EOF);
         }
       } else {
-        if (avcodec_send_packet(d->avctx.get(), &temp_pkt) == AVERROR(EAGAIN)) {
+        if (avcodec_send_packet(d->avctx.get(), temp_pkt.get()) ==
+            AVERROR(EAGAIN)) {
           av_log(d->avctx.get(), AV_LOG_ERROR,
                  "Receive_frame and send_packet both returned EAGAIN, which is "
                  "an API violation.\n");
           d->packet_pending = 1;
-          av_packet_move_ref(&d->pkt, &temp_pkt);
+          d->pkt = std::move(temp_pkt);
         }
       }
-      av_packet_unref(&temp_pkt);
     }
   }
   return -1;
@@ -162,14 +160,11 @@ void Decoder::Start() {
   });
 }
 
-void Decoder::Abort(FrameQueue* fq) {
+void Decoder::Abort() {
   abort_decoder = true;
   queue()->Abort();
   AbortRender();
   queue()->Flush();
-  if (fq) {
-    fq->Signal();
-  }
 }
 
 void Decoder::Join() {
@@ -22,19 +22,20 @@ extern "C" {
 #include "ffp_packet_queue.h"
 
 #include "logging.h"
+#include "read_event.h"
 #include "render_base.h"
 
 struct DecodeParams {
   std::shared_ptr<PacketQueue> pkt_queue;
-  // Use to notify data_source if decoder have not enough packets.
-  std::shared_ptr<std::condition_variable_any> read_condition;
+  // Use to notify data_source if decoder runs out of packets.
+  std::shared_ptr<ReadEvent> read_event;
   AVFormatContext* const* format_ctx;
   int stream_index = -1;
   bool audio_follow_stream_start_pts = false;
 
  public:
   DecodeParams(std::shared_ptr<PacketQueue> pkt_queue_,
-               std::shared_ptr<std::condition_variable_any> read_condition_,
+               std::shared_ptr<ReadEvent> read_event_,
                AVFormatContext* const* format_ctx_,
                int stream_index_);
 
@@ -48,7 +49,8 @@ class Decoder {
   bool abort_decoder = false;
 
  public:
-  AVPacket pkt{0};
+  // packet the codec refused, sent again on the next DecodeFrame().
+  Packet pkt;
   unique_ptr_d<AVCodecContext> avctx;
   int pkt_serial = -1;
   int finished = 0;
@@ -66,7 +68,7 @@ class Decoder {
     return decode_params->pkt_queue;
   }
 
-  void NotifyQueueEmpty() const { decode_params->read_condition->notify_all(); }
+  void NotifyQueueEmpty() const { decode_params->read_event->Notify(); }
 
   int DecodeFrame(AVFrame* frame, AVSubtitle* sub);
 
@@ -84,12 +86,12 @@ class Decoder {
 
   virtual ~Decoder();
 
-  void Abort(FrameQueue* fq);
+  void Abort();
 
   void Join();
 
   bool IsFinished() {
-    return finished == queue()->serial;
+    return finished == queue()->serial.load(std::memory_order_acquire);
   }
 };
 
@@ -0,0 +1,206 @@
+//
+// Created by boyan on 2021/2/14.
+//
+
+#include "decoder_buffer_pool.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+const int DecoderBufferPool::kAlignment;
+
+void DecoderBufferPool::Install(AVCodecContext* codec_ctx,
+                                const AVCodec* codec) {
+  if (!(codec->capabilities & AV_CODEC_CAP_DR1)) {
+    return;
+  }
+  if (codec_ctx->codec_type != AVMEDIA_TYPE_VIDEO &&
+      codec_ctx->codec_type != AVMEDIA_TYPE_AUDIO) {
+    return;
+  }
+  codec_ctx->opaque = new DecoderBufferPool();
+  codec_ctx->get_buffer2 = GetBuffer2;
+  // frame threads call get_buffer2 concurrently, GetBuffer2() locks the
+  // pool.
+  codec_ctx->thread_safe_callbacks = 1;
+}
+
+void DecoderBufferPool::FreeContext(AVCodecContext** codec_ctx) {
+  if (!*codec_ctx) {
+    return;
+  }
+  auto* pool = Get(*codec_ctx);
+  // the frame threads may still get buffers until the codec is freed.
+  avcodec_free_context(codec_ctx);
+  delete pool;
+}
+
+DecoderBufferPool* DecoderBufferPool::Get(const AVCodecContext* codec_ctx) {
+  if (codec_ctx->get_buffer2 != GetBuffer2) {
+    return nullptr;
+  }
+  return static_cast<DecoderBufferPool*>(codec_ctx->opaque);
+}
+
+DecoderBufferPool::~DecoderBufferPool() {
+  av_log(nullptr, AV_LOG_INFO,
+         "decoder buffer pool: %" PRId64 " buffers requested, %" PRId64
+         " allocated.\n",
+         buffer_requests_.load(), buffer_allocations_.load());
+  ResetPools();
+}
+
+void DecoderBufferPool::ResetPools() {
+  for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+    // buffers still referenced by frames are freed once they are unref'd.
+    av_buffer_pool_uninit(&pools_[i]);
+    pool_sizes_[i] = 0;
+    linesize_[i] = 0;
+  }
+  format_ = -1;
+  width_ = 0;
+  height_ = 0;
+  channels_ = 0;
+}
+
+bool DecoderBufferPool::InitPool(int plane, int size) {
+  pools_[plane] = av_buffer_pool_init2(size, this, AllocBuffer, nullptr);
+  pool_sizes_[plane] = pools_[plane] ? size : 0;
+  return pools_[plane] != nullptr;
+}
+
+AVBufferRef* DecoderBufferPool::AllocBuffer(void* opaque, int size) {
+  auto* pool = static_cast<DecoderBufferPool*>(opaque);
+  pool->buffer_allocations_++;
+  return av_buffer_allocz(size);
+}
+
+int DecoderBufferPool::GetVideoBuffer(AVCodecContext* codec_ctx,
+                                      AVFrame* frame) {
+  if (frame->format != format_ || frame->width != width_ ||
+      frame->height != height_) {
+    ResetPools();
+    auto pix_fmt = static_cast<AVPixelFormat>(frame->format);
+    int w = frame->width;
+    int h = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(codec_ctx, &w, &h, linesize_align);
+
+    int linesize[4];
+    bool unaligned;
+    do {
+      // increase the alignment of w until every linesize is aligned.
+      auto ret = av_image_fill_linesizes(linesize, pix_fmt, w);
+      if (ret < 0) {
+        return ret;
+      }
+      w += w & ~(w - 1);
+      unaligned = false;
+      for (int i = 0; i < 4; i++) {
+        unaligned |= linesize[i] % FFMAX(linesize_align[i], kAlignment) != 0;
+      }
+    } while (unaligned);
+
+    uint8_t* data[4];
+    auto total = av_image_fill_pointers(data, pix_fmt, h, nullptr, linesize);
+    if (total < 0) {
+      return total;
+    }
+    int plane_size[4] = {0};
+    int i;
+    for (i = 0; i < 3 && data[i + 1]; i++) {
+      plane_size[i] = (int)(data[i + 1] - data[i]);
+    }
+    plane_size[i] = total - (int)(data[i] - data[0]);
+
+    for (i = 0; i < 4; i++) {
+      linesize_[i] = linesize[i];
+      if (plane_size[i] &&
+          !InitPool(i, plane_size[i] + 16 + kAlignment - 1)) {
+        ResetPools();
+        return AVERROR(ENOMEM);
+      }
+    }
+    format_ = frame->format;
+    width_ = frame->width;
+    height_ = frame->height;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    frame->linesize[i] = linesize_[i];
+    if (!pools_[i]) {
+      continue;
+    }
+    frame->buf[i] = av_buffer_pool_get(pools_[i]);
+    if (!frame->buf[i]) {
+      av_frame_unref(frame);
+      return AVERROR(ENOMEM);
+    }
+    frame->data[i] = frame->buf[i]->data;
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+int DecoderBufferPool::GetAudioBuffer(AVFrame* frame) {
+  auto sample_fmt = static_cast<AVSampleFormat>(frame->format);
+  auto planes = av_sample_fmt_is_planar(sample_fmt) ? frame->channels : 1;
+  int linesize;
+  auto ret = av_samples_get_buffer_size(&linesize, frame->channels,
+                                        frame->nb_samples, sample_fmt,
+                                        kAlignment);
+  if (ret < 0) {
+    return ret;
+  }
+  // nb_samples may vary between frames, keep buffers of the largest one.
+  if (frame->format != format_ || frame->channels != channels_ ||
+      linesize > pool_sizes_[0]) {
+    ResetPools();
+    if (!InitPool(0, linesize)) {
+      return AVERROR(ENOMEM);
+    }
+    format_ = frame->format;
+    channels_ = frame->channels;
+  }
+
+  frame->linesize[0] = linesize;
+  for (int i = 0; i < planes; i++) {
+    frame->buf[i] = av_buffer_pool_get(pools_[0]);
+    if (!frame->buf[i]) {
+      av_frame_unref(frame);
+      return AVERROR(ENOMEM);
+    }
+    frame->data[i] = frame->buf[i]->data;
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+int DecoderBufferPool::GetBuffer2(AVCodecContext* codec_ctx,
+                                  AVFrame* frame,
+                                  int flags) {
+  auto* pool = static_cast<DecoderBufferPool*>(codec_ctx->opaque);
+  pool->buffer_requests_++;
+  std::lock_guard<std::mutex> lock(pool->mutex_);
+  switch (codec_ctx->codec_type) {
+    case AVMEDIA_TYPE_VIDEO: {
+      auto* desc = av_pix_fmt_desc_get(AVPixelFormat(frame->format));
+      if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+        return pool->GetVideoBuffer(codec_ctx, frame);
+      }
+      break;
+    }
+    case AVMEDIA_TYPE_AUDIO:
+      if (frame->channels > 0 &&
+          (frame->channels <= AV_NUM_DATA_POINTERS ||
+           !av_sample_fmt_is_planar(AVSampleFormat(frame->format)))) {
+        return pool->GetAudioBuffer(frame);
+      }
+      break;
+    default:
+      break;
+  }
+  return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+}
@@ -0,0 +1,87 @@
+//
+// Created by boyan on 2021/2/14.
+//
+
+#ifndef FFPLAYER_DECODER_BUFFER_POOL_H
+#define FFPLAYER_DECODER_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/buffer.h"
+}
+
+/**
+ * Frame buffers for one decoder, served from AVBufferPools.
+ *
+ * Buffers return to the pool once the last frame referencing them is unref'd
+ * by the render, so after the first few frames decoding no longer allocates.
+ * The pools are rebuilt only when the frame geometry (video) or sample
+ * layout (audio) changes.
+ */
+class DecoderBufferPool {
+ public:
+  // linesize and plane alignment, enough for AVX-512 conversion paths.
+  static const int kAlignment = 64;
+
+  /**
+   * Install the pool as |codec_ctx|'s get_buffer2 callback, must be called
+   * before avcodec_open2(). Codecs without AV_CODEC_CAP_DR1 keep the default
+   * allocator. The pool is owned by |codec_ctx->opaque|, see FreeContext().
+   */
+  static void Install(AVCodecContext* codec_ctx, const AVCodec* codec);
+
+  /**
+   * Free |*codec_ctx|, then the pool installed on it, if any. Buffers still
+   * held by frames stay valid until they are unref'd.
+   */
+  static void FreeContext(AVCodecContext** codec_ctx);
+
+  /** @return the pool installed on |codec_ctx|, null if none. */
+  static DecoderBufferPool* Get(const AVCodecContext* codec_ctx);
+
+  /** @return buffers requested by the decoder. */
+  int64_t GetBufferRequests() const { return buffer_requests_; }
+
+  /** @return buffers allocated, requests not served from the pools. */
+  int64_t GetBufferAllocations() const { return buffer_allocations_; }
+
+ private:
+  // guards the pools and the geometry, frame threads get buffers
+  // concurrently.
+  std::mutex mutex_;
+  AVBufferPool* pools_[AV_NUM_DATA_POINTERS] = {nullptr};
+  int pool_sizes_[AV_NUM_DATA_POINTERS] = {0};
+  int linesize_[AV_NUM_DATA_POINTERS] = {0};
+
+  // geometry the pools were built for.
+  int format_ = -1;
+  int width_ = 0;
+  int height_ = 0;
+  int channels_ = 0;
+
+  std::atomic<int64_t> buffer_requests_{0};
+  std::atomic<int64_t> buffer_allocations_{0};
+
+  DecoderBufferPool() = default;
+
+  ~DecoderBufferPool();
+
+  // must be called with |mutex_| held, as the methods below.
+  void ResetPools();
+
+  bool InitPool(int plane, int size);
+
+  int GetVideoBuffer(AVCodecContext* codec_ctx, AVFrame* frame);
+
+  int GetAudioBuffer(AVFrame* frame);
+
+  static int GetBuffer2(AVCodecContext* codec_ctx, AVFrame* frame, int flags);
+
+  static AVBufferRef* AllocBuffer(void* opaque, int size);
+};
+
+#endif  // FFPLAYER_DECODER_BUFFER_POOL_H
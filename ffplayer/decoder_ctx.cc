@@ -4,17 +4,17 @@
 
 #include <utility>
 
+#include "decoder_buffer_pool.h"
 #include "decoder_ctx.h"
 #include "logging.h"
 
-int DecoderContext::StartDecoder(std::unique_ptr<DecodeParams> decode_params) {
+int DecoderContext::OpenCodec(AVStream* stream,
+                              int low_res,
+                              bool fast,
+                              unique_ptr_d<AVCodecContext>* codec_ctx_out) {
   unique_ptr_d<AVCodecContext> codec_ctx(
       avcodec_alloc_context3(nullptr),
-      [](AVCodecContext* ptr) { avcodec_free_context(&ptr); });
-  auto* stream = decode_params->stream();
-  if (!stream) {
-    return -1;
-  }
+      [](AVCodecContext* ptr) { DecoderBufferPool::FreeContext(&ptr); });
   if (!codec_ctx) {
     return AVERROR(ENOMEM);
   }
@@ -33,7 +33,7 @@ int DecoderContext::StartDecoder(std::unique_ptr<DecodeParams> decode_params) {
   }
 
   codec_ctx->codec_id = codec->id;
-  auto stream_lowers = this->low_res;
+  auto stream_lowers = low_res;
   if (stream_lowers > codec->max_lowres) {
     av_log(codec_ctx.get(), AV_LOG_WARNING,
            "The maximum value for lowres supported by the decoder is %d, but "
@@ -46,11 +46,35 @@ int DecoderContext::StartDecoder(std::unique_ptr<DecodeParams> decode_params) {
     codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
   }
 
+  DecoderBufferPool::Install(codec_ctx.get(), codec);
+
   ret = avcodec_open2(codec_ctx.get(), codec, nullptr);
   if (ret < 0) {
     return ret;
   }
+  *codec_ctx_out = std::move(codec_ctx);
+  return 0;
+}
+
+int DecoderContext::StartDecoder(std::unique_ptr<DecodeParams> decode_params) {
+  auto* stream = decode_params->stream();
+  if (!stream) {
+    return -1;
+  }
+  unique_ptr_d<AVCodecContext> codec_ctx(nullptr, nullptr);
+  auto ret = OpenCodec(stream, low_res, fast, &codec_ctx);
+  if (ret < 0) {
+    return ret;
+  }
+  return StartDecoder(std::move(codec_ctx), std::move(decode_params));
+}
 
+int DecoderContext::StartDecoder(unique_ptr_d<AVCodecContext> codec_ctx,
+                                 std::unique_ptr<DecodeParams> decode_params) {
+  auto* stream = decode_params->stream();
+  if (!stream) {
+    return -1;
+  }
   switch (codec_ctx->codec_type) {
     case AVMEDIA_TYPE_VIDEO:
       if (!video_render) {
@@ -121,10 +145,10 @@ DecoderContext::DecoderContext(std::shared_ptr<BasicAudioRender> audio_render_,
 
 DecoderContext::~DecoderContext() {
   if (audio_decoder) {
-    audio_decoder->Abort(nullptr);
+    audio_decoder->Abort();
   }
   if (video_decoder) {
-    video_decoder->Abort(nullptr);
+    video_decoder->Abort();
   }
   if (video_render) {
     video_render->Abort();
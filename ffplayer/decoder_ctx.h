@@ -48,8 +48,25 @@ class DecoderContext {
 
   ~DecoderContext();
 
+  /**
+   * Open a decoder for |stream|, before or without starting it.
+   *
+   * @param low_res see |low_res|.
+   * @param fast see |fast|.
+   */
+  static int OpenCodec(AVStream* stream,
+                       int low_res,
+                       bool fast,
+                       unique_ptr_d<AVCodecContext>* codec_ctx_out);
+
   int StartDecoder(std::unique_ptr<DecodeParams> decode_params);
 
+  /**
+   * Start decoding with |codec_ctx| opened by OpenCodec().
+   */
+  int StartDecoder(unique_ptr_d<AVCodecContext> codec_ctx,
+                   std::unique_ptr<DecodeParams> decode_params);
+
   bool AudioDecoderFinished() const {
     if (!audio_decoder) {
       return true;
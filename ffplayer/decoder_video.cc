@@ -21,7 +21,7 @@ int VideoDecoder::DecodeThread() {
     return -1;
   }
 
-  AVFrame* frame = av_frame_alloc();
+  auto frame = MakeFrame();
   if (!frame) {
     return AVERROR(ENOMEM);
   }
@@ -35,7 +35,7 @@ int VideoDecoder::DecodeThread() {
           : 3600.0;
   video_render_->SetMaxFrameDuration(max_frame_duration);
   for (;;) {
-    ret = GetVideoFrame(frame);
+    ret = GetVideoFrame(frame.get());
     if (ret < 0) {
       break;
     }
@@ -48,13 +48,12 @@ int VideoDecoder::DecodeThread() {
     auto pts =
         (frame->pts == AV_NOPTS_VALUE) ? NAN : double(frame->pts) * av_q2d(tb);
 
-    ret = video_render_->PushFrame(frame, pts, duration, pkt_serial);
-    av_frame_unref(frame);
+    ret = video_render_->PushFrame(frame.get(), pts, duration, pkt_serial);
+    av_frame_unref(frame.get());
     if (ret < 0) {
       break;
     }
   }
-  av_frame_free(&frame);
   return 0;
 }
 
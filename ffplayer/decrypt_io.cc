@@ -0,0 +1,88 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#include "decrypt_io.h"
+
+#include <cstring>
+
+extern "C" {
+#include "libavutil/aes_ctr.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define AES_BLOCK_SIZE 16
+
+const int DecryptIO::kKeySize;
+const int DecryptIO::kIvSize;
+
+std::unique_ptr<DecryptIO> DecryptIO::Create(std::unique_ptr<MediaIO> source,
+                                             const uint8_t key[kKeySize],
+                                             const uint8_t iv[kIvSize]) {
+  std::unique_ptr<DecryptIO> io(new DecryptIO(std::move(source)));
+  io->aes_ctr_ = av_aes_ctr_alloc();
+  if (!io->aes_ctr_ || av_aes_ctr_init(io->aes_ctr_, key) < 0) {
+    av_log(nullptr, AV_LOG_ERROR, "can not init aes ctr.\n");
+    return nullptr;
+  }
+  memcpy(io->iv_, iv, kIvSize);
+  io->SetPosition(0);
+  return io;
+}
+
+DecryptIO::DecryptIO(std::unique_ptr<MediaIO> source)
+    : source_(std::move(source)) {}
+
+DecryptIO::~DecryptIO() {
+  av_aes_ctr_free(aes_ctr_);
+  av_log(nullptr, AV_LOG_INFO,
+         "decrypt io: %" PRId64 " KB decrypted at %.1f MB/s.\n",
+         bytes_decrypted_ / 1024,
+         decrypt_time_ ? (double)bytes_decrypted_ / (double)decrypt_time_
+                       : 0.0);
+}
+
+int DecryptIO::Read(uint8_t* buf, int size) {
+  auto ret = source_->Read(buf, size);
+  if (ret <= 0) {
+    return ret;
+  }
+  auto start = av_gettime_relative();
+  av_aes_ctr_crypt(aes_ctr_, buf, buf, ret);
+  decrypt_time_ += av_gettime_relative() - start;
+  bytes_decrypted_ += ret;
+  position_ += ret;
+  return ret;
+}
+
+int64_t DecryptIO::Seek(int64_t offset, int whence) {
+  auto ret = source_->Seek(offset, whence);
+  if (ret >= 0 && (whence & ~AVSEEK_FORCE) != AVSEEK_SIZE) {
+    SetPosition(ret);
+  }
+  return ret;
+}
+
+void DecryptIO::Abort() {
+  source_->Abort();
+}
+
+void DecryptIO::SetPosition(int64_t position) {
+  // add the block index to the 64 bit big endian counter, wrapping like
+  // sequential decryption does.
+  uint8_t iv[kIvSize];
+  memcpy(iv, iv_, kIvSize);
+  auto counter = AV_RB64(iv + 8) + (uint64_t)(position / AES_BLOCK_SIZE);
+  AV_WB64(iv + 8, counter);
+  av_aes_ctr_set_full_iv(aes_ctr_, iv);
+
+  // skip the part of the block before |position|.
+  auto skip = (int)(position % AES_BLOCK_SIZE);
+  if (skip) {
+    uint8_t discard[AES_BLOCK_SIZE] = {};
+    av_aes_ctr_crypt(aes_ctr_, discard, discard, skip);
+  }
+  position_ = position;
+}
@@ -0,0 +1,58 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#ifndef FFPLAYER_DECRYPT_IO_H
+#define FFPLAYER_DECRYPT_IO_H
+
+#include <memory>
+
+#include "media_io.h"
+
+struct AVAESCTR;
+
+/**
+ * Decrypts an AES-128-CTR encrypted source as it is read.
+ *
+ * Only the bytes read are decrypted. A seek moves the counter to the block of
+ * its target, so random access costs no more than sequential reading. The
+ * counter is the last 8 bytes of the iv, big endian, incremented once per 16
+ * bytes as libavutil's aes_ctr does.
+ */
+class DecryptIO : public MediaIO {
+ public:
+  static const int kKeySize = 16;
+  static const int kIvSize = 16;
+
+  /**
+   * @return null if |key| can not be used.
+   */
+  static std::unique_ptr<DecryptIO> Create(std::unique_ptr<MediaIO> source,
+                                           const uint8_t key[kKeySize],
+                                           const uint8_t iv[kIvSize]);
+
+  ~DecryptIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+ private:
+  std::unique_ptr<MediaIO> source_;
+  AVAESCTR* aes_ctr_ = nullptr;
+  uint8_t iv_[kIvSize] = {};
+  int64_t position_ = 0;
+
+  // statistic.
+  int64_t bytes_decrypted_ = 0;
+  int64_t decrypt_time_ = 0;
+
+  explicit DecryptIO(std::unique_ptr<MediaIO> source);
+
+  // move the key stream to |position| of the source.
+  void SetPosition(int64_t position);
+};
+
+#endif  // FFPLAYER_DECRYPT_IO_H
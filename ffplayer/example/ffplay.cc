@@ -9,6 +9,7 @@
 
 #include "logging.h"
 #include "media_player.h"
+#include "prepared_source_pool.h"
 #include "render_video_sdl.h"
 #include "sdl_utils.h"
 
@@ -227,6 +228,11 @@ class SdlLycheePlayerExample
     player->SetPlayWhenReady(true);
 
     current_player_ = player;
+
+    // so that skipping to the next item starts at once.
+    auto next_index = (playing_file_index_ + 1) % input_files_.size();
+    PreparedSourcePool::Get()->Prepare(input_files_[next_index],
+                                       player->start_configuration);
   }
 };
 
@@ -0,0 +1,121 @@
+//
+// Created by boyan on 2021/2/6.
+//
+
+#ifndef FFPLAYER_FFP_AV_HANDLE_H
+#define FFPLAYER_FFP_AV_HANDLE_H
+
+#include <memory>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+}
+
+/**
+ * Move-only owner of the references held by an AVPacket.
+ *
+ * The AVPacket lives inline, so moving a Packet from the demuxer through
+ * PacketQueue to the decoder is a plain struct move: it never allocates nor
+ * touches the buffer reference count. The references are released when the
+ * owning Packet is destroyed, packets owning none, such as the blanks left
+ * behind by moves, are dropped without calling into ffmpeg.
+ */
+class Packet {
+ public:
+  Packet() : pkt_(Blank()) {}
+
+  /** Take over the references of |src|, which is left blank. */
+  explicit Packet(AVPacket* src) : Packet() { av_packet_move_ref(&pkt_, src); }
+
+  Packet(Packet&& other) noexcept : pkt_(other.pkt_) {
+    other.pkt_ = Blank();
+  }
+
+  Packet& operator=(Packet&& other) noexcept {
+    if (this != &other) {
+      Release();
+      pkt_ = other.pkt_;
+      other.pkt_ = Blank();
+    }
+    return *this;
+  }
+
+  Packet(const Packet&) = delete;
+
+  Packet& operator=(const Packet&) = delete;
+
+  ~Packet() { Release(); }
+
+  /**
+   * Marker packet telling the decoder to flush, the queue starts a new serial
+   * with it. It holds no buffer.
+   */
+  static Packet Flush() {
+    Packet pkt;
+    pkt.pkt_.data = FlushData();
+    return pkt;
+  }
+
+  bool IsFlush() const { return pkt_.data == FlushData(); }
+
+  /** Replace the content with a new reference to |src|. */
+  int Ref(const AVPacket* src) {
+    av_packet_unref(&pkt_);
+    return av_packet_ref(&pkt_, src);
+  }
+
+  void Reset() {
+    Release();
+    pkt_ = Blank();
+  }
+
+  AVPacket* get() { return &pkt_; }
+
+  const AVPacket* get() const { return &pkt_; }
+
+  AVPacket* operator->() { return &pkt_; }
+
+  const AVPacket* operator->() const { return &pkt_; }
+
+ private:
+  AVPacket pkt_;
+
+  // the fields at their defaults, replaces av_init_packet().
+  static const AVPacket& Blank() {
+    static const AVPacket blank = []() {
+      AVPacket pkt = {};
+      av_packet_unref(&pkt);
+      return pkt;
+    }();
+    return blank;
+  }
+
+  // release the references, if any, leaving the fields as they are.
+  void Release() {
+    if (pkt_.buf || pkt_.side_data) {
+      av_packet_unref(&pkt_);
+    }
+  }
+
+  static uint8_t* FlushData() {
+    static uint8_t flush_data;
+    return &flush_data;
+  }
+};
+
+struct AVFrameDeleter {
+  void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+};
+
+/**
+ * Owner of an AVFrame. Decoded data is handed over with av_frame_move_ref(),
+ * so the frame itself is allocated once per decoder or queue slot.
+ */
+typedef std::unique_ptr<AVFrame, AVFrameDeleter> FramePtr;
+
+static inline FramePtr MakeFrame() {
+  return FramePtr(av_frame_alloc());
+}
+
+#endif  // FFPLAYER_FFP_AV_HANDLE_H
@@ -5,27 +5,35 @@
 #ifndef FFPLAYER_FFP_FRAME_QUEUE_H
 #define FFPLAYER_FFP_FRAME_QUEUE_H
 
+#include <atomic>
+#include <cmath>
 #include <condition_variable>
 #include <mutex>
 
+#include "ffp_av_handle.h"
 #include "ffp_packet_queue.h"
 
-extern "C" {
-#include "libavcodec/avcodec.h"
+#define VIDEO_PICTURE_QUEUE_SIZE 3
+// upper bound of audio frames, the sample queue is bounded by decoded duration
+// and bytes, see FrameQueue::SetLimits(). slots are allocated as the queue
+// fills, so only the frames the limits let in cost memory.
+#define SAMPLE_QUEUE_SIZE 128
+
+/* Decoded audio samples waiting for the audio device. */
+struct AudioFrame {
+  FramePtr frame;
+  int serial;
+  double pts;      /* presentation timestamp for the frame */
+  double duration; /* estimated duration of the frame */
+  int64_t pos;     /* byte position of the frame in the input file */
+
+ public:
+  void Unref();
 };
 
-#define VIDEO_PICTURE_QUEUE_SIZE 3
-#define SUBPICTURE_QUEUE_SIZE 16
-#define SAMPLE_QUEUE_SIZE 9
-#define FRAME_QUEUE_SIZE   \
-  FFMAX(SAMPLE_QUEUE_SIZE, \
-        FFMAX(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
-
-/* Common struct for handling all types of decoded data and allocated render
- * buffers. */
-struct Frame {
-  AVFrame* frame;
-  AVSubtitle sub;
+/* Decoded picture and its render state. */
+struct VideoFrame {
+  FramePtr frame;
   int serial;
   double pts;      /* presentation timestamp for the frame */
   double duration; /* estimated duration of the frame */
@@ -41,45 +49,233 @@ struct Frame {
   void Unref();
 };
 
+/**
+ * Single-producer/single-consumer frame queue of |Capacity| slots of |T|.
+ * Besides the slots, the queue can be bounded by the duration of frames not
+ * read yet and by the bytes of all frames it holds.
+ *
+ * The decoder thread is the only writer (PeekWritable/Push) and the render
+ * (or audio device) thread the only reader (Peek, Next). Indices are atomic,
+ * |size| publishes frames with release/acquire ordering. Only the writer can
+ * block, the reader side never waits so it is safe to call from realtime
+ * audio callbacks.
+ */
+template <typename T, int Capacity>
 class FrameQueue {
  public:
-  Frame queue[FRAME_QUEUE_SIZE];
-  int rindex = 0;
-  int windex = 0;
-  int size = 0;
-  int max_size = 0;
+  static const int max_size = Capacity;
+
+  T queue[Capacity]{};
+  std::atomic<int> rindex{0};
+  std::atomic<int> windex{0};
+  std::atomic<int> size{0};
   int keep_last = 0;
-  int rindex_shown = 0;
-  std::recursive_mutex mutex;
-  std::condition_variable_any cond;
+  std::atomic<int> rindex_shown{0};
   PacketQueue* pktq = nullptr;
 
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<bool> writer_waiting_{false};
+
+  // 0 for no limit, see SetLimits().
+  std::atomic<int64_t> max_duration_us_{0};
+  std::atomic<int64_t> max_bytes_{0};
+  std::atomic<int64_t> pending_duration_us_{0};
+  std::atomic<int64_t> queued_bytes_{0};
+
+  static int64_t DurationUs(const T& item) {
+    return std::isnan(item.duration) ? 0 : (int64_t)(item.duration * 1000000);
+  }
+
+  static int64_t FrameBytes(const T& item) {
+    int64_t bytes = 0;
+    for (auto* buf : item.frame->buf) {
+      if (buf) {
+        bytes += buf->size;
+      }
+    }
+    for (int i = 0; i < item.frame->nb_extended_buf; i++) {
+      bytes += item.frame->extended_buf[i]->size;
+    }
+    return bytes;
+  }
+
+  void WakeWriter() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_waiting_.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cond_.notify_one();
+    }
+  }
+
  public:
-  int Init(PacketQueue* _pktq, int _max_size, int _keep_last);
+  FrameQueue() = default;
+
+  ~FrameQueue() { Destroy(); }
+
+  int Init(PacketQueue* _pktq, int _keep_last) {
+    pktq = _pktq;
+    keep_last = !!_keep_last;
+    // frames of the slots are allocated by PeekWritable() on first use.
+    return 0;
+  }
+
+  void Destroy() {
+    for (auto& item : queue) {
+      if (item.frame) {
+        item.Unref();
+        item.frame.reset();
+      }
+    }
+  }
+
+  /**
+   * Bound the queue by decoded duration and bytes, on top of |Capacity|.
+   *
+   * @param max_duration_ms max duration of frames not read yet, 0 for no limit.
+   * @param max_bytes max bytes of frames held by the queue, 0 for no limit.
+   */
+  void SetLimits(int64_t max_duration_ms, int64_t max_bytes) {
+    max_duration_us_ = max_duration_ms * 1000;
+    max_bytes_ = max_bytes;
+    WakeWriter();
+  }
+
+  /* return the bytes of frames held by the queue */
+  int64_t QueuedBytes() const {
+    return queued_bytes_.load(std::memory_order_relaxed);
+  }
 
-  void Destroy();
+  /* return the duration of frames not read yet, in milliseconds */
+  double PendingDurationMs() const {
+    return pending_duration_us_.load(std::memory_order_relaxed) / 1000.0;
+  }
 
-  void Signal();
+  /**
+   * @return true if the writer has to wait for the reader. A frame is always
+   * accepted when there is nothing left to read, so a single frame larger
+   * than the limits can not stall the queue.
+   */
+  bool IsFull() const {
+    auto queued = size.load(std::memory_order_acquire);
+    if (queued >= max_size) {
+      return true;
+    }
+    if (queued - rindex_shown <= 0) {
+      return false;
+    }
+    auto max_duration_us = max_duration_us_.load(std::memory_order_relaxed);
+    auto max_bytes = max_bytes_.load(std::memory_order_relaxed);
+    return (max_duration_us > 0 &&
+            pending_duration_us_.load(std::memory_order_relaxed) >=
+                max_duration_us) ||
+           (max_bytes > 0 &&
+            queued_bytes_.load(std::memory_order_relaxed) >= max_bytes);
+  }
 
-  Frame* Peek();
+  void Signal() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_all();
+  }
 
-  Frame* PeekNext();
+  T* Peek() { return &queue[(rindex + rindex_shown) % max_size]; }
 
-  Frame* PeekLast();
+  T* PeekNext() { return &queue[(rindex + rindex_shown + 1) % max_size]; }
 
-  Frame* PeekWritable();
+  T* PeekLast() { return &queue[rindex]; }
 
-  Frame* PeekReadable();
+  /**
+   * Wait until there is a free slot to write.
+   *
+   * @return nullptr if aborted or out of memory.
+   */
+  T* PeekWritable() {
+    /* wait until we have space to put a new frame */
+    if (IsFull()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      writer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (IsFull() && !pktq->abort_request) {
+        cond_.wait(lock);
+      }
+      writer_waiting_.store(false, std::memory_order_relaxed);
+    }
 
-  void Push();
+    if (pktq->abort_request)
+      return nullptr;
 
-  void Next();
+    // the slot is published to the reader by Push(), so is its frame.
+    auto& item = queue[windex.load(std::memory_order_relaxed)];
+    if (!item.frame) {
+      item.frame = MakeFrame();
+      if (!item.frame)
+        return nullptr;
+    }
+    return &item;
+  }
+
+  /**
+   * @return the next frame to be shown, nullptr if there is none yet or the
+   * queue is aborted. Never blocks.
+   */
+  T* TryPeekReadable() {
+    if (pktq->abort_request ||
+        size.load(std::memory_order_acquire) - rindex_shown <= 0) {
+      return nullptr;
+    }
+    return &queue[(rindex + rindex_shown) % max_size];
+  }
+
+  void Push() {
+    auto& item = queue[windex.load(std::memory_order_relaxed)];
+    pending_duration_us_.fetch_add(DurationUs(item), std::memory_order_relaxed);
+    queued_bytes_.fetch_add(FrameBytes(item), std::memory_order_relaxed);
+    auto next_windex = windex.load(std::memory_order_relaxed) + 1;
+    windex.store(next_windex == max_size ? 0 : next_windex,
+                 std::memory_order_relaxed);
+    size.fetch_add(1, std::memory_order_release);
+  }
+
+  void Next() {
+    pending_duration_us_.fetch_sub(DurationUs(*Peek()),
+                                   std::memory_order_relaxed);
+    if (keep_last && !rindex_shown) {
+      rindex_shown = 1;
+    } else {
+      auto rindex_now = rindex.load(std::memory_order_relaxed);
+      queued_bytes_.fetch_sub(FrameBytes(queue[rindex_now]),
+                              std::memory_order_relaxed);
+      queue[rindex_now].Unref();
+      rindex.store(rindex_now + 1 == max_size ? 0 : rindex_now + 1,
+                   std::memory_order_relaxed);
+      size.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Only wake the decoder if it is actually waiting for room.
+    WakeWriter();
+  }
 
   /* return the number of undisplayed frames in the queue */
-  int NbRemaining();
+  int NbRemaining() {
+    return size.load(std::memory_order_acquire) - rindex_shown;
+  }
 
   /* return last shown position */
-  int64_t LastPos();
+  int64_t LastPos() {
+    T* fp = &queue[rindex];
+    if (rindex_shown &&
+        fp->serial == pktq->serial.load(std::memory_order_acquire))
+      return fp->pos;
+    else
+      return -1;
+  }
 };
 
+template <typename T, int Capacity>
+const int FrameQueue<T, Capacity>::max_size;
+
+typedef FrameQueue<AudioFrame, SAMPLE_QUEUE_SIZE> SampleQueue;
+typedef FrameQueue<VideoFrame, VIDEO_PICTURE_QUEUE_SIZE> PictureQueue;
+
 #endif  // FFPLAYER_FFP_FRAME_QUEUE_H
@@ -45,6 +45,8 @@ extern "C" {
   503 /* arg1 = cached data in bytes,            arg2 = high water mark */
 #define FFP_MSG_BUFFERING_TIME_UPDATE \
   504 /* arg1 = cached duration in milliseconds, arg2 = high water mark */
+#define FFP_MSG_BUFFERING_WATERMARK_UPDATE \
+  505 /* arg1 = low water mark in milliseconds, arg2 = high water mark */
 #define FFP_MSG_SEEK_COMPLETE \
   600 /* arg1 = seek position,                   arg2 = error */
 #define FFP_MSG_PLAYBACK_STATE_CHANGED 700
@@ -93,6 +95,9 @@ extern "C" {
 #define FFP_PROP_INT64_TRAFFIC_STATISTIC_BYTE_COUNT 20204
 
 #define FFP_PROP_INT64_LATEST_SEEK_LOAD_DURATION 20300
+#define FFP_PROP_INT64_STARTUP_DURATION 20301
+#define FFP_PROP_INT64_REBUFFER_COUNT 20302
+#define FFP_PROP_INT64_REBUFFER_DURATION 20303
 
 #define FFP_PROP_INT64_CACHE_STATISTIC_PHYSICAL_POS 20205
 
@@ -107,6 +112,7 @@ extern "C" {
 #define FFP_PROP_INT64_IMMEDIATE_RECONNECT 20211
 
 const int MEDIA_MSG_DO_SOME_WORK = 30000;
+const int MEDIA_MSG_TRIM_BUFFERS = 30001;
 
 class MessageContext {
  public:
@@ -4,167 +4,550 @@
 
 #include "ffp_packet_queue.h"
 
-int PacketQueue::Get(AVPacket* pkt,
+#include <memory>
+#include <thread>
+
+#include "ffp_utils.h"
+
+namespace {
+
+// Packets detached from a queue by PacketQueue::BumpSerial().
+struct DetachedPackets {
+  PacketRing* rings = nullptr;
+  std::deque<PacketSlot> replay;
+  std::deque<Packet> retained;
+
+  ~DetachedPackets() {
+    // slots already taken by the consumer are blank, the rest are released
+    // with the ring.
+    while (rings) {
+      auto* next = rings->next.load(std::memory_order_acquire);
+      delete rings;
+      rings = next;
+    }
+  }
+};
+
+// Releases detached packets off the decoder and read threads.
+class PacketReleaser {
+ public:
+  static PacketReleaser* Get() {
+    // never destroyed, the thread lives as long as the process.
+    static auto* instance = new PacketReleaser();
+    return instance;
+  }
+
+  void Post(std::unique_ptr<DetachedPackets> packets) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(packets));
+    cond_.notify_one();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::unique_ptr<DetachedPackets>> pending_;
+
+  PacketReleaser() {
+    std::thread([this]() {
+      update_thread_name("packet_release");
+      for (;;) {
+        std::deque<std::unique_ptr<DetachedPackets>> releasing;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          while (pending_.empty()) {
+            cond_.wait(lock);
+          }
+          releasing.swap(pending_);
+        }
+        releasing.clear();
+      }
+    }).detach();
+  }
+};
+
+}  // namespace
+
+static inline int64_t packet_timestamp(const AVPacket* pkt) {
+  return pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+}
+
+PacketRing::PacketRing(uint32_t capacity)
+    : capacity(capacity), slots(new PacketSlot[capacity]) {}
+
+PacketRing::~PacketRing() {
+  delete[] slots;
+}
+
+int PacketQueue::Get(Packet* pkt,
                      int block,
                      int* pkt_serial,
                      void* opacity,
                      void (*on_block)(void*)) {
-  MyAVPacketList* pkt1;
-  int ret;
-
-  std::unique_lock<std::mutex> lock(mutex);
-
   for (;;) {
-    if (abort_request) {
-      ret = -1;
-      break;
-    }
-
-    pkt1 = first_pkt;
-    if (pkt1) {
-      first_pkt = pkt1->next;
-      if (!first_pkt)
-        last_pkt = nullptr;
-      nb_packets--;
-      size -= pkt1->pkt.size + (int)sizeof(*pkt1);
-      duration -= pkt1->pkt.duration;
-      *pkt = pkt1->pkt;
-      if (pkt_serial)
-        *pkt_serial = pkt1->serial;
-      av_free(pkt1);
-      ret = 1;
-      break;
-    } else if (!block) {
-      ret = 0;
-      break;
-    } else {
-      if (on_block) {
-        on_block(opacity);
+    bool popped;
+    {
+      std::lock_guard<std::mutex> lock(consumer_mutex_);
+      if (abort_request) {
+        return -1;
       }
-      cond.wait(lock);
+      popped = Pop(pkt, pkt_serial);
     }
+    if (popped) {
+      WakeWaiters();
+      CheckLowWatermark();
+      return 1;
+    }
+    if (!block) {
+      return 0;
+    }
+    if (on_block) {
+      on_block(opacity);
+    }
+    WaitUntil([this]() { return IsReadable(); });
   }
-  return ret;
 }
 
 void PacketQueue::Start() {
   abort_request = 0;
-  Put_(GetFlushPacket());
+  Put_(Packet::Flush());
 }
 
 void PacketQueue::Abort() {
-  std::lock_guard<std::mutex> lock(mutex);
-
+  std::lock_guard<std::mutex> lock(wait_mutex_);
   abort_request = 1;
-  cond.notify_all();
+  cond_.notify_all();
 }
 
-int PacketQueue::Put(AVPacket* pkt) {
-  int ret;
-
-  ret = Put_(pkt);
-
-  if (pkt != GetFlushPacket() && ret < 0)
-    av_packet_unref(pkt);
-
-  return ret;
+int PacketQueue::Put(Packet pkt) {
+  return Put_(std::move(pkt));
 }
 
 int PacketQueue::PutNullPacket(int stream_index) {
-  AVPacket pkt1, *pkt = &pkt1;
-  av_init_packet(pkt);
-  pkt->data = nullptr;
-  pkt->size = 0;
+  Packet pkt;
   pkt->stream_index = stream_index;
-  return Put(pkt);
+  return Put(std::move(pkt));
 }
 
 PacketQueue::PacketQueue() {
-  abort_request = 1;
+  write_ring_ = read_ring_ = new PacketRing(kInitialRingCapacity);
 }
 
 PacketQueue::~PacketQueue() {
   Flush();
   Abort();
+  while (read_ring_) {
+    auto* next = read_ring_->next.load(std::memory_order_acquire);
+    delete read_ring_;
+    read_ring_ = next;
+  }
 }
 
 void PacketQueue::Flush() {
-  std::lock_guard<std::mutex> lock(mutex);
-
-  MyAVPacketList *pkt, *pkt1;
-
-  for (pkt = first_pkt; pkt; pkt = pkt1) {
-    pkt1 = pkt->next;
-    av_packet_unref(&pkt->pkt);
-    av_freep(&pkt);
+  {
+    std::lock_guard<std::mutex> lock(consumer_mutex_);
+    PacketSlot slot;
+    while (PopPending(&slot)) {
+      slot.pkt.Reset();
+    }
+    ClearBackBuffer();
+    rebase_serial_ = INT_MAX;
   }
-  last_pkt = nullptr;
-  first_pkt = nullptr;
-  nb_packets = 0;
-  size = 0;
-  duration = 0;
+  WakeWaiters();
 }
 
-int PacketQueue::Put_(AVPacket* pkt) {
-  std::lock_guard<std::mutex> lock(mutex);
+void PacketQueue::BumpSerial() {
+  std::unique_ptr<DetachedPackets> detached(new DetachedPackets);
+  {
+    std::lock_guard<std::mutex> lock(consumer_mutex_);
+    // The caller is the producer, so the whole chain up to |write_ring_| is
+    // stable while the consumer is locked out.
+    detached->rings = read_ring_;
+    read_ring_ = write_ring_ = new PacketRing(write_ring_->capacity);
+    detached->replay.swap(replay_);
+    detached->retained.swap(retained_);
+    retained_size_ = 0;
+    retained_duration_ = 0;
+    rebase_serial_ = INT_MAX;
+    nb_packets = 0;
+    size = 0;
+    duration = 0;
+  }
+  PacketReleaser::Get()->Post(std::move(detached));
+  Put_(Packet::Flush());
+}
 
-  MyAVPacketList* pkt1;
+PacketRing* PacketQueue::AcquireWritableRing() {
+  for (;;) {
+    auto* ring = write_ring_;
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) < ring->capacity) {
+      return ring;
+    }
+    if (ring->capacity < kMaxRingCapacity) {
+      // The consumer will pick up the bigger ring once it drained this one.
+      auto* grown = new PacketRing(ring->capacity * 2);
+      ring->next.store(grown, std::memory_order_release);
+      write_ring_ = grown;
+      return grown;
+    }
+    WaitUntil([ring]() {
+      return ring->tail.load(std::memory_order_relaxed) -
+                 ring->head.load(std::memory_order_acquire) <
+             ring->capacity;
+    });
+    if (abort_request) {
+      return nullptr;
+    }
+  }
+}
 
+int PacketQueue::Put_(Packet pkt) {
   if (abort_request)
     return -1;
 
-  pkt1 = (MyAVPacketList*)av_malloc(sizeof(MyAVPacketList));
-  if (!pkt1)
+  auto* ring = AcquireWritableRing();
+  if (!ring)
     return -1;
-  pkt1->pkt = *pkt;
-  pkt1->next = nullptr;
-  if (pkt == GetFlushPacket()) {
-    serial++;
-  }
-  pkt1->serial = serial;
-
-  if (!last_pkt)
-    first_pkt = pkt1;
-  else
-    last_pkt->next = pkt1;
-  last_pkt = pkt1;
-  nb_packets++;
-  size += pkt1->pkt.size + (int)sizeof(*pkt1);
-  duration += pkt1->pkt.duration;
+
+  auto tail = ring->tail.load(std::memory_order_relaxed);
+  auto& slot = ring->slots[tail & (ring->capacity - 1)];
+  auto current_serial = serial.load(std::memory_order_relaxed);
+  if (pkt.IsFlush()) {
+    current_serial++;
+  }
+  slot.pkt = std::move(pkt);
+  slot.serial = current_serial;
+
+  // Account before publishing, so the consumer never sees negative counters.
+  UpdatePendingStatistic(slot.pkt, 1);
+  last_pts_.store(slot.pkt->pts, std::memory_order_relaxed);
+  last_duration_.store(slot.pkt->duration, std::memory_order_relaxed);
   /* XXX: should duplicate packet data in DV case */
-  cond.notify_all();
+  ring->tail.store(tail + 1, std::memory_order_release);
+  serial.store(current_serial, std::memory_order_release);
+  WakeWaiters();
   return 0;
 }
 
-int PacketQueue::DequeuePacket(AVPacket& pkt, int* pkt_serial) {
-  std::lock_guard<std::mutex> lck(mutex);
-  if (abort_request) {
-    return -1;
+bool PacketQueue::PopPending(PacketSlot* slot) {
+  if (!replay_.empty()) {
+    *slot = std::move(replay_.front());
+    replay_.pop_front();
+  } else {
+    for (;;) {
+      auto* ring = read_ring_;
+      auto head = ring->head.load(std::memory_order_relaxed);
+      if (head != ring->tail.load(std::memory_order_acquire)) {
+        *slot = std::move(ring->slots[head & (ring->capacity - 1)]);
+        ring->head.store(head + 1, std::memory_order_release);
+        break;
+      }
+      auto* next = ring->next.load(std::memory_order_acquire);
+      if (!next) {
+        return false;
+      }
+      // The producer may have filled this ring just before linking |next|.
+      if (head != ring->tail.load(std::memory_order_acquire)) {
+        continue;
+      }
+      read_ring_ = next;
+      delete ring;
+    }
   }
-  MyAVPacketList* head = first_pkt;
-  if (!head) {
-    return -1;
+  UpdatePendingStatistic(slot->pkt, -1);
+  if (slot->serial >= rebase_serial_) {
+    slot->serial = serial.load(std::memory_order_acquire);
   }
+  return true;
+}
 
-  first_pkt = head->next;
-  if (!first_pkt) {
-    last_pkt = nullptr;
+bool PacketQueue::Pop(Packet* pkt, int* pkt_serial) {
+  PacketSlot slot;
+  if (!PopPending(&slot)) {
+    return false;
   }
-  nb_packets--;
-  size -= head->pkt.size + int(sizeof(*head));
-  duration -= head->pkt.duration;
-
-  pkt = head->pkt;
   if (pkt_serial) {
-    *pkt_serial = head->serial;
+    *pkt_serial = slot.serial;
+  }
+  if (IsBackBufferEnabled() && !slot.pkt.IsFlush()) {
+    if (!slot.pkt->data) {
+      // EOF marker, keep a blank one so a rewind still ends the stream.
+      Packet eof;
+      eof->stream_index = slot.pkt->stream_index;
+      Retain(std::move(eof));
+    } else if (slot.pkt->buf) {
+      // Hand a new reference to the consumer, keep the original.
+      if (pkt->Ref(slot.pkt.get()) >= 0) {
+        Retain(std::move(slot.pkt));
+        TrimBackBuffer();
+        return true;
+      }
+    }
+    TrimBackBuffer();
+  }
+  *pkt = std::move(slot.pkt);
+  return true;
+}
+
+void PacketQueue::UpdatePendingStatistic(const Packet& pkt, int sign) {
+  nb_packets.fetch_add(sign, std::memory_order_relaxed);
+  size.fetch_add(sign * (pkt->size + (int)sizeof(PacketSlot)),
+                 std::memory_order_relaxed);
+  duration.fetch_add(sign * pkt->duration, std::memory_order_relaxed);
+}
+
+bool PacketQueue::IsBackBufferEnabled() const {
+  return back_buffer_max_duration_ms_ > 0 || back_buffer_max_bytes_ > 0;
+}
+
+void PacketQueue::Retain(Packet pkt) {
+  retained_size_ += pkt->size;
+  retained_duration_ += pkt->duration;
+  retained_.push_back(std::move(pkt));
+}
+
+void PacketQueue::TrimBackBuffer() {
+  auto over_budget = [this]() {
+    if (back_buffer_max_bytes_ > 0 &&
+        retained_size_ > back_buffer_max_bytes_) {
+      return true;
+    }
+    return back_buffer_max_duration_ms_ > 0 &&
+           av_q2d(time_base) * (double)retained_duration_ * 1000 >
+               (double)back_buffer_max_duration_ms_;
+  };
+  while (!retained_.empty() && over_budget()) {
+    auto& pkt = retained_.front();
+    retained_size_ -= pkt->size;
+    retained_duration_ -= pkt->duration;
+    retained_.pop_front();
+  }
+}
+
+void PacketQueue::ClearBackBuffer() {
+  retained_.clear();
+  retained_size_ = 0;
+  retained_duration_ = 0;
+}
+
+int PacketQueue::FindSeekPoint(int64_t target,
+                               std::vector<const Packet*>& sequence) {
+  sequence.clear();
+  for (auto& pkt : retained_) {
+    sequence.push_back(&pkt);
+  }
+  for (auto& slot : replay_) {
+    sequence.push_back(&slot.pkt);
+  }
+  for (auto* ring = read_ring_; ring;
+       ring = ring->next.load(std::memory_order_acquire)) {
+    auto tail = ring->tail.load(std::memory_order_acquire);
+    for (auto i = ring->head.load(std::memory_order_relaxed); i != tail; i++) {
+      sequence.push_back(&ring->slots[i & (ring->capacity - 1)].pkt);
+    }
+  }
+
+  int seek_point = -1;
+  for (int i = 0; i < (int)sequence.size(); i++) {
+    auto& pkt = *sequence[i];
+    if (!pkt->data) {
+      // reached EOF, everything after the seek point is buffered.
+      return seek_point;
+    }
+    if (pkt.IsFlush()) {
+      continue;
+    }
+    auto ts = packet_timestamp(pkt.get());
+    if (ts == AV_NOPTS_VALUE) {
+      continue;
+    }
+    if (ts > target) {
+      return seek_point;
+    }
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      seek_point = i;
+    }
+  }
+  // |target| is beyond the buffered packets.
+  return -1;
+}
+
+bool PacketQueue::IsReadable() {
+  std::lock_guard<std::mutex> lock(consumer_mutex_);
+  auto* ring = read_ring_;
+  return !replay_.empty() ||
+         ring->head.load(std::memory_order_relaxed) !=
+             ring->tail.load(std::memory_order_acquire) ||
+         ring->next.load(std::memory_order_acquire) != nullptr;
+}
+
+void PacketQueue::WaitUntil(const std::function<bool()>& ready) {
+  waiters_.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    while (!abort_request && !ready()) {
+      cond_.wait(lock);
+    }
+  }
+  waiters_.fetch_sub(1);
+}
+
+void PacketQueue::WakeWaiters() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(wait_mutex_);
+  cond_.notify_all();
+}
+
+int PacketQueue::DequeuePacket(Packet& pkt, int* pkt_serial) {
+  {
+    std::lock_guard<std::mutex> lck(consumer_mutex_);
+    if (abort_request || !Pop(&pkt, pkt_serial)) {
+      return -1;
+    }
   }
-  av_free(head);
+  WakeWaiters();
+  CheckLowWatermark();
   return 0;
 }
 
-AVPacket* PacketQueue::GetFlushPacket() {
-  static AVPacket flush_pkt;
-  av_init_packet(&flush_pkt);
-  flush_pkt.data = (uint8_t*)&flush_pkt;
-  return &flush_pkt;
+void PacketQueue::SetLowWatermarkListener(
+    std::function<bool(const BufferLevel&)> has_enough,
+    std::function<void()> listener) {
+  has_enough_ = std::move(has_enough);
+  low_watermark_listener_ = std::move(listener);
+}
+
+void PacketQueue::ArmLowWatermark(int64_t max_bytes) {
+  if (!low_watermark_listener_) {
+    return;
+  }
+  low_watermark_max_bytes_.store(max_bytes, std::memory_order_relaxed);
+  low_watermark_armed_.store(true, std::memory_order_release);
+  // pairs with the fence of WakeWaiters() on the consumer side: either the
+  // consumer sees the listener armed, or the producer sees what it popped.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void PacketQueue::CheckLowWatermark() {
+  // a single load per packet while the producer is busy reading, called
+  // after WakeWaiters().
+  if (!low_watermark_armed_.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto level = GetBufferLevel();
+  auto max_bytes = low_watermark_max_bytes_.load(std::memory_order_relaxed);
+  if (max_bytes >= 0 ? level.bytes > max_bytes : has_enough_(level)) {
+    return;
+  }
+  if (low_watermark_armed_.exchange(false)) {
+    low_watermark_listener_();
+  }
+}
+
+bool PacketQueue::GetLastPacketTimestamp(int64_t& pts,
+                                         int64_t& last_duration) const {
+  if (nb_packets <= 0) {
+    return false;
+  }
+  pts = last_pts_.load(std::memory_order_relaxed);
+  last_duration = last_duration_.load(std::memory_order_relaxed);
+  return true;
+}
+
+BufferLevel PacketQueue::GetBufferLevel() const {
+  BufferLevel level;
+  level.packets = nb_packets;
+  level.bytes = size;
+  if (time_base.den) {
+    level.duration_ms =
+        (int64_t)(av_q2d(time_base) * (double)duration.load() * 1000);
+  }
+  return level;
+}
+
+void PacketQueue::SetBackBuffer(int64_t max_duration_ms, int64_t max_bytes) {
+  std::lock_guard<std::mutex> lock(consumer_mutex_);
+  back_buffer_max_duration_ms_ = max_duration_ms;
+  back_buffer_max_bytes_ = max_bytes;
+  if (max_duration_ms <= 0 && max_bytes <= 0) {
+    ClearBackBuffer();
+  } else {
+    TrimBackBuffer();
+  }
+}
+
+int64_t PacketQueue::ReleaseBackBuffer() {
+  std::lock_guard<std::mutex> lock(consumer_mutex_);
+  int64_t released = retained_size_;
+  ClearBackBuffer();
+  return released;
+}
+
+bool PacketQueue::CanSeekInBuffer(int64_t target) {
+  std::lock_guard<std::mutex> lock(consumer_mutex_);
+  std::vector<const Packet*> sequence;
+  return FindSeekPoint(target, sequence) >= 0;
+}
+
+bool PacketQueue::SeekInBuffer(int64_t target) {
+  {
+    std::lock_guard<std::mutex> lock(consumer_mutex_);
+    std::vector<const Packet*> sequence;
+    auto seek_point = FindSeekPoint(target, sequence);
+    if (seek_point < 0) {
+      return false;
+    }
+    auto new_serial = serial.load(std::memory_order_relaxed) + 1;
+    if (seek_point < (int)retained_.size()) {
+      // rewind: the tail of back buffer goes back in front of the queue.
+      while ((int)retained_.size() > seek_point) {
+        PacketSlot slot{std::move(retained_.back()), new_serial};
+        retained_.pop_back();
+        retained_size_ -= slot.pkt->size;
+        retained_duration_ -= slot.pkt->duration;
+        UpdatePendingStatistic(slot.pkt, 1);
+        replay_.push_front(std::move(slot));
+      }
+    } else {
+      // skip forward: pending packets before the keyframe are consumed.
+      auto skip = seek_point - (int)retained_.size();
+      auto retain = IsBackBufferEnabled();
+      PacketSlot slot;
+      while (skip-- > 0 && PopPending(&slot)) {
+        if (slot.pkt.IsFlush()) {
+          continue;
+        }
+        if (retain && (slot.pkt->buf || !slot.pkt->data)) {
+          Retain(std::move(slot.pkt));
+        } else {
+          slot.pkt.Reset();
+        }
+      }
+      TrimBackBuffer();
+    }
+    // the flush of an earlier seek the consumer has not taken yet would get
+    // the new serial too, and flush the decoder in the middle of the stream.
+    for (auto it = replay_.begin(); it != replay_.end();) {
+      if (it->pkt.IsFlush()) {
+        UpdatePendingStatistic(it->pkt, -1);
+        it = replay_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    PacketSlot flush_slot{Packet::Flush(), new_serial};
+    UpdatePendingStatistic(flush_slot.pkt, 1);
+    replay_.push_front(std::move(flush_slot));
+    if (rebase_serial_ == INT_MAX) {
+      rebase_serial_ = new_serial - 1;
+    }
+    serial.store(new_serial, std::memory_order_release);
+  }
+  WakeWaiters();
+  return true;
 }
@@ -5,52 +5,169 @@
 #ifndef FFP_PACKET_QUEUE_H
 #define FFP_PACKET_QUEUE_H
 
-#include <mutex>
+#include <atomic>
+#include <climits>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "buffering_policy.h"
+#include "ffp_av_handle.h"
 
-extern "C" {
-#include "libavcodec/avcodec.h"
+struct PacketSlot {
+  Packet pkt;
+  int serial = 0;
 };
 
-struct MyAVPacketList {
-  AVPacket pkt;
-  struct MyAVPacketList *next;
-  int serial;
+/**
+ * Fixed capacity ring of packet slots. |tail| is only advanced by the producer
+ * and |head| only by the consumer. Once the producer outgrows a ring it links
+ * a bigger one through |next| and never writes the old ring again, the
+ * consumer switches over after it has drained the old one.
+ */
+struct PacketRing {
+  explicit PacketRing(uint32_t capacity);
+
+  ~PacketRing();
+
+  const uint32_t capacity;
+  PacketSlot* const slots;
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<PacketRing*> next{nullptr};
 };
 
+/**
+ * Single-producer/single-consumer packet queue.
+ *
+ * The producer (DataSource read thread) puts packets without taking any lock,
+ * the consumer (decoder thread) takes them without taking any shared lock with
+ * the producer. Threads only block (and only then touch a mutex) when the
+ * queue is empty or the ring reached |kMaxRingCapacity| and is full.
+ */
 class PacketQueue {
  public:
-  static AVPacket *GetFlushPacket();
+  static const uint32_t kInitialRingCapacity = 64;
+  static const uint32_t kMaxRingCapacity = 1 << 16;
+
+  std::atomic<int> nb_packets{0};
+  std::atomic<int> size{0};
+  std::atomic<int64_t> duration{0};
+  std::atomic<int> abort_request{1};
+  // only written by the producer, with release stores: a reader seeing a
+  // serial also sees the flush packet that started it.
+  std::atomic<int> serial{0};
+  AVRational time_base{};
 
-  MyAVPacketList *first_pkt = nullptr, *last_pkt = nullptr;
-  int nb_packets = 0;
-  int size = 0;
-  int64_t duration = 0;
-  int abort_request = true;
-  int serial = 0;
-  std::mutex mutex;
-  std::condition_variable_any cond;
-  AVRational time_base;
  private:
-  int Put_(AVPacket *pkt);
+  // producer side.
+  PacketRing* write_ring_;
+  // consumer side.
+  PacketRing* read_ring_;
 
- public:
+  // Serializes the consumer with Flush() called from other threads. It is
+  // never contended in steady state.
+  std::mutex consumer_mutex_;
+
+  std::mutex wait_mutex_;
+  std::condition_variable cond_;
+  std::atomic<int> waiters_{0};
+
+  std::atomic<int64_t> last_pts_{AV_NOPTS_VALUE};
+  std::atomic<int64_t> last_duration_{0};
+
+  // Back buffer: packets already handed to the consumer, kept for seeking
+  // back. Guarded by |consumer_mutex_|.
+  int64_t back_buffer_max_duration_ms_ = 0;
+  int64_t back_buffer_max_bytes_ = 0;
+  std::deque<Packet> retained_;
+  std::atomic<int64_t> retained_size_{0};
+  int64_t retained_duration_ = 0;
+  // Packets to be consumed before the ring, filled by SeekInBuffer().
+  std::deque<PacketSlot> replay_;
+  // Packets in the ring with a serial not less than this one were moved by
+  // SeekInBuffer() and belong to the current serial.
+  int rebase_serial_ = INT_MAX;
+
+  // Low watermark: see SetLowWatermarkListener().
+  std::function<bool(const BufferLevel&)> has_enough_;
+  std::function<void()> low_watermark_listener_;
+  std::atomic<int64_t> low_watermark_max_bytes_{-1};
+  std::atomic<bool> low_watermark_armed_{false};
+
+  int Put_(Packet pkt);
+
+  PacketRing* AcquireWritableRing();
+
+  bool Pop(Packet* pkt, int* pkt_serial);
+
+  bool PopPending(PacketSlot* slot);
+
+  void UpdatePendingStatistic(const Packet& pkt, int sign);
+
+  bool IsBackBufferEnabled() const;
+
+  void Retain(Packet pkt);
 
+  void TrimBackBuffer();
+
+  void ClearBackBuffer();
+
+  int FindSeekPoint(int64_t target, std::vector<const Packet*>& sequence);
+
+  bool IsReadable();
+
+  void WaitUntil(const std::function<bool()>& ready);
+
+  void WakeWaiters();
+
+  void CheckLowWatermark();
+
+ public:
   PacketQueue();
 
   ~PacketQueue();
 
-  int Put(AVPacket *pkt);
+  /**
+   * Take ownership of |pkt|, it is released if the queue is aborted.
+   */
+  int Put(Packet pkt);
 
   int PutNullPacket(int stream_index);
 
+  /**
+   * Drop all packets, can be called from any thread. The packets are released
+   * on the calling thread.
+   */
   void Flush();
 
+  /**
+   * Detach all packets in one step and start a new serial by putting the flush
+   * packet. Detached packets are released on a background thread, so the cost
+   * does not depend on how deep the queue was.
+   *
+   * Must be called from the producer thread.
+   */
+  void BumpSerial();
+
   void Abort();
 
   void Start();
 
-  int Get(AVPacket *pkt, int block, int *pkt_serial, void *opacity, void (*on_block)(void *opacity));
+  /**
+   * Take pkt from packet queue.
+   *
+   * @param block wait until there is a packet if non-zero.
+   * @param on_block called before the consumer goes to sleep.
+   * @return -1 if aborted, 0 if there is no packet, 1 if success.
+   */
+  int Get(Packet* pkt,
+          int block,
+          int* pkt_serial,
+          void* opacity,
+          void (*on_block)(void* opacity));
 
   /**
    * Take pkt from packet queue.
@@ -59,8 +176,79 @@ class PacketQueue {
    * @param pkt_serial the serial of pkt.
    * @return -1 if we got nothing, 0 if success.
    */
-  int DequeuePacket(AVPacket &pkt, int *pkt_serial);
+  int DequeuePacket(Packet& pkt, int* pkt_serial);
+
+  /**
+   * Timestamp of the last packet put into queue.
+   *
+   * @return false if the queue is empty.
+   */
+  bool GetLastPacketTimestamp(int64_t& pts, int64_t& last_duration) const;
+
+  /** @return packets waiting for the consumer, for BufferingPolicy. */
+  BufferLevel GetBufferLevel() const;
+
+  /**
+   * Let the producer sleep while the queue is full enough: |listener| is
+   * called once, on the consumer thread, when a packet taken leaves the queue
+   * no longer |has_enough| after ArmLowWatermark().
+   *
+   * Must be called before the consumer starts.
+   */
+  void SetLowWatermarkListener(
+      std::function<bool(const BufferLevel&)> has_enough,
+      std::function<void()> listener);
+
+  /**
+   * Arm the listener for the next crossing. Must be called from the producer
+   * thread, before it checks whether it has to sleep.
+   *
+   * @param max_bytes if not negative, wait until the queue holds no more
+   * than this many bytes instead of until it is no longer |has_enough|.
+   */
+  void ArmLowWatermark(int64_t max_bytes = -1);
+
+  /**
+   * Keep packets taken by the consumer for seeking back.
+   *
+   * @param max_duration_ms max duration to keep, 0 for no duration limit.
+   * @param max_bytes max bytes to keep, 0 for no bytes limit.
+   * Back buffer is disabled if both are 0.
+   */
+  void SetBackBuffer(int64_t max_duration_ms, int64_t max_bytes);
 
+  /** @return bytes of packets kept in the back buffer. */
+  int64_t GetRetainedBytes() const { return retained_size_; }
+
+  /**
+   * Drop the back buffer to release memory, the back buffer keeps working
+   * afterwards. Can be called from any thread.
+   *
+   * @return bytes released.
+   */
+  int64_t ReleaseBackBuffer();
+
+  /**
+   * Check whether |target| can be served by SeekInBuffer().
+   *
+   * Must be called from the producer thread.
+   *
+   * @param target timestamp in |time_base|.
+   */
+  bool CanSeekInBuffer(int64_t target);
+
+  /**
+   * Move the read position to the last keyframe at or before |target|, which
+   * either is in the back buffer or still pending in the queue. The consumer
+   * receives a flush packet with a new serial followed by packets from that
+   * keyframe on.
+   *
+   * Must be called from the producer thread.
+   *
+   * @param target timestamp in |time_base|.
+   * @return false if |target| is not covered by buffered packets.
+   */
+  bool SeekInBuffer(int64_t target);
 };
 
-#endif //FFP_PACKET_QUEUE_H
+#endif  // FFP_PACKET_QUEUE_H
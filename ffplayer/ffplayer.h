@@ -2,6 +2,8 @@
 #define FFPLAYER_FFPLAYER_H_
 
 #include <cstdint>
+#include <map>
+#include <string>
 
 struct PlayerConfiguration {
   int32_t audio_disable = false;
@@ -14,6 +16,66 @@ struct PlayerConfiguration {
 
   double start_time = 0;
   int32_t loop = 1;
+
+  // Keep packets already taken by decoders, so that seeking back into them
+  // does not go through the demuxer. 0 means no limit on that dimension, the
+  // back buffer is disabled if both are 0.
+  int32_t back_buffer_duration_ms = 0;
+  int32_t back_buffer_max_bytes = 0;
+
+  // Decoded audio kept ahead of the audio device, about 100 ms is enough for
+  // low-memory devices and 1000 ms absorbs high decode/network jitter. 0 means
+  // no limit on that dimension, the duration falls back to 200 ms if both
+  // are 0.
+  int32_t audio_buffer_duration_ms = 200;
+  int32_t audio_buffer_max_bytes = 0;
+
+  // Local files are memory mapped, which saves a syscall and a copy per read.
+  // Only for files that are never truncated or replaced while played: a read
+  // past the new end raises SIGBUS. Page faults on network file systems can
+  // not be aborted either. Off, local files use the read ahead below.
+  int32_t mmap_local_files = false;
+
+  // Local files which are not mapped are read ahead of the demuxer by a
+  // prefetch thread, keeping this many MB in memory. 0 lets ffmpeg read the
+  // file directly.
+  int32_t read_ahead_window_mb = 4;
+
+  // Http streams of known size go through the disk cache, once it is enabled
+  // with MediaCache::SetDirectory().
+  int32_t cache_network_streams = true;
+
+  // Remote files served with range requests are fetched over this many
+  // connections at once, in segments read back in order. 1 uses a single
+  // connection.
+  int32_t http_connections = 4;
+
+  // A network source that fails is reopened and resumes at the byte it had
+  // reached, with an exponential backoff, for up to this long. 0 ends the
+  // playback on the first failure.
+  int32_t reconnect_timeout_ms = 30000;
+
+  // Read the source through an emulated network link, for reproducible
+  // buffering measurements. NetworkProfile options such as
+  // "profile=3g,seed=7", same as the url prefix "netem:profile=3g,seed=7|".
+  // Empty reads the source as is.
+  std::string network_emulation;
+
+  // Options of avformat_open_input, such as probesize, analyzeduration or
+  // fpsprobesize. "format" forces the input format, like ffplay's -f.
+  std::map<std::string, std::string> format_options;
+
+  // Remember the format and streams probed from local files, keyed by path,
+  // size and modification time, so that opening them again skips probing.
+  // See ProbeCache::SetStoragePath() to keep them across sessions.
+  int32_t probe_cache = true;
+
+  // The source is encrypted with AES-128-CTR and decrypted while reading.
+  // The iv holds the nonce and the 64 bit big endian counter of the first
+  // block.
+  int32_t decrypt_aes_ctr = false;
+  uint8_t decryption_key[16] = {};
+  uint8_t decryption_iv[16] = {};
 };
 
 #endif  // FFPLAYER_FFPLAYER_H_
\ No newline at end of file
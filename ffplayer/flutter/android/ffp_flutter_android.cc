@@ -21,7 +21,7 @@ FlutterAndroidVideoRender::~FlutterAndroidVideoRender() {
   Detach();
 }
 
-void FlutterAndroidVideoRender::RenderPicture(Frame& frame) {
+void FlutterAndroidVideoRender::RenderPicture(VideoFrame& frame) {
   CHECK_VALUE(texture_);
   CHECK_VALUE(texture_->native_window());
 
@@ -43,7 +43,7 @@ void FlutterAndroidVideoRender::RenderPicture(Frame& frame) {
   }
 
 #if 1
-  auto* av_frame = frame.frame;
+  auto* av_frame = frame.frame.get();
   int linesize[4] = {4 * window_buffer_.stride};
   uint8_t* bgr_buffer[8] = {static_cast<uint8_t*>(window_buffer_.bits)};
   sws_scale(img_convert_ctx_, av_frame->data, av_frame->linesize, 0,
@@ -62,7 +62,7 @@ class FlutterAndroidVideoRender : public FlutterVideoRender {
 
   ~FlutterAndroidVideoRender();
 
-  void RenderPicture(Frame& frame) override;
+  void RenderPicture(VideoFrame& frame) override;
 
   int64_t Attach();
 
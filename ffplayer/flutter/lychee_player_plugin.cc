@@ -5,7 +5,11 @@
 #include "dart/dart_api_dl.h"
 #include "lychee_player_plugin.h"
 
+#include "http_connection_pool.h"
 #include "media_player.h"
+#include "prefetch_scheduler.h"
+#include "prepared_source_pool.h"
+#include "probe_cache.h"
 
 #ifdef LYCHEE_ENABLE_SDL
 #include "audio_render_sdl.h"
@@ -40,23 +44,7 @@ void PostMessageToDart(Dart_Port_DL send_port,
   Dart_PostCObject_DL(send_port, &dart_args);
 }
 
-}  // namespace
-
-void lychee_player_initialize_dart(void* native_port) {
-  Dart_InitializeApiDL(native_port);
-  MediaPlayer::GlobalInit();
-
-  if (players_) {
-    for (const auto& player : *players_) {
-      av_log(nullptr, AV_LOG_INFO,
-             "free play, close stream %p by flutter global \n", player);
-      ReleasePlayer(player);
-    }
-    players_->clear();
-  }
-}
-
-void* lychee_player_create(const char* file_path, int64_t send_port) {
+MediaPlayer* CreatePlayer() {
   std::unique_ptr<VideoRenderBase> video_render = nullptr;
   std::unique_ptr<BasicAudioRender> audio_render;
 #ifdef LYCHEE_ENABLE_SDL
@@ -70,9 +58,10 @@ void* lychee_player_create(const char* file_path, int64_t send_port) {
   video_render = nullptr;
   audio_render = std::make_unique<AudioRenderSdl>();
 #endif
-  auto* player =
-      new MediaPlayer(std::move(video_render), std::move(audio_render));
-  player->OpenDataSource(file_path);
+  return new MediaPlayer(std::move(video_render), std::move(audio_render));
+}
+
+void RegisterPlayer(MediaPlayer* player, int64_t send_port) {
   player->SetMessageHandleCallback(
       [send_port](int what, int64_t arg1, int64_t arg2) {
         PostMessageToDart(send_port, what, arg1, arg2);
@@ -81,6 +70,69 @@ void* lychee_player_create(const char* file_path, int64_t send_port) {
     players_ = new std::list<MediaPlayer*>;
   }
   players_->push_back(player);
+}
+
+}  // namespace
+
+void lychee_player_initialize_dart(void* native_port) {
+  Dart_InitializeApiDL(native_port);
+  MediaPlayer::GlobalInit();
+
+  if (players_) {
+    for (const auto& player : *players_) {
+      av_log(nullptr, AV_LOG_INFO,
+             "free play, close stream %p by flutter global \n", player);
+      ReleasePlayer(player);
+    }
+    players_->clear();
+  }
+}
+
+void* lychee_player_create(const char* file_path, int64_t send_port) {
+  auto* player = CreatePlayer();
+  player->OpenDataSource(file_path);
+  RegisterPlayer(player, send_port);
+  return player;
+}
+
+void* lychee_memory_source_create() {
+  return new std::shared_ptr<MemorySource>(std::make_shared<MemorySource>());
+}
+
+int lychee_memory_source_append(void* source,
+                                const uint8_t* data,
+                                int64_t size,
+                                lychee_release_callback release,
+                                void* opaque) {
+  if (!source) {
+    return -1;
+  }
+  auto& memory_source = *static_cast<std::shared_ptr<MemorySource>*>(source);
+  MemorySource::ReleaseCallback release_callback;
+  if (release) {
+    release_callback = [release, opaque]() { release(opaque); };
+  }
+  return memory_source->Append(data, size, std::move(release_callback));
+}
+
+void lychee_memory_source_finish(void* source) {
+  if (!source) {
+    return;
+  }
+  (*static_cast<std::shared_ptr<MemorySource>*>(source))->Finish();
+}
+
+void lychee_memory_source_release(void* source) {
+  delete static_cast<std::shared_ptr<MemorySource>*>(source);
+}
+
+void* lychee_player_create_from_memory(void* source, int64_t send_port) {
+  if (!source) {
+    return nullptr;
+  }
+  auto* player = CreatePlayer();
+  player->OpenDataSource(*static_cast<std::shared_ptr<MemorySource>*>(source));
+  RegisterPlayer(player, send_port);
   return player;
 }
 
@@ -142,3 +194,83 @@ int lychee_player_get_volume(void* player) {
   auto* p = static_cast<MediaPlayer*>(player);
   return p->GetVolume();
 }
+
+int64_t lychee_player_get_memory_usage(void* player) {
+  if (!player) {
+    return 0;
+  }
+  auto* p = static_cast<MediaPlayer*>(player);
+  return p->GetMemoryUsage();
+}
+
+void lychee_player_set_memory_budget(int64_t bytes) {
+  MemoryGovernor::Get()->SetBudget(bytes);
+}
+
+int64_t lychee_player_get_property_int64(void* player,
+                                         int property,
+                                         int64_t default_value) {
+  if (!player) {
+    return default_value;
+  }
+  auto* p = static_cast<MediaPlayer*>(player);
+  return p->GetPropertyInt64(property, default_value);
+}
+
+void lychee_player_set_property_int64(void* player,
+                                      int property,
+                                      int64_t value) {
+  if (!player) {
+    return;
+  }
+  static_cast<MediaPlayer*>(player)->SetPropertyInt64(property, value);
+}
+
+void lychee_player_set_cache_directory(const char* directory,
+                                       int64_t max_bytes) {
+  MediaCache::Get()->SetDirectory(directory ? directory : "", max_bytes);
+}
+
+void lychee_player_set_probe_cache_path(const char* path) {
+  ProbeCache::Get()->SetStoragePath(path ? path : "");
+}
+
+void lychee_player_prepare_source(const char* file_path) {
+  if (!file_path) {
+    return;
+  }
+  PlayerConfiguration configuration;
+#if defined(LYCHEE_ENABLE_SDL) || !_FLUTTER_MEDIA_ANDROID
+  // same as the players of CreatePlayer(), which have no video render.
+  configuration.video_disable = true;
+#endif
+  PreparedSourcePool::Get()->Prepare(file_path, configuration);
+}
+
+void lychee_player_configure_source_pool(int max_sources,
+                                         int64_t max_bytes,
+                                         int64_t buffer_ms) {
+  PreparedSourcePool::Get()->Configure(max_sources, max_bytes, buffer_ms);
+}
+
+void lychee_player_configure_http_pool(int max_connections_per_host) {
+  HttpConnectionPool::Get()->Configure(max_connections_per_host);
+}
+
+void lychee_player_set_prefetch_queue(const char** urls, int count) {
+  std::vector<PrefetchRequest> requests;
+  for (int i = 0; i < count; i++) {
+    if (urls[i]) {
+      // the first queued plays first.
+      requests.push_back({urls[i], count - i});
+    }
+  }
+  PrefetchScheduler::Get()->SetQueue(requests);
+}
+
+void lychee_player_configure_prefetch(int max_concurrent,
+                                      int64_t max_bytes_per_second,
+                                      int64_t bytes_per_url) {
+  PrefetchScheduler::Get()->Configure(max_concurrent, max_bytes_per_second,
+                                      bytes_per_url);
+}
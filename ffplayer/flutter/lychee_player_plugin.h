@@ -28,6 +28,34 @@ extern "C" {
 FFI_PLUGIN_EXPORT void* lychee_player_create(const char* file_path,
                                              int64_t send_port);
 
+typedef void (*lychee_release_callback)(void* opaque);
+
+// media bytes held by the caller, a single buffer or a stream of chunks.
+FFI_PLUGIN_EXPORT void* lychee_memory_source_create();
+
+// |release| is called with |opaque| once |data| is not used anymore, it can be
+// null. returns -1 if the source is finished.
+//
+// |release| runs on whatever native thread drops the last reference to the
+// chunk: a player's read or dispose thread, or the caller of append or
+// release. It must not call into Dart directly, post to an isolate instead,
+// such as with a NativeCallable.listener.
+FFI_PLUGIN_EXPORT int lychee_memory_source_append(
+    void* source,
+    const uint8_t* data,
+    int64_t size,
+    lychee_release_callback release,
+    void* opaque);
+
+// no data will be appended anymore.
+FFI_PLUGIN_EXPORT void lychee_memory_source_finish(void* source);
+
+// release the handle, players created from the source keep using it.
+FFI_PLUGIN_EXPORT void lychee_memory_source_release(void* source);
+
+FFI_PLUGIN_EXPORT void* lychee_player_create_from_memory(void* source,
+                                                         int64_t send_port);
+
 FFI_PLUGIN_EXPORT void lychee_player_dispose(void* player);
 
 FFI_PLUGIN_EXPORT void lychee_player_set_play_when_ready(void* player,
@@ -46,6 +74,57 @@ FFI_PLUGIN_EXPORT void lychee_player_set_volume(void* player, int volume);
 // get volume
 FFI_PLUGIN_EXPORT int lychee_player_get_volume(void* player);
 
+// bytes of packets and decoded frames held by the player.
+FFI_PLUGIN_EXPORT int64_t lychee_player_get_memory_usage(void* player);
+
+// memory budget shared by all players, in bytes.
+FFI_PLUGIN_EXPORT void lychee_player_set_memory_budget(int64_t bytes);
+
+// FFP_PROP_INT64_* value, such as the cache statistic.
+FFI_PLUGIN_EXPORT int64_t lychee_player_get_property_int64(
+    void* player,
+    int property,
+    int64_t default_value);
+
+// set a FFP_PROP_INT64_* value, such as FFP_PROP_INT64_IMMEDIATE_RECONNECT
+// when the network changed.
+FFI_PLUGIN_EXPORT void lychee_player_set_property_int64(void* player,
+                                                        int property,
+                                                        int64_t value);
+
+// cache http streams in |directory|, up to |max_bytes|. 0 for the default
+// limit.
+FFI_PLUGIN_EXPORT void lychee_player_set_cache_directory(const char* directory,
+                                                         int64_t max_bytes);
+
+// keep the probe results of local files in |path| across sessions.
+FFI_PLUGIN_EXPORT void lychee_player_set_probe_cache_path(const char* path);
+
+// open and buffer |file_path| in the background, so that a player created
+// for it later starts at once.
+FFI_PLUGIN_EXPORT void lychee_player_prepare_source(const char* file_path);
+
+// limits of the prepared sources, see PreparedSourcePool::Configure().
+FFI_PLUGIN_EXPORT void lychee_player_configure_source_pool(int max_sources,
+                                                           int64_t max_bytes,
+                                                           int64_t buffer_ms);
+
+// keep-alive http connections open to a host at most, 0 leaves http to
+// ffmpeg. See HttpConnectionPool::Configure().
+FFI_PLUGIN_EXPORT void lychee_player_configure_http_pool(
+    int max_connections_per_host);
+
+// download the start of |urls| into the media cache, in the order they
+// will play. Replaces the previous queue.
+FFI_PLUGIN_EXPORT void lychee_player_set_prefetch_queue(const char** urls,
+                                                        int count);
+
+// budget of the prefetching, see PrefetchScheduler::Configure().
+FFI_PLUGIN_EXPORT void lychee_player_configure_prefetch(
+    int max_concurrent,
+    int64_t max_bytes_per_second,
+    int64_t bytes_per_url);
+
 #ifdef __cplusplus
 }
 #endif
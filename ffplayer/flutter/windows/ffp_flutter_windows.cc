@@ -21,14 +21,14 @@ void register_flutter_plugin(flutter::PluginRegistrarWindows* registrar) {
   std::cout << "register_flutter_plugin: " << registrar << std::endl;
 }
 
-void FlutterWindowsVideoRender::RenderPicture(Frame& frame) {
+void FlutterWindowsVideoRender::RenderPicture(VideoFrame& frame) {
   if (!pixel_buffer_->buffer) {
     std::cout << "render_frame：init" << std::endl;
     pixel_buffer_->height = frame.height;
     pixel_buffer_->width = frame.width;
     pixel_buffer_->buffer = new uint8_t[frame.height * frame.width * 4];
   }
-  auto av_frame = frame.frame;
+  auto* av_frame = frame.frame.get();
 
   img_convert_ctx_ = sws_getCachedContext(
       img_convert_ctx_, av_frame->width, av_frame->height,
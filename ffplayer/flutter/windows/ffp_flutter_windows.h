@@ -23,7 +23,7 @@ class FlutterWindowsVideoRender : public FlutterVideoRender {
   struct SwsContext* img_convert_ctx_ = nullptr;
 
  public:
-  void RenderPicture(Frame& frame) override;
+  void RenderPicture(VideoFrame& frame) override;
 
   int64_t Attach();
 
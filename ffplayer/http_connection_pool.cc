@@ -0,0 +1,255 @@
+//
+// Created by boyan on 2021/3/14.
+//
+
+#include "http_connection_pool.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "ffp_utils.h"
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define CONNECTION_BUFFER_SIZE (16 * 1024)
+#define MAX_LINE_LENGTH 8192
+
+/* idle connections are closed after this, before most servers drop them */
+#define IDLE_TIMEOUT_US (30 * 1000000LL)
+
+/* requests wait this long for a connection at the per host limit, then open
+ * one beyond it rather than stall playback behind a paused player */
+#define ACQUIRE_TIMEOUT_US (2 * 1000000LL)
+#define ACQUIRE_POLL_MS 100
+
+const int HttpConnectionPool::kDefaultMaxConnectionsPerHost;
+
+HttpConnection::~HttpConnection() {
+  avio_closep(&avio_);
+}
+
+int HttpConnection::InterruptCallback(void* opaque) {
+  auto& parent = static_cast<HttpConnection*>(opaque)->parent_interrupt_cb_;
+  return parent.callback && parent.callback(parent.opaque);
+}
+
+int HttpConnection::Write(const std::string& data) {
+  avio_write(avio_, reinterpret_cast<const uint8_t*>(data.data()),
+             (int)data.size());
+  avio_flush(avio_);
+  return avio_->error < 0 ? avio_->error : 0;
+}
+
+int HttpConnection::FillBuffer() {
+  if (buffer_.empty()) {
+    buffer_.resize(CONNECTION_BUFFER_SIZE);
+  }
+  // reads straight from the protocol, the context is opened for writing.
+  auto ret = avio_read_partial(avio_, buffer_.data(), (int)buffer_.size());
+  if (ret <= 0) {
+    return ret ? ret : AVERROR_EOF;
+  }
+  buffer_pos_ = 0;
+  buffer_end_ = ret;
+  return ret;
+}
+
+int HttpConnection::ReadLine(std::string* line) {
+  line->clear();
+  for (;;) {
+    if (buffer_pos_ == buffer_end_) {
+      auto ret = FillBuffer();
+      if (ret < 0) {
+        return ret;
+      }
+    }
+    auto c = (char)buffer_[buffer_pos_++];
+    if (c == '\n') {
+      if (!line->empty() && line->back() == '\r') {
+        line->pop_back();
+      }
+      return 0;
+    }
+    if (line->size() >= MAX_LINE_LENGTH) {
+      return AVERROR_INVALIDDATA;
+    }
+    line->push_back(c);
+  }
+}
+
+int HttpConnection::Read(uint8_t* buf, int size) {
+  if (buffer_pos_ == buffer_end_) {
+    if (size >= CONNECTION_BUFFER_SIZE) {
+      auto ret = avio_read_partial(avio_, buf, size);
+      return ret ? ret : AVERROR_EOF;
+    }
+    auto ret = FillBuffer();
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  auto bytes = FFMIN(size, buffer_end_ - buffer_pos_);
+  memcpy(buf, buffer_.data() + buffer_pos_, bytes);
+  buffer_pos_ += bytes;
+  return bytes;
+}
+
+HttpConnectionPool* HttpConnectionPool::Get() {
+  static auto* instance = new HttpConnectionPool();
+  return instance;
+}
+
+void HttpConnectionPool::Configure(int max_connections_per_host) {
+  std::vector<std::unique_ptr<HttpConnection>> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_connections_per_host_ = FFMAX(max_connections_per_host, 0);
+  if (!max_connections_per_host_) {
+    for (auto& item : hosts_) {
+      for (auto& connection : item.second.idle) {
+        closed.push_back(std::move(connection));
+      }
+      item.second.idle.clear();
+    }
+  }
+  released_cond_.notify_all();
+}
+
+bool HttpConnectionPool::IsEnabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_connections_per_host_ > 0;
+}
+
+int HttpConnectionPool::Acquire(const std::string& scheme,
+                                const std::string& host,
+                                int port,
+                                const AVIOInterruptCB* interrupt_cb,
+                                bool fresh,
+                                std::unique_ptr<HttpConnection>* connection) {
+  auto key = scheme + "://" + host + ":" + std::to_string(port);
+  AVIOInterruptCB parent_cb = {nullptr, nullptr};
+  if (interrupt_cb) {
+    parent_cb = *interrupt_cb;
+  }
+  // closed without the lock, when leaving.
+  std::vector<std::unique_ptr<HttpConnection>> closed;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    TakeExpired(&closed);
+    auto& entry = hosts_[key];
+    auto wait_start = av_gettime_relative();
+    for (;;) {
+      if (!fresh && !entry.idle.empty()) {
+        *connection = std::move(entry.idle.back());
+        entry.idle.pop_back();
+        break;
+      }
+      if (entry.active + (int)entry.idle.size() < max_connections_per_host_) {
+        break;
+      }
+      if (!entry.idle.empty()) {
+        // make room for a fresh one.
+        closed.push_back(std::move(entry.idle.front()));
+        entry.idle.pop_front();
+        continue;
+      }
+      if (parent_cb.callback && parent_cb.callback(parent_cb.opaque)) {
+        return AVERROR_EXIT;
+      }
+      if (av_gettime_relative() - wait_start > ACQUIRE_TIMEOUT_US) {
+        av_log(nullptr, AV_LOG_WARNING,
+               "http pool: %s has %d connections busy, opening one more.\n",
+               key.c_str(), entry.active);
+        break;
+      }
+      released_cond_.wait_for(lock,
+                              std::chrono::milliseconds(ACQUIRE_POLL_MS));
+    }
+    entry.active++;
+    if (*connection) {
+      hits_++;
+      (*connection)->parent_interrupt_cb_ = parent_cb;
+      return 0;
+    }
+    misses_++;
+  }
+
+  std::unique_ptr<HttpConnection> opened(new HttpConnection());
+  opened->key_ = key;
+  opened->parent_interrupt_cb_ = parent_cb;
+  AVIOInterruptCB cb = {HttpConnection::InterruptCallback, opened.get()};
+  auto address = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+  auto url = (scheme == "https" ? "tls://" : "tcp://") + address + ":" +
+             std::to_string(port);
+  auto ret = avio_open2(&opened->avio_, url.c_str(), AVIO_FLAG_READ_WRITE,
+                        &cb, nullptr);
+  if (ret < 0) {
+    av_log(nullptr, AV_LOG_ERROR, "http pool: can not connect to %s: %s.\n",
+           key.c_str(), av_err_to_str(ret));
+    std::lock_guard<std::mutex> lock(mutex_);
+    hosts_[key].active--;
+    released_cond_.notify_all();
+    return ret;
+  }
+  *connection = std::move(opened);
+  return 0;
+}
+
+void HttpConnectionPool::Release(std::unique_ptr<HttpConnection> connection,
+                                 bool reusable) {
+  if (!connection) {
+    return;
+  }
+  connection->requests_++;
+  connection->parent_interrupt_cb_ = {nullptr, nullptr};
+  // bytes left over belong to a response nobody reads.
+  reusable &= connection->buffer_pos_ == connection->buffer_end_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = hosts_[connection->key_];
+    entry.active--;
+    if (reusable && max_connections_per_host_ > 0) {
+      connection->released_time_ = av_gettime_relative();
+      entry.idle.push_back(std::move(connection));
+    }
+    released_cond_.notify_all();
+  }
+  // otherwise closed here without the lock, closing tls sends a message.
+}
+
+int HttpConnectionPool::GetHitCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+int HttpConnectionPool::GetMissCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+void HttpConnectionPool::Trim() {
+  std::vector<std::unique_ptr<HttpConnection>> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& item : hosts_) {
+    for (auto& connection : item.second.idle) {
+      closed.push_back(std::move(connection));
+    }
+    item.second.idle.clear();
+  }
+}
+
+void HttpConnectionPool::TakeExpired(
+    std::vector<std::unique_ptr<HttpConnection>>* expired) {
+  auto now = av_gettime_relative();
+  for (auto& item : hosts_) {
+    auto& idle = item.second.idle;
+    while (!idle.empty() &&
+           now - idle.front()->released_time_ > IDLE_TIMEOUT_US) {
+      expired->push_back(std::move(idle.front()));
+      idle.pop_front();
+    }
+  }
+}
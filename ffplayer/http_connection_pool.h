@@ -0,0 +1,141 @@
+//
+// Created by boyan on 2021/3/14.
+//
+
+#ifndef FFPLAYER_HTTP_CONNECTION_POOL_H
+#define FFPLAYER_HTTP_CONNECTION_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+/**
+ * A persistent tcp or tls connection to an http server, used by one request
+ * at a time.
+ */
+class HttpConnection {
+ public:
+  ~HttpConnection();
+
+  int Write(const std::string& data);
+
+  /** Read a line ending with CRLF, stored without it. */
+  int ReadLine(std::string* line);
+
+  /**
+   * Read up to |size| bytes, returns as soon as some are available.
+   *
+   * @return bytes read or a negative AVERROR code.
+   */
+  int Read(uint8_t* buf, int size);
+
+  /** @return true if the connection served requests before. */
+  bool IsReused() const { return requests_ > 0; }
+
+ private:
+  friend class HttpConnectionPool;
+
+  std::string key_;
+  AVIOContext* avio_ = nullptr;
+  // of the current user, checked by blocking protocol calls.
+  AVIOInterruptCB parent_interrupt_cb_{nullptr, nullptr};
+  std::vector<uint8_t> buffer_;
+  int buffer_pos_ = 0;
+  int buffer_end_ = 0;
+  int requests_ = 0;
+  // of the last release, for the idle timeout.
+  int64_t released_time_ = 0;
+
+  HttpConnection() = default;
+
+  static int InterruptCallback(void* opaque);
+
+  int FillBuffer();
+};
+
+/**
+ * Process-wide pool of keep-alive http connections, by scheme, host and
+ * port.
+ *
+ * Opening a track from a host played before reuses an idle connection and
+ * skips the dns lookup, the tcp handshake and the tls handshake. Connections
+ * idle for long are closed, servers drop them anyway.
+ */
+class HttpConnectionPool {
+ public:
+  static const int kDefaultMaxConnectionsPerHost = 6;
+
+  static HttpConnectionPool* Get();
+
+  /**
+   * @param max_connections_per_host connections open to a host at most,
+   * requests wait for one to be released beyond. 0 disables the pool, http
+   * is left to ffmpeg.
+   */
+  void Configure(int max_connections_per_host);
+
+  bool IsEnabled();
+
+  /**
+   * Take an idle connection to |host|, or open one.
+   *
+   * @param scheme "http" or "https".
+   * @param interrupt_cb checked by blocking calls, can be null.
+   * @param fresh never reuse an idle connection.
+   * @return 0 or a negative AVERROR code.
+   */
+  int Acquire(const std::string& scheme,
+              const std::string& host,
+              int port,
+              const AVIOInterruptCB* interrupt_cb,
+              bool fresh,
+              std::unique_ptr<HttpConnection>* connection);
+
+  /**
+   * @param reusable false if the response was not read to its end, or the
+   * server closes the connection.
+   */
+  void Release(std::unique_ptr<HttpConnection> connection, bool reusable);
+
+  /** @return requests served on a reused connection. */
+  int GetHitCount();
+
+  /** @return requests which opened a new connection. */
+  int GetMissCount();
+
+  /** Close all idle connections. */
+  void Trim();
+
+ private:
+  struct Host {
+    // most recently released last.
+    std::deque<std::unique_ptr<HttpConnection>> idle;
+    // connections acquired or being opened.
+    int active = 0;
+  };
+
+  std::mutex mutex_;
+  // signaled when a connection is released.
+  std::condition_variable released_cond_;
+  int max_connections_per_host_ = kDefaultMaxConnectionsPerHost;
+  std::map<std::string, Host> hosts_;
+  int hits_ = 0;
+  int misses_ = 0;
+
+  HttpConnectionPool() = default;
+
+  // must be called with |mutex_| held, moves expired idle connections to
+  // |expired|, to be closed without the lock.
+  void TakeExpired(std::vector<std::unique_ptr<HttpConnection>>* expired);
+};
+
+#endif  // FFPLAYER_HTTP_CONNECTION_POOL_H
@@ -0,0 +1,478 @@
+//
+// Created by boyan on 2021/3/14.
+//
+
+#include "http_io.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "ffp_utils.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavformat/version.h"
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/dict.h"
+#include "libavutil/log.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+}
+
+#define MAX_REDIRECTS 5
+
+/* seeks forward in the current response up to this far read through it,
+ * and leftovers this small are drained, both keep the connection */
+#define SKIP_BYTES (64 * 1024)
+
+static int http_error(int status) {
+  switch (status) {
+    case 400:
+      return AVERROR_HTTP_BAD_REQUEST;
+    case 401:
+      return AVERROR_HTTP_UNAUTHORIZED;
+    case 403:
+      return AVERROR_HTTP_FORBIDDEN;
+    case 404:
+      return AVERROR_HTTP_NOT_FOUND;
+    default:
+      return status < 500 ? AVERROR_HTTP_OTHER_4XX : AVERROR_HTTP_SERVER_ERROR;
+  }
+}
+
+int HttpIO::Open(const char* url,
+                 const AVIOInterruptCB* interrupt_cb,
+                 int64_t request_bytes,
+                 const AVDictionary* options,
+                 std::unique_ptr<HttpIO>* io) {
+  auto* proxy = getenv("http_proxy");
+  if (proxy && *proxy) {
+    return AVERROR(ENOSYS);
+  }
+  std::unique_ptr<HttpIO> http(new HttpIO(interrupt_cb, request_bytes));
+  auto ret = http->SetOptions(options);
+  if (ret < 0) {
+    return ret;
+  }
+  ret = http->SetUrl(url);
+  if (ret < 0) {
+    return ret;
+  }
+  ret = http->Request(0);
+  if (ret < 0) {
+    if (ret != AVERROR(ENOSYS)) {
+      av_log(nullptr, AV_LOG_ERROR, "http: can not open %s: %s.\n", url,
+             av_err_to_str(ret));
+    }
+    return ret;
+  }
+  av_log(nullptr, AV_LOG_INFO,
+         "http: %s, first byte in %.1f ms on a %s connection.\n", url,
+         (double)http->first_byte_time_ / 1000,
+         http->reused_requests_ ? "reused" : "new");
+  *io = std::move(http);
+  return 0;
+}
+
+HttpIO::HttpIO(const AVIOInterruptCB* interrupt_cb, int64_t request_bytes)
+    : request_bytes_(request_bytes) {
+  if (interrupt_cb) {
+    parent_interrupt_cb_ = *interrupt_cb;
+  }
+}
+
+HttpIO::~HttpIO() {
+  ReleaseConnection(false);
+  if (requests_ > 1) {
+    av_log(nullptr, AV_LOG_INFO,
+           "http: %s, %d requests, %d on reused connections, first byte in "
+           "%.1f ms on average.\n",
+           host_.c_str(), requests_, reused_requests_,
+           (double)first_byte_time_ / requests_ / 1000);
+  }
+}
+
+int HttpIO::InterruptCallback(void* opaque) {
+  auto* io = static_cast<HttpIO*>(opaque);
+  if (io->abort_) {
+    return 1;
+  }
+  auto& parent = io->parent_interrupt_cb_;
+  return parent.callback && parent.callback(parent.opaque);
+}
+
+int HttpIO::SetUrl(const std::string& url) {
+  char proto[16], auth[256], host[1024], path[4096];
+  int port = -1;
+  av_url_split(proto, sizeof(proto), auth, sizeof(auth), host, sizeof(host),
+               &port, path, sizeof(path), url.c_str());
+  if (strcmp(proto, "http") != 0 && strcmp(proto, "https") != 0) {
+    return AVERROR(ENOSYS);
+  }
+  if (auth[0]) {
+    return AVERROR(ENOSYS);
+  }
+  if (!host[0]) {
+    return AVERROR(EINVAL);
+  }
+  scheme_ = proto;
+  host_ = host;
+  port_ = port > 0 ? port : scheme_ == "https" ? 443 : 80;
+  path_ = path[0] ? path : "/";
+  return 0;
+}
+
+int HttpIO::SetOptions(const AVDictionary* options) {
+  user_agent_ = LIBAVFORMAT_IDENT;
+  headers_.clear();
+  AVDictionaryEntry* entry = nullptr;
+  while ((entry = av_dict_get(options, "", entry, AV_DICT_IGNORE_SUFFIX))) {
+    if (!strcmp(entry->key, "user_agent")) {
+      user_agent_ = entry->value;
+    } else if (!strcmp(entry->key, "referer")) {
+      headers_ += std::string("Referer: ") + entry->value + "\r\n";
+    } else if (!strcmp(entry->key, "headers")) {
+      headers_ += entry->value;
+      if (headers_.size() < 2 ||
+          headers_.compare(headers_.size() - 2, 2, "\r\n") != 0) {
+        headers_ += "\r\n";
+      }
+    } else if (http_io_is_protocol_option(entry->key)) {
+      // such as cookies or timeout, ffmpeg's http protocol handles them.
+      av_log(nullptr, AV_LOG_DEBUG, "http: option %s left to ffmpeg.\n",
+             entry->key);
+      return AVERROR(ENOSYS);
+    }
+  }
+  return 0;
+}
+
+int HttpIO::Request(int64_t position) {
+  for (int redirects = 0;; redirects++) {
+    Response response;
+    auto ret = SendRequest(position, &response);
+    if (ret < 0) {
+      return ret;
+    }
+    keep_alive_ = response.keep_alive;
+    if (response.status >= 300 && response.status < 400 &&
+        !response.location.empty()) {
+      if (response.content_length >= 0 &&
+          response.content_length <= SKIP_BYTES && !response.chunked) {
+        remaining_ = response.content_length;
+        Skip(remaining_);
+      }
+      ReleaseConnection(false);
+      if (redirects == MAX_REDIRECTS) {
+        av_log(nullptr, AV_LOG_ERROR, "http: too many redirects.\n");
+        return AVERROR(EIO);
+      }
+      auto& location = response.location;
+      if (location[0] == '/') {
+        location = scheme_ + "://" + host_ + ":" + std::to_string(port_) +
+                   location;
+      }
+      ret = SetUrl(location);
+      if (ret < 0) {
+        return ret;
+      }
+      continue;
+    }
+    if (response.status == 416) {
+      // past the end.
+      ReleaseConnection(false);
+      return AVERROR_EOF;
+    }
+    if (response.status >= 400) {
+      ReleaseConnection(false);
+      return http_error(response.status);
+    }
+    if (response.chunked || response.content_length < 0) {
+      ReleaseConnection(false);
+      return AVERROR(ENOSYS);
+    }
+    if (response.status == 206) {
+      if (response.range_start != position) {
+        ReleaseConnection(false);
+        return AVERROR_INVALIDDATA;
+      }
+      size_ = response.total_size;
+      seekable_ = true;
+    } else if (response.status == 200) {
+      if (position > 0) {
+        // the server ignores ranges.
+        ReleaseConnection(false);
+        seekable_ = false;
+        return AVERROR(ENOSYS);
+      }
+      size_ = response.content_length;
+      seekable_ = false;
+    } else {
+      ReleaseConnection(false);
+      return AVERROR_INVALIDDATA;
+    }
+    remaining_ = response.content_length;
+    if (!remaining_) {
+      ReleaseConnection(keep_alive_);
+    }
+    return 0;
+  }
+}
+
+int HttpIO::SendRequest(int64_t position, Response* response) {
+  auto host = host_.find(':') != std::string::npos ? "[" + host_ + "]" : host_;
+  if (port_ != (scheme_ == "https" ? 443 : 80)) {
+    host += ":" + std::to_string(port_);
+  }
+  auto range = "bytes=" + std::to_string(position) + "-";
+  if (request_bytes_ > 0) {
+    auto end = position + request_bytes_;
+    range += std::to_string(size_ >= 0 ? FFMIN(end, size_) - 1 : end - 1);
+  }
+  auto request = "GET " + path_ + " HTTP/1.1\r\nHost: " + host +
+                 "\r\nUser-Agent: " + user_agent_ +
+                 "\r\nAccept: */*\r\nRange: " + range +
+                 "\r\nConnection: keep-alive\r\n" + headers_ + "\r\n";
+
+  AVIOInterruptCB cb = {InterruptCallback, this};
+  for (int attempt = 0;; attempt++) {
+    auto ret = HttpConnectionPool::Get()->Acquire(scheme_, host_, port_, &cb,
+                                                  attempt > 0, &connection_);
+    if (ret < 0) {
+      return ret;
+    }
+    auto reused = connection_->IsReused();
+    auto start = av_gettime_relative();
+    std::string line;
+    ret = connection_->Write(request);
+    if (ret >= 0) {
+      ret = connection_->ReadLine(&line);
+    }
+    int major, minor;
+    if (ret >= 0 && sscanf(line.c_str(), "HTTP/%d.%d %d", &major, &minor,
+                           &response->status) != 3) {
+      ret = AVERROR_INVALIDDATA;
+    }
+    if (ret < 0) {
+      ReleaseConnection(false);
+      // the server may have closed an idle connection meanwhile.
+      if (!reused || abort_ || attempt > 0) {
+        return ret;
+      }
+      continue;
+    }
+    requests_++;
+    reused_requests_ += reused;
+    first_byte_time_ += av_gettime_relative() - start;
+    response->keep_alive = major > 1 || (major == 1 && minor >= 1);
+    break;
+  }
+
+  std::string line;
+  int64_t range_end = -1;
+  for (;;) {
+    auto ret = connection_->ReadLine(&line);
+    if (ret < 0) {
+      ReleaseConnection(false);
+      return ret;
+    }
+    if (line.empty()) {
+      break;
+    }
+    auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    auto name = line.substr(0, colon);
+    auto* value = line.c_str() + colon + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    if (!av_strcasecmp(name.c_str(), "Content-Length")) {
+      response->content_length = strtoll(value, nullptr, 10);
+    } else if (!av_strcasecmp(name.c_str(), "Content-Range")) {
+      // bytes <start>-<end>/<size or *>
+      if (av_strstart(value, "bytes ", &value)) {
+        char* end;
+        response->range_start = strtoll(value, &end, 10);
+        if (*end == '-') {
+          range_end = strtoll(end + 1, &end, 10);
+        }
+        auto* slash = strchr(value, '/');
+        if (slash && slash[1] != '*') {
+          response->total_size = strtoll(slash + 1, nullptr, 10);
+        }
+      }
+    } else if (!av_strcasecmp(name.c_str(), "Connection")) {
+      if (!av_strcasecmp(value, "close")) {
+        response->keep_alive = false;
+      } else if (!av_strcasecmp(value, "keep-alive")) {
+        response->keep_alive = true;
+      }
+    } else if (!av_strcasecmp(name.c_str(), "Transfer-Encoding")) {
+      response->chunked = av_stristr(value, "chunked") != nullptr;
+    } else if (!av_strcasecmp(name.c_str(), "Location")) {
+      response->location = value;
+    }
+  }
+  if (response->content_length < 0 && response->range_start >= 0 &&
+      range_end >= response->range_start && !response->chunked) {
+    response->content_length = range_end - response->range_start + 1;
+  }
+  return 0;
+}
+
+int HttpIO::Skip(int64_t bytes) {
+  uint8_t scratch[4096];
+  while (bytes > 0) {
+    auto ret =
+        connection_->Read(scratch, (int)FFMIN(bytes, (int64_t)sizeof(scratch)));
+    if (ret < 0) {
+      ReleaseConnection(false);
+      remaining_ = 0;
+      return ret;
+    }
+    bytes -= ret;
+    remaining_ -= ret;
+  }
+  if (!remaining_) {
+    ReleaseConnection(keep_alive_);
+  }
+  return 0;
+}
+
+void HttpIO::ReleaseConnection(bool reusable) {
+  if (connection_) {
+    HttpConnectionPool::Get()->Release(std::move(connection_), reusable);
+  }
+}
+
+int HttpIO::Read(uint8_t* buf, int size) {
+  if (abort_) {
+    return AVERROR_EXIT;
+  }
+  if (size_ >= 0 && position_ >= size_) {
+    return AVERROR_EOF;
+  }
+  int ret;
+  for (int attempt = 0;; attempt++) {
+    if (!remaining_) {
+      ret = Request(position_);
+      if (ret < 0) {
+        return ret;
+      }
+      if (!remaining_) {
+        return AVERROR_EOF;
+      }
+    }
+    ret = connection_->Read(buf, (int)FFMIN(size, remaining_));
+    if (ret > 0) {
+      break;
+    }
+    ReleaseConnection(false);
+    remaining_ = 0;
+    if (abort_ || attempt > 0 || !seekable_) {
+      return ret;
+    }
+    av_log(nullptr, AV_LOG_WARNING,
+           "http: connection lost at %" PRId64 ", resuming.\n", position_);
+  }
+  position_ += ret;
+  remaining_ -= ret;
+  if (!remaining_) {
+    // read to its end, the connection goes back to the pool.
+    ReleaseConnection(keep_alive_);
+  }
+  return ret;
+}
+
+int64_t HttpIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return size_;
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      if (size_ < 0) {
+        return AVERROR(ENOSYS);
+      }
+      target = size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  if (target == position_) {
+    return target;
+  }
+  auto distance = target - position_;
+  if (remaining_ && distance > 0 && distance <= FFMIN(remaining_, SKIP_BYTES)) {
+    // cheaper than a new request.
+    auto ret = Skip(distance);
+    if (ret < 0 && !seekable_) {
+      return ret;
+    }
+    position_ = target;
+    return target;
+  }
+  if (!seekable_) {
+    return AVERROR(ENOSYS);
+  }
+  if (remaining_ && remaining_ <= SKIP_BYTES) {
+    Skip(remaining_);
+  }
+  ReleaseConnection(false);
+  remaining_ = 0;
+  position_ = target;
+  return target;
+}
+
+void HttpIO::Abort() {
+  abort_ = true;
+}
+
+std::unique_ptr<MediaIO> http_io_open(const char* url,
+                                      const AVIOInterruptCB* interrupt_cb,
+                                      int64_t request_bytes,
+                                      const AVDictionary* options,
+                                      bool* seekable) {
+  if (HttpConnectionPool::Get()->IsEnabled()) {
+    std::unique_ptr<HttpIO> io;
+    auto ret = HttpIO::Open(url, interrupt_cb, request_bytes, options, &io);
+    if (ret >= 0) {
+      if (seekable) {
+        *seekable = io->IsSeekable();
+      }
+      return io;
+    }
+    if (ret != AVERROR(ENOSYS)) {
+      return nullptr;
+    }
+  }
+  // avio_open2() takes the options it uses out of the dictionary.
+  AVDictionary* url_options = nullptr;
+  av_dict_copy(&url_options, options, 0);
+  auto io = UrlIO::Open(url, interrupt_cb, &url_options);
+  av_dict_free(&url_options);
+  if (io && seekable) {
+    *seekable = io->IsSeekable();
+  }
+  return io;
+}
+
+bool http_io_is_protocol_option(const char* key) {
+  auto* protocol_class = avio_protocol_get_class("http");
+  return protocol_class && av_opt_find(&protocol_class, key, nullptr, 0,
+                                       AV_OPT_SEARCH_FAKE_OBJ) != nullptr;
+}
@@ -0,0 +1,131 @@
+//
+// Created by boyan on 2021/3/14.
+//
+
+#ifndef FFPLAYER_HTTP_IO_H
+#define FFPLAYER_HTTP_IO_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "http_connection_pool.h"
+#include "media_io.h"
+
+/**
+ * Reads an http(s) url with range requests sent on connections of the
+ * HttpConnectionPool, so that tracks from the same host, reconnects and
+ * seeks do not pay the connection setup again.
+ *
+ * A connection is held while a response is read and returned to the pool
+ * once it is read to its end. Only plain GET requests are handled: proxies,
+ * authentication and responses without a length are left to ffmpeg.
+ */
+class HttpIO : public MediaIO {
+ public:
+  /**
+   * @param interrupt_cb checked by blocking calls, can be null.
+   * @param request_bytes bytes asked per request, 0 for up to the end. Seeks
+   * out of a bounded request do not close its connection.
+   * @param options options of the ffmpeg http protocol, can be null.
+   * "user_agent", "referer" and "headers" are sent with the requests, the
+   * other http options are left to ffmpeg.
+   * @return 0, AVERROR(ENOSYS) if |url| needs what is not handled here, or
+   * another negative AVERROR code.
+   */
+  static int Open(const char* url,
+                  const AVIOInterruptCB* interrupt_cb,
+                  int64_t request_bytes,
+                  const AVDictionary* options,
+                  std::unique_ptr<HttpIO>* io);
+
+  ~HttpIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+  bool IsSeekable() const { return seekable_; }
+
+ private:
+  struct Response {
+    int status = 0;
+    int64_t content_length = -1;
+    // of Content-Range.
+    int64_t range_start = -1;
+    int64_t total_size = -1;
+    bool keep_alive = true;
+    bool chunked = false;
+    std::string location;
+  };
+
+  std::string scheme_;
+  std::string host_;
+  int port_ = -1;
+  std::string path_;
+  std::string user_agent_;
+  // extra header lines, each ended by CRLF.
+  std::string headers_;
+  AVIOInterruptCB parent_interrupt_cb_{nullptr, nullptr};
+  int64_t request_bytes_;
+  std::atomic<bool> abort_{false};
+
+  std::unique_ptr<HttpConnection> connection_;
+  int64_t size_ = -1;
+  bool seekable_ = false;
+  int64_t position_ = 0;
+  // bytes of the current response left to read.
+  int64_t remaining_ = 0;
+  bool keep_alive_ = false;
+
+  // statistic.
+  int requests_ = 0;
+  int reused_requests_ = 0;
+  int64_t first_byte_time_ = 0;
+
+  HttpIO(const AVIOInterruptCB* interrupt_cb, int64_t request_bytes);
+
+  static int InterruptCallback(void* opaque);
+
+  // split |url| into the members above.
+  int SetUrl(const std::string& url);
+
+  // @return AVERROR(ENOSYS) if an option is not handled here.
+  int SetOptions(const AVDictionary* options);
+
+  // send a request for |position| on, following redirects.
+  int Request(int64_t position);
+
+  int SendRequest(int64_t position, Response* response);
+
+  // read the rest of the current response, keeping its connection.
+  int Skip(int64_t bytes);
+
+  void ReleaseConnection(bool reusable);
+};
+
+/**
+ * Open |url| on a pooled connection with HttpIO when the pool is enabled and
+ * handles it, through the ffmpeg protocols otherwise.
+ *
+ * @param request_bytes see HttpIO::Open().
+ * @param options options of the ffmpeg http protocol, such as headers or
+ * timeout, can be null.
+ * @param seekable set to whether the source can seek, can be null.
+ * @return null if |url| can not be opened.
+ */
+std::unique_ptr<MediaIO> http_io_open(const char* url,
+                                      const AVIOInterruptCB* interrupt_cb,
+                                      int64_t request_bytes,
+                                      const AVDictionary* options,
+                                      bool* seekable);
+
+/**
+ * @return true if |key| is an option of the ffmpeg http protocol, consumed
+ * by the io layers rather than by the demuxer.
+ */
+bool http_io_is_protocol_option(const char* key);
+
+#endif  // FFPLAYER_HTTP_IO_H
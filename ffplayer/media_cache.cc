@@ -0,0 +1,354 @@
+//
+// Created by boyan on 2021/3/8.
+//
+
+#include "media_cache.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+extern "C" {
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+}
+
+#define MANIFEST_NAME "manifest"
+#define MANIFEST_VERSION 1
+
+/* ranges are saved to the manifest every this many bytes written */
+#define SAVE_INTERVAL_BYTES (4 * 1024 * 1024)
+
+const int64_t MediaCache::kDefaultMaxBytes;
+
+static std::string cache_key(const std::string& url) {
+  // 64 bit FNV-1a.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto c : url) {
+    hash ^= (uint8_t)c;
+    hash *= 0x100000001b3ULL;
+  }
+  char key[17];
+  snprintf(key, sizeof(key), "%016" PRIx64, hash);
+  return key;
+}
+
+CacheEntry::CacheEntry(MediaCache* cache, std::string key, std::string path)
+    : cache_(cache), key_(std::move(key)), path_(std::move(path)) {}
+
+CacheEntry::~CacheEntry() {
+  if (file_.is_open()) {
+    file_.close();
+  }
+  cache_->OnEntryUpdated(this);
+}
+
+int64_t CacheEntry::GetContentSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return content_size_;
+}
+
+void CacheEntry::SetContentSize(int64_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (content_size_ >= 0 && content_size_ != size) {
+    av_log(nullptr, AV_LOG_INFO,
+           "cache %s: size changed from %" PRId64 " to %" PRId64
+           ", dropping cached data.\n",
+           key_.c_str(), content_size_, size);
+    Clear();
+  }
+  content_size_ = size;
+}
+
+bool CacheEntry::IsComplete() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return content_size_ > 0 && cached_bytes_ >= content_size_;
+}
+
+int64_t CacheEntry::GetCachedForwards(int64_t position) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = ranges_.upper_bound(position);
+  if (it == ranges_.begin()) {
+    return 0;
+  }
+  --it;
+  return it->second > position ? it->second - position : 0;
+}
+
+int64_t CacheEntry::GetNextCachedStart(int64_t position) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = ranges_.upper_bound(position);
+  return it == ranges_.end() ? INT64_MAX : it->first;
+}
+
+int64_t CacheEntry::GetCachedBytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cached_bytes_;
+}
+
+bool CacheEntry::IsShared() const {
+  return self_.use_count() > 1;
+}
+
+int CacheEntry::Read(int64_t position, uint8_t* buf, int size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = ranges_.upper_bound(position);
+  if (it == ranges_.begin() || (--it)->second <= position) {
+    return 0;
+  }
+  auto bytes = (int)std::min((int64_t)size, it->second - position);
+  if (!OpenFile()) {
+    return AVERROR(EIO);
+  }
+  file_.clear();
+  file_.seekg(position);
+  file_.read(reinterpret_cast<char*>(buf), bytes);
+  if (file_.gcount() != bytes) {
+    // the file was changed behind our back, fetch everything again.
+    av_log(nullptr, AV_LOG_WARNING, "cache %s: file is corrupted.\n",
+           key_.c_str());
+    Clear();
+    return 0;
+  }
+  return bytes;
+}
+
+int CacheEntry::Write(int64_t position, const uint8_t* buf, int size) {
+  bool save;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!OpenFile()) {
+      return AVERROR(EIO);
+    }
+    file_.clear();
+    file_.seekp(position);
+    file_.write(reinterpret_cast<const char*>(buf), size);
+    if (!file_) {
+      return AVERROR(EIO);
+    }
+    AddRange(position, position + size);
+    unsaved_bytes_ += size;
+    save = unsaved_bytes_ >= SAVE_INTERVAL_BYTES;
+  }
+  if (save) {
+    cache_->OnEntryUpdated(this);
+  }
+  return size;
+}
+
+bool CacheEntry::OpenFile() {
+  if (file_.is_open()) {
+    return true;
+  }
+  auto mode = std::ios::in | std::ios::out | std::ios::binary;
+  file_.open(path_, mode);
+  if (!file_.is_open()) {
+    // does not exist yet.
+    file_.open(path_, mode | std::ios::trunc);
+  }
+  if (!file_.is_open()) {
+    av_log(nullptr, AV_LOG_ERROR, "cache: can not open %s.\n", path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void CacheEntry::AddRange(int64_t start, int64_t end) {
+  auto it = ranges_.upper_bound(start);
+  if (it != ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second >= start) {
+      start = prev->first;
+      end = std::max(end, prev->second);
+      cached_bytes_ -= prev->second - prev->first;
+      it = ranges_.erase(prev);
+    }
+  }
+  while (it != ranges_.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    cached_bytes_ -= it->second - it->first;
+    it = ranges_.erase(it);
+  }
+  ranges_[start] = end;
+  cached_bytes_ += end - start;
+}
+
+void CacheEntry::Clear() {
+  ranges_.clear();
+  cached_bytes_ = 0;
+  if (file_.is_open()) {
+    file_.close();
+  }
+  file_.open(path_, std::ios::in | std::ios::out | std::ios::binary |
+                        std::ios::trunc);
+}
+
+MediaCache* MediaCache::Get() {
+  // never destroyed, entries may outlive static destruction.
+  static auto* instance = new MediaCache();
+  return instance;
+}
+
+void MediaCache::SetDirectory(const std::string& directory,
+                              int64_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  directory_ = directory;
+  max_bytes_ = max_bytes > 0 ? max_bytes : kDefaultMaxBytes;
+  records_.clear();
+  if (directory_.empty()) {
+    return;
+  }
+  LoadManifest();
+  Evict();
+  SaveManifest();
+}
+
+bool MediaCache::IsEnabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !directory_.empty();
+}
+
+std::shared_ptr<CacheEntry> MediaCache::Open(const std::string& url) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (directory_.empty()) {
+    return nullptr;
+  }
+  auto key = cache_key(url);
+  auto& record = records_[key];
+  record.last_access = time(nullptr);
+  auto entry = record.entry.lock();
+  if (entry) {
+    return entry;
+  }
+  entry.reset(new CacheEntry(this, key, GetFilePath(key)));
+  entry->self_ = entry;
+  entry->content_size_ = record.content_size;
+  entry->ranges_ = record.ranges;
+  entry->cached_bytes_ = record.cached_bytes;
+  record.entry = entry;
+  return entry;
+}
+
+int64_t MediaCache::GetCachedBytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t bytes = 0;
+  for (auto& item : records_) {
+    bytes += item.second.cached_bytes;
+  }
+  return bytes;
+}
+
+void MediaCache::OnEntryUpdated(CacheEntry* entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(entry->key_);
+  if (it == records_.end()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> entry_lock(entry->mutex_);
+    if (entry->file_.is_open()) {
+      // ranges must not be saved before their data.
+      entry->file_.flush();
+    }
+    auto& record = it->second;
+    record.content_size = entry->content_size_;
+    record.ranges = entry->ranges_;
+    record.cached_bytes = entry->cached_bytes_;
+    record.last_access = time(nullptr);
+    entry->unsaved_bytes_ = 0;
+  }
+  Evict();
+  SaveManifest();
+}
+
+void MediaCache::LoadManifest() {
+  std::ifstream manifest(directory_ + "/" MANIFEST_NAME);
+  std::string magic;
+  int version = 0;
+  if (!(manifest >> magic >> version) || magic != "lychee-cache" ||
+      version != MANIFEST_VERSION) {
+    return;
+  }
+  std::string key;
+  EntryRecord record;
+  size_t range_count;
+  while (manifest >> key >> record.content_size >> record.last_access >>
+         range_count) {
+    record.ranges.clear();
+    record.cached_bytes = 0;
+    for (size_t i = 0; i < range_count; i++) {
+      int64_t start, end;
+      if (!(manifest >> start >> end)) {
+        return;
+      }
+      record.ranges[start] = end;
+      record.cached_bytes += end - start;
+    }
+    if (std::ifstream(GetFilePath(key)).good()) {
+      records_[key] = record;
+    }
+  }
+}
+
+void MediaCache::SaveManifest() {
+  auto path = directory_ + "/" MANIFEST_NAME;
+  auto temp_path = path + ".tmp";
+  {
+    std::ofstream manifest(temp_path, std::ios::trunc);
+    manifest << "lychee-cache " << MANIFEST_VERSION << "\n";
+    for (auto& item : records_) {
+      auto& record = item.second;
+      manifest << item.first << " " << record.content_size << " "
+               << record.last_access << " " << record.ranges.size();
+      for (auto& range : record.ranges) {
+        manifest << " " << range.first << " " << range.second;
+      }
+      manifest << "\n";
+    }
+    if (!manifest) {
+      av_log(nullptr, AV_LOG_ERROR, "cache: can not write %s.\n",
+             temp_path.c_str());
+      return;
+    }
+  }
+  // replace the old manifest at once, a crash keeps one of the two.
+  std::remove(path.c_str());
+  std::rename(temp_path.c_str(), path.c_str());
+}
+
+void MediaCache::Evict() {
+  int64_t total = 0;
+  std::vector<std::map<std::string, EntryRecord>::iterator> candidates;
+  for (auto it = records_.begin(); it != records_.end(); ++it) {
+    total += it->second.cached_bytes;
+    // entries in use can not be evicted. never lock() them here, the last
+    // reference would destroy the entry with |mutex_| held.
+    if (it->second.entry.expired()) {
+      candidates.push_back(it);
+    }
+  }
+  if (total <= max_bytes_) {
+    return;
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const std::map<std::string, EntryRecord>::iterator& a,
+               const std::map<std::string, EntryRecord>::iterator& b) {
+              return a->second.last_access < b->second.last_access;
+            });
+  for (auto& it : candidates) {
+    if (total <= max_bytes_) {
+      break;
+    }
+    av_log(nullptr, AV_LOG_DEBUG, "cache: evict %s, %" PRId64 " bytes.\n",
+           it->first.c_str(), it->second.cached_bytes);
+    total -= it->second.cached_bytes;
+    std::remove(GetFilePath(it->first).c_str());
+    records_.erase(it);
+  }
+}
+
+std::string MediaCache::GetFilePath(const std::string& key) const {
+  return directory_ + "/" + key + ".cache";
+}
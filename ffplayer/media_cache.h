@@ -0,0 +1,166 @@
+//
+// Created by boyan on 2021/3/8.
+//
+
+#ifndef FFPLAYER_MEDIA_CACHE_H
+#define FFPLAYER_MEDIA_CACHE_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class MediaCache;
+
+/**
+ * Cached bytes of one url: a sparse cache file and the map of the byte
+ * ranges written to it. Players opening the same url share the entry.
+ * Methods can be called from any thread.
+ */
+class CacheEntry {
+ public:
+  ~CacheEntry();
+
+  /** @return size of the content, negative if unknown. */
+  int64_t GetContentSize();
+
+  /**
+   * Record the size reported by the server. The cached ranges are dropped if
+   * it differs from the known size, the content changed.
+   */
+  void SetContentSize(int64_t size);
+
+  /** @return true if the whole content is cached. */
+  bool IsComplete();
+
+  /** @return bytes cached contiguously from |position|, 0 if none. */
+  int64_t GetCachedForwards(int64_t position);
+
+  /**
+   * @return start of the first cached range after |position|, INT64_MAX if
+   * there is none.
+   */
+  int64_t GetNextCachedStart(int64_t position);
+
+  /** @return total bytes cached. */
+  int64_t GetCachedBytes();
+
+  /**
+   * Read cached bytes at |position|.
+   *
+   * @return bytes read, 0 if |position| is not cached, or a negative AVERROR
+   * code.
+   */
+  int Read(int64_t position, uint8_t* buf, int size);
+
+  /**
+   * Write bytes fetched from the source at |position|.
+   */
+  int Write(int64_t position, const uint8_t* buf, int size);
+
+  /** @return true if another player is using the entry too. */
+  bool IsShared() const;
+
+ private:
+  friend class MediaCache;
+
+  MediaCache* cache_;
+  std::string key_;
+  std::string path_;
+
+  // guards everything below.
+  mutable std::mutex mutex_;
+  std::fstream file_;
+  int64_t content_size_ = -1;
+  // start -> end of the cached ranges, never overlapping or adjacent.
+  std::map<int64_t, int64_t> ranges_;
+  int64_t cached_bytes_ = 0;
+  // bytes written since the ranges were saved.
+  int64_t unsaved_bytes_ = 0;
+  std::weak_ptr<CacheEntry> self_;
+
+  CacheEntry(MediaCache* cache, std::string key, std::string path);
+
+  // must be called with |mutex_| held.
+  bool OpenFile();
+
+  // must be called with |mutex_| held.
+  void AddRange(int64_t start, int64_t end);
+
+  // must be called with |mutex_| held.
+  void Clear();
+};
+
+/**
+ * Process-wide disk cache of network streams.
+ *
+ * Each url is cached in its own sparse file. The cached ranges of every url
+ * are kept in a manifest file, so partial downloads resume in the next
+ * session. When the cache grows over its size limit, the least recently used
+ * urls which are not being played are evicted.
+ */
+class MediaCache {
+ public:
+  static const int64_t kDefaultMaxBytes = 512 * 1024 * 1024;
+
+  static MediaCache* Get();
+
+  /**
+   * Enable the cache. Must be called before players are created.
+   *
+   * @param directory existing directory the cache files are written to.
+   * @param max_bytes size limit of the cache, 0 for the default.
+   */
+  void SetDirectory(const std::string& directory, int64_t max_bytes);
+
+  bool IsEnabled();
+
+  /**
+   * @return entry of |url|, shared with other players of the same url. Null
+   * if the cache is not enabled.
+   */
+  std::shared_ptr<CacheEntry> Open(const std::string& url);
+
+  /**
+   * @return bytes cached for all urls, bytes cached by urls being played are
+   * counted every few MB.
+   */
+  int64_t GetCachedBytes();
+
+ private:
+  friend class CacheEntry;
+
+  struct EntryRecord {
+    int64_t content_size = -1;
+    std::map<int64_t, int64_t> ranges;
+    int64_t cached_bytes = 0;
+    // seconds since epoch.
+    int64_t last_access = 0;
+    std::weak_ptr<CacheEntry> entry;
+  };
+
+  std::mutex mutex_;
+  std::string directory_;
+  int64_t max_bytes_ = kDefaultMaxBytes;
+  std::map<std::string, EntryRecord> records_;
+
+  MediaCache() = default;
+
+  // called by entries when they have enough unsaved bytes or are closed.
+  void OnEntryUpdated(CacheEntry* entry);
+
+  // must be called with |mutex_| held.
+  void LoadManifest();
+
+  // must be called with |mutex_| held.
+  void SaveManifest();
+
+  // must be called with |mutex_| held.
+  void Evict();
+
+  std::string GetFilePath(const std::string& key) const;
+};
+
+#endif  // FFPLAYER_MEDIA_CACHE_H
@@ -8,7 +8,7 @@
 #include "logging.h"
 #include "media_clock.h"
 
-Clock::Clock(int* queue_serial)
+Clock::Clock(const std::atomic<int>* queue_serial)
     : queue_serial_(queue_serial),
       speed_(1.0),
       paused(0),
@@ -18,7 +18,7 @@ Clock::Clock(int* queue_serial)
   SetClock(NAN, -1);
 }
 
-Clock::Clock() : Clock(&serial) {}
+Clock::Clock() : Clock(nullptr) {}
 
 void Clock::SetClockAt(double pts, int _serial, double time) {
   pts_ = pts;
@@ -48,7 +48,8 @@ void Clock::Sync(Clock* secondary) {
 }
 
 double Clock::GetClock() {
-  if (*queue_serial_ != serial)
+  if (queue_serial_ &&
+      queue_serial_->load(std::memory_order_acquire) != serial)
     return NAN;
   if (paused) {
     return pts_;
@@ -94,8 +95,8 @@ double MediaClock::GetMasterClock() {
   }
 }
 
-MediaClock::MediaClock(int* audio_queue_serial,
-                       int* video_queue_serial,
+MediaClock::MediaClock(const std::atomic<int>* audio_queue_serial,
+                       const std::atomic<int>* video_queue_serial,
                        std::function<int(int)> sync_type_confirm)
     : sync_type_confirm_(std::move(sync_type_confirm)),
       audio_clock_(std::make_unique<Clock>(audio_queue_serial)),
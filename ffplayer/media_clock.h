@@ -5,6 +5,7 @@
 #ifndef BASE_MEDIA_CLOCK_H
 #define BASE_MEDIA_CLOCK_H
 
+#include <atomic>
 #include <functional>
 #include <memory>
 
@@ -30,8 +31,8 @@ struct Clock {
   double speed_ = 1.0;
 
   /* pointer to the current packet queue serial, used for obsolete clock
-   * detection */
-  int* queue_serial_;
+   * detection, null if the clock follows no queue */
+  const std::atomic<int>* queue_serial_;
 
   /* clock base */
   double pts_;
@@ -40,7 +41,7 @@ struct Clock {
   double pts_drift_;
 
  public:
-  explicit Clock(int* queue_serial);
+  explicit Clock(const std::atomic<int>* queue_serial);
 
   explicit Clock();
 
@@ -71,8 +72,8 @@ class MediaClock {
   std::function<int(int sync_type)> sync_type_confirm_;
 
  public:
-  MediaClock(int* audio_queue_serial,
-             int* video_queue_serial,
+  MediaClock(const std::atomic<int>* audio_queue_serial,
+             const std::atomic<int>* video_queue_serial,
              std::function<int(int)> sync_type_confirm);
 
   Clock* GetAudioClock();
@@ -0,0 +1,113 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#include "media_io.h"
+
+#include <cstring>
+
+#include "ffp_utils.h"
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+// same as the internal buffer of ffmpeg's own AVIOContext.
+#define AVIO_BUFFER_SIZE 32768
+
+std::unique_ptr<UrlIO> UrlIO::Open(const char* url,
+                                   const AVIOInterruptCB* interrupt_cb,
+                                   AVDictionary** options) {
+  std::unique_ptr<UrlIO> io(new UrlIO());
+  if (interrupt_cb) {
+    io->parent_interrupt_cb_ = *interrupt_cb;
+  }
+  AVIOInterruptCB cb = {InterruptCallback, io.get()};
+  auto ret = avio_open2(&io->avio_, url, AVIO_FLAG_READ, &cb, options);
+  if (ret < 0) {
+    av_log(nullptr, AV_LOG_ERROR, "UrlIO: can not open %s: %s.\n", url,
+           av_err_to_str(ret));
+    return nullptr;
+  }
+  return io;
+}
+
+UrlIO::~UrlIO() {
+  avio_closep(&avio_);
+}
+
+int UrlIO::InterruptCallback(void* opaque) {
+  auto* io = static_cast<UrlIO*>(opaque);
+  if (io->abort_) {
+    return 1;
+  }
+  auto& parent = io->parent_interrupt_cb_;
+  return parent.callback && parent.callback(parent.opaque);
+}
+
+int UrlIO::Read(uint8_t* buf, int size) {
+  if (abort_) {
+    return AVERROR_EXIT;
+  }
+  return avio_read(avio_, buf, size);
+}
+
+int64_t UrlIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  if (whence == AVSEEK_SIZE) {
+    return avio_size(avio_);
+  }
+  if (whence == SEEK_END) {
+    auto size = avio_size(avio_);
+    if (size < 0) {
+      return size;
+    }
+    offset += size;
+    whence = SEEK_SET;
+  }
+  return avio_seek(avio_, offset, whence);
+}
+
+void UrlIO::Abort() {
+  abort_ = true;
+}
+
+bool media_io_is_local_file(const char* url) {
+  auto* protocol = avio_find_protocol_name(url);
+  return protocol && !strcmp(protocol, "file");
+}
+
+AVIOContext* CreateAVIOContext(std::unique_ptr<MediaIO> io) {
+  auto* buffer = static_cast<uint8_t*>(av_malloc(AVIO_BUFFER_SIZE));
+  if (!buffer) {
+    return nullptr;
+  }
+  auto* avio_ctx = avio_alloc_context(
+      buffer, AVIO_BUFFER_SIZE, 0, io.get(),
+      [](void* opaque, uint8_t* buf, int size) -> int {
+        return static_cast<MediaIO*>(opaque)->Read(buf, size);
+      },
+      nullptr,
+      [](void* opaque, int64_t offset, int whence) -> int64_t {
+        return static_cast<MediaIO*>(opaque)->Seek(offset, whence);
+      });
+  if (!avio_ctx) {
+    av_free(buffer);
+    return nullptr;
+  }
+  io.release();
+  return avio_ctx;
+}
+
+MediaIO* GetMediaIO(AVIOContext* avio_ctx) {
+  return static_cast<MediaIO*>(avio_ctx->opaque);
+}
+
+void FreeAVIOContext(AVIOContext** avio_ctx) {
+  if (!*avio_ctx) {
+    return;
+  }
+  delete GetMediaIO(*avio_ctx);
+  av_freep(&(*avio_ctx)->buffer);
+  avio_context_free(avio_ctx);
+}
@@ -0,0 +1,100 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#ifndef FFPLAYER_MEDIA_IO_H
+#define FFPLAYER_MEDIA_IO_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+/**
+ * Byte source under the demuxer.
+ *
+ * Layers such as the read-ahead buffer wrap the MediaIO they read from, the
+ * outermost one is handed to the demuxer with CreateAVIOContext().
+ */
+class MediaIO {
+ public:
+  virtual ~MediaIO() = default;
+
+  /**
+   * @return bytes read, AVERROR_EOF at the end of the source, or a negative
+   * AVERROR code.
+   */
+  virtual int Read(uint8_t* buf, int size) = 0;
+
+  /**
+   * Same contract as the seek callback of AVIOContext: |whence| is SEEK_SET,
+   * SEEK_CUR, SEEK_END or AVSEEK_SIZE.
+   *
+   * @return the new position, the size for AVSEEK_SIZE, or a negative AVERROR
+   * code.
+   */
+  virtual int64_t Seek(int64_t offset, int whence) = 0;
+
+  /**
+   * Unblock pending and future reads, they fail with AVERROR_EXIT. Called
+   * from a thread other than the reading one.
+   */
+  virtual void Abort() = 0;
+};
+
+/**
+ * Reads an url through the ffmpeg protocols (file, http, ...).
+ */
+class UrlIO : public MediaIO {
+ public:
+  /**
+   * @param interrupt_cb checked by blocking protocol calls, can be null.
+   * @return null if the url can not be opened.
+   */
+  static std::unique_ptr<UrlIO> Open(const char* url,
+                                     const AVIOInterruptCB* interrupt_cb,
+                                     AVDictionary** options);
+
+  ~UrlIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+  /** @return true if the protocol can seek, such as http with ranges. */
+  bool IsSeekable() const { return avio_->seekable & AVIO_SEEKABLE_NORMAL; }
+
+ private:
+  AVIOContext* avio_ = nullptr;
+  AVIOInterruptCB parent_interrupt_cb_{nullptr, nullptr};
+  std::atomic_bool abort_{false};
+
+  UrlIO() = default;
+
+  static int InterruptCallback(void* opaque);
+};
+
+/**
+ * @return true if |url| is a file on the local file system.
+ */
+bool media_io_is_local_file(const char* url);
+
+/**
+ * Wrap |io| in an AVIOContext for the demuxer. The context owns |io| and must
+ * be freed with FreeAVIOContext().
+ */
+AVIOContext* CreateAVIOContext(std::unique_ptr<MediaIO> io);
+
+/**
+ * @return the MediaIO of a context created by CreateAVIOContext().
+ */
+MediaIO* GetMediaIO(AVIOContext* avio_ctx);
+
+void FreeAVIOContext(AVIOContext** avio_ctx);
+
+#endif  // FFPLAYER_MEDIA_IO_H
@@ -4,6 +4,7 @@
 
 #include "media_player.h"
 #include "logging.h"
+#include "prepared_source_pool.h"
 
 #ifndef _FLUTTER_MEDIA_ANDROID
 #define MEDIA_SDL_ENABLE
@@ -32,6 +33,12 @@ MediaPlayer::MediaPlayer(std::unique_ptr<VideoRenderBase> video_render,
         DoSomeWork();
         break;
       }
+      case MEDIA_MSG_TRIM_BUFFERS: {
+        if (data_source && !play_when_ready_) {
+          data_source->TrimBuffers(GetCurrentPosition());
+        }
+        break;
+      }
       default: {
         if (message_callback_external_) {
           message_callback_external_(what, arg1, arg2);
@@ -79,16 +86,110 @@ MediaPlayer::MediaPlayer(std::unique_ptr<VideoRenderBase> video_render,
 
   decoder_context = std::make_shared<DecoderContext>(
       audio_render_, video_render_, clock_context);
+
+  SetBufferingPolicy(std::make_shared<AdaptiveBufferingPolicy>());
+
+  memory_account_ = MemoryGovernor::Get()->Register();
+  for (auto& queue : {audio_pkt_queue, video_pkt_queue, subtitle_pkt_queue}) {
+    memory_account_->AddUsage([queue]() -> int64_t {
+      return queue->size + queue->GetRetainedBytes();
+    });
+  }
+  if (audio_render_) {
+    auto render = audio_render_;
+    memory_account_->AddUsage([render]() { return render->GetQueuedBytes(); });
+  }
+  if (video_render_) {
+    auto render = video_render_;
+    memory_account_->AddUsage([render]() { return render->GetQueuedBytes(); });
+  }
+  auto audio_queue = audio_pkt_queue;
+  auto video_queue = video_pkt_queue;
+  auto subtitle_queue = subtitle_pkt_queue;
+  memory_account_->SetReclaimCallback(
+      [audio_queue, video_queue, subtitle_queue]() {
+        return audio_queue->ReleaseBackBuffer() +
+               video_queue->ReleaseBackBuffer() +
+               subtitle_queue->ReleaseBackBuffer();
+      });
+  // called with the governor locked from another player's thread, the data
+  // source is trimmed on our message thread.
+  auto message_ctx = message_context;
+  memory_account_->SetTrimCallback(
+      [message_ctx]() { message_ctx->NotifyMsg(MEDIA_MSG_TRIM_BUFFERS); });
 }
 
 MediaPlayer::~MediaPlayer() {
   message_context->StopAndWait();
+  if (startup_duration_ >= 0) {
+    av_log(nullptr, AV_LOG_INFO,
+           "playback: startup %.1f ms, %d rebuffers for %.1f ms, %d seeks in "
+           "%.1f ms average.\n",
+           (double)startup_duration_ / 1000, rebuffer_count_,
+           (double)rebuffer_duration_ / 1000, seek_count_,
+           seek_count_ ? (double)seek_duration_ / 1000 / seek_count_ : 0.0);
+  }
+}
+
+void MediaPlayer::SetBufferingPolicy(std::shared_ptr<BufferingPolicy> policy) {
+  CHECK_VALUE(policy);
+  auto message_ctx = message_context;
+  policy->SetWatermarksListener(
+      [message_ctx](const BufferWatermarks& watermarks) {
+        message_ctx->NotifyMsg(FFP_MSG_BUFFERING_WATERMARK_UPDATE,
+                               watermarks.low_ms, watermarks.high_ms);
+      });
+  buffering_policy_ = std::move(policy);
+}
+
+int64_t MediaPlayer::GetMemoryUsage() const {
+  return memory_account_->GetUsage();
+}
+
+int64_t MediaPlayer::GetPropertyInt64(int property, int64_t default_value) {
+  switch (property) {
+    case FFP_PROP_INT64_VIDEO_CACHED_DURATION:
+      return video_pkt_queue->GetBufferLevel().duration_ms;
+    case FFP_PROP_INT64_AUDIO_CACHED_DURATION:
+      return audio_pkt_queue->GetBufferLevel().duration_ms;
+    case FFP_PROP_INT64_VIDEO_CACHED_BYTES:
+      return video_pkt_queue->GetBufferLevel().bytes;
+    case FFP_PROP_INT64_AUDIO_CACHED_BYTES:
+      return audio_pkt_queue->GetBufferLevel().bytes;
+    case FFP_PROP_INT64_VIDEO_CACHED_PACKETS:
+      return video_pkt_queue->GetBufferLevel().packets;
+    case FFP_PROP_INT64_AUDIO_CACHED_PACKETS:
+      return audio_pkt_queue->GetBufferLevel().packets;
+    case FFP_PROP_INT64_STARTUP_DURATION:
+      return startup_duration_ >= 0 ? startup_duration_ / 1000 : default_value;
+    case FFP_PROP_INT64_REBUFFER_COUNT:
+      return rebuffer_count_;
+    case FFP_PROP_INT64_REBUFFER_DURATION:
+      return rebuffer_duration_ / 1000;
+    case FFP_PROP_INT64_LATEST_SEEK_LOAD_DURATION:
+      return latest_seek_duration_ >= 0 ? latest_seek_duration_ / 1000
+                                        : default_value;
+    default:
+      break;
+  }
+  if (!data_source) {
+    return default_value;
+  }
+  return data_source->GetPropertyInt64(property, default_value);
+}
+
+void MediaPlayer::SetPropertyInt64(int property, int64_t value) {
+  if (data_source) {
+    data_source->SetPropertyInt64(property, value);
+  }
 }
 
 void MediaPlayer::SetPlayWhenReady(bool play_when_ready) {
   play_when_ready_ = play_when_ready;
+  memory_account_->SetPriority(play_when_ready ? MemoryPriority::PLAYING
+                                               : MemoryPriority::PAUSED);
   if (data_source) {
-    data_source->paused = !play_when_ready;
+    data_source->SetPaused(!play_when_ready);
   }
   if (!play_when_ready) {
     StopRenders();
@@ -124,20 +225,53 @@ void MediaPlayer::PauseClock(bool pause) {
 }
 
 int MediaPlayer::OpenDataSource(const char* filename) {
+  auto source = PreparedSourcePool::Get()->Take(
+      filename, start_configuration.video_disable || !video_render_);
+  if (source) {
+    return AttachDataSource(std::move(source));
+  }
+  return AttachDataSource(std::make_unique<DataSource>(filename, nullptr));
+}
+
+int MediaPlayer::OpenDataSource(std::shared_ptr<MemorySource> source) {
+  return AttachDataSource(
+      std::make_unique<DataSource>(std::move(source), nullptr));
+}
+
+int MediaPlayer::AttachDataSource(std::unique_ptr<DataSource> source) {
   if (data_source) {
     av_log(nullptr, AV_LOG_ERROR, "can not open file multi-times.\n");
     return -1;
   }
 
-  data_source = std::make_unique<DataSource>(filename, nullptr);
+  data_source = std::move(source);
+  open_time_ = av_gettime_relative();
   data_source->configuration = start_configuration;
+  if (!video_render_) {
+    // nothing would show the video, do not even demux it.
+    data_source->configuration.video_disable = true;
+  }
   data_source->audio_queue = audio_pkt_queue;
   data_source->video_queue = video_pkt_queue;
   data_source->subtitle_queue = subtitle_pkt_queue;
   data_source->ext_clock = clock_context->GetAudioClock();
   data_source->decoder_ctx = decoder_context;
   data_source->msg_ctx = message_context;
-  data_source->Open();
+  data_source->memory_account = memory_account_;
+  data_source->buffering_policy = buffering_policy_;
+  for (auto& queue : {audio_pkt_queue, video_pkt_queue, subtitle_pkt_queue}) {
+    queue->SetBackBuffer(start_configuration.back_buffer_duration_ms,
+                         start_configuration.back_buffer_max_bytes);
+  }
+  if (audio_render_) {
+    audio_render_->SetBufferLimits(start_configuration.audio_buffer_duration_ms,
+                                   start_configuration.audio_buffer_max_bytes);
+  }
+  if (data_source->IsPrepared()) {
+    data_source->OpenPrepared();
+  } else {
+    data_source->Open();
+  }
   ChangePlaybackState(MediaPlayerState::BUFFERING);
   SetPlayWhenReady(false);
   return 0;
@@ -251,6 +385,13 @@ double MediaPlayer::GetDuration() {
 
 void MediaPlayer::Seek(double position) {
   CHECK_VALUE(data_source);
+  auto now = av_gettime_relative();
+  if (rebuffer_start_) {
+    // the seek ends the rebuffering.
+    rebuffer_duration_ += now - rebuffer_start_;
+    rebuffer_start_ = 0;
+  }
+  seek_start_ = now;
   ChangePlaybackState(MediaPlayerState::BUFFERING);
   data_source->Seek(position);
 }
@@ -334,6 +475,11 @@ void MediaPlayer::DoSomeWork() {
   }
 
   if (player_state_ == MediaPlayerState::READY && !render_allow_playback) {
+    if (play_when_ready_ && !data_source->IsReadComplete()) {
+      buffering_policy_->OnRebuffer();
+      rebuffer_count_++;
+      rebuffer_start_ = av_gettime_relative();
+    }
     ChangePlaybackState(MediaPlayerState::BUFFERING);
   } else if (player_state_ == MediaPlayerState::BUFFERING &&
              ShouldTransitionToReadyState(render_allow_playback)) {
@@ -345,11 +491,33 @@ void MediaPlayer::ChangePlaybackState(MediaPlayerState state) {
   if (player_state_ == state) {
     return;
   }
+  if (state == MediaPlayerState::READY) {
+    UpdatePlaybackStatistic();
+  }
   player_state_ = state;
   message_context->NotifyMsg(MEDIA_MSG_PLAYER_STATE_CHANGED,
                              int(player_state_));
 }
 
+void MediaPlayer::UpdatePlaybackStatistic() {
+  auto now = av_gettime_relative();
+  if (startup_duration_ < 0) {
+    startup_duration_ = now - open_time_;
+    av_log(nullptr, AV_LOG_INFO, "playback: ready in %.1f ms.\n",
+           (double)startup_duration_ / 1000);
+  }
+  if (rebuffer_start_) {
+    rebuffer_duration_ += now - rebuffer_start_;
+    rebuffer_start_ = 0;
+  }
+  if (seek_start_) {
+    latest_seek_duration_ = now - seek_start_;
+    seek_duration_ += latest_seek_duration_;
+    seek_count_++;
+    seek_start_ = 0;
+  }
+}
+
 void MediaPlayer::StopRenders() {
   PauseClock(true);
   if (audio_render_) {
@@ -378,36 +546,46 @@ bool MediaPlayer::ShouldTransitionToReadyState(bool render_allow_play) {
     return true;
   }
 
+  // the source stopped reading at its memory share, nothing more to wait for.
+  if (memory_account_->GetUsage() >= memory_account_->GetShare()) {
+    return true;
+  }
+
   bool ready = true;
   if (audio_render_ && data_source->ContainAudioStream()) {
-    ready &= audio_pkt_queue->nb_packets > 2;
+    ready &= audio_render_->IsBufferedEnough() &&
+             buffering_policy_->IsReadyToPlay(
+                 audio_pkt_queue->GetBufferLevel());
   }
   if (video_render_ && data_source->ContainVideoStream() &&
       !data_source->VideoStreamIsAttachedPic()) {
-    ready &= video_pkt_queue->nb_packets > 2;
+    ready &=
+        buffering_policy_->IsReadyToPlay(video_pkt_queue->GetBufferLevel());
   }
   return ready;
 }
 
 static inline bool check_queue_is_ready(
+    BufferingPolicy* policy,
     const std::shared_ptr<PacketQueue>& queue,
     bool has_stream) {
-  static const int min_frames = 2;
-  return queue->nb_packets > min_frames || !has_stream || queue->abort_request;
+  return !has_stream || queue->abort_request ||
+         policy->IsReadyToPlay(queue->GetBufferLevel());
 }
 
 void MediaPlayer::CheckBuffering() {
   if (data_source->IsReadComplete()) {
     double duration = GetDuration();
-    if (duration <= 0 && audio_pkt_queue->last_pkt) {
-      auto d = audio_pkt_queue->last_pkt->pkt.pts +
-               audio_pkt_queue->last_pkt->pkt.duration;
-      duration = av_q2d(audio_pkt_queue->time_base) * d;
+    int64_t last_pts, last_duration;
+    if (duration <= 0 &&
+        audio_pkt_queue->GetLastPacketTimestamp(last_pts, last_duration)) {
+      duration = av_q2d(audio_pkt_queue->time_base) *
+                 (double)(last_pts + last_duration);
     }
-    if (duration <= 0 && video_pkt_queue->last_pkt) {
+    if (duration <= 0 &&
+        video_pkt_queue->GetLastPacketTimestamp(last_pts, last_duration)) {
       duration = av_q2d(video_pkt_queue->time_base) *
-                 (int64_t)(video_pkt_queue->last_pkt->pkt.pts +
-                           video_pkt_queue->last_pkt->pkt.duration);
+                 (double)(last_pts + last_duration);
     }
     buffered_position_ = duration;
     message_context->NotifyMsg(FFP_MSG_BUFFERING_TIME_UPDATE,
@@ -435,18 +613,22 @@ void MediaPlayer::CheckBuffering() {
 
   auto check_packet = [](const std::shared_ptr<PacketQueue>& queue,
                          int& nb_packets, double& cached_position) {
-    nb_packets = FFMIN(nb_packets, queue->nb_packets);
-    auto last_position = queue->last_pkt->pkt.pts * av_q2d(queue->time_base);
+    int64_t last_pts, last_duration;
+    if (!queue->GetLastPacketTimestamp(last_pts, last_duration)) {
+      return;
+    }
+    nb_packets = FFMIN(nb_packets, queue->nb_packets.load());
+    auto last_position = (double)last_pts * av_q2d(queue->time_base);
     cached_position = FFMIN(cached_position, last_position);
   };
 
   double cached_position = INT_MAX;
   int nb_packets = INT_MAX;
 
-  if (data_source->ContainAudioStream() && audio_pkt_queue->last_pkt) {
+  if (data_source->ContainAudioStream()) {
     check_packet(audio_pkt_queue, nb_packets, cached_position);
   }
-  if (data_source->ContainVideoStream() && video_pkt_queue->last_pkt) {
+  if (data_source->ContainVideoStream()) {
     check_packet(video_pkt_queue, nb_packets, cached_position);
   }
 
@@ -469,9 +651,9 @@ void MediaPlayer::CheckBuffering() {
   video_render_->DumpDebugInformation();
 #endif
 
-  if (check_queue_is_ready(video_pkt_queue,
+  if (check_queue_is_ready(buffering_policy_.get(), video_pkt_queue,
                            data_source->ContainVideoStream()) &&
-      check_queue_is_ready(audio_pkt_queue,
+      check_queue_is_ready(buffering_policy_.get(), audio_pkt_queue,
                            data_source->ContainAudioStream())) {
     ChangePlaybackState(MediaPlayerState::READY);
     if (play_when_ready_) {
@@ -8,10 +8,12 @@
 #include <functional>
 #include <memory>
 
+#include "buffering_policy.h"
 #include "data_source.h"
 #include "ffp_packet_queue.h"
 #include "ffplayer.h"
 #include "media_clock.h"
+#include "memory_governor.h"
 #include "render_audio_base.h"
 #include "render_video_base.h"
 
@@ -34,6 +36,10 @@ class MediaPlayer {
 
   std::shared_ptr<MessageContext> message_context;
 
+  std::shared_ptr<MemoryAccount> memory_account_;
+
+  std::shared_ptr<BufferingPolicy> buffering_policy_;
+
   MediaPlayerState player_state_ = MediaPlayerState::IDLE;
   std::mutex player_mutex_;
 
@@ -47,6 +53,21 @@ class MediaPlayer {
   // buffered position in seconds. -1 if not available
   double buffered_position_ = -1;
 
+  // playback statistic, times in microseconds.
+  int64_t open_time_ = 0;
+  // from open to the first READY, -1 until then.
+  int64_t startup_duration_ = -1;
+  int rebuffer_count_ = 0;
+  int64_t rebuffer_duration_ = 0;
+  // of the rebuffering in progress, 0 if none.
+  int64_t rebuffer_start_ = 0;
+  int seek_count_ = 0;
+  int64_t seek_duration_ = 0;
+  // from the last seek to READY, -1 if none.
+  int64_t latest_seek_duration_ = -1;
+  // of the seek in progress, 0 if none.
+  int64_t seek_start_ = 0;
+
  public:
   MediaPlayer(std::unique_ptr<VideoRenderBase> video_render,
               std::unique_ptr<BasicAudioRender> audio_render);
@@ -64,21 +85,56 @@ class MediaPlayer {
 
   void ChangePlaybackState(MediaPlayerState state);
 
+  // account the startup, rebuffering or seek that READY ends.
+  void UpdatePlaybackStatistic();
+
   void PauseClock(bool pause);
 
   bool ShouldTransitionToReadyState(bool render_allow_play);
 
   void CheckBuffering();
 
+  int AttachDataSource(std::unique_ptr<DataSource> source);
+
  public:
   PlayerConfiguration start_configuration{};
 
+  /**
+   * Replace the default AdaptiveBufferingPolicy, must be called before
+   * OpenDataSource().
+   */
+  void SetBufferingPolicy(std::shared_ptr<BufferingPolicy> policy);
+
   int OpenDataSource(const char* filename);
 
+  /**
+   * Play media held in memory, see MemorySource.
+   */
+  int OpenDataSource(std::shared_ptr<MemorySource> source);
+
   double GetCurrentPosition();
 
   bool IsPlayWhenReady() const { return play_when_ready_; }
 
+  /**
+   * @return bytes of packets and decoded frames held by this player.
+   */
+  int64_t GetMemoryUsage() const;
+
+  /**
+   * @param property one of FFP_PROP_INT64_*. FFP_PROP_INT64_STARTUP_DURATION,
+   * FFP_PROP_INT64_REBUFFER_DURATION and
+   * FFP_PROP_INT64_LATEST_SEEK_LOAD_DURATION are in milliseconds.
+   * @return value of the property, |default_value| if not available.
+   */
+  int64_t GetPropertyInt64(int property, int64_t default_value);
+
+  /**
+   * @param property one of FFP_PROP_INT64_*, such as
+   * FFP_PROP_INT64_IMMEDIATE_RECONNECT.
+   */
+  void SetPropertyInt64(int property, int64_t value);
+
   void SetPlayWhenReady(bool play_when_ready);
 
   int GetVolume();
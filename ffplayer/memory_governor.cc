@@ -0,0 +1,184 @@
+//
+// Created by boyan on 2021/3/6.
+//
+
+#include "memory_governor.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+// reclaiming walks all players, do it at most every 100 ms per player.
+#define RECLAIM_CHECK_INTERVAL_US 100000
+
+// an account is trimmed when over its share by more than this part of it, or
+// kMinReadBytes, so that one refilled up to its share is left alone.
+#define TRIM_SHARE_SLACK_DIVISOR 4
+
+static int priority_weight(MemoryPriority priority) {
+  switch (priority) {
+    case MemoryPriority::PLAYING:
+      return 4;
+    case MemoryPriority::PRELOAD:
+      return 2;
+    case MemoryPriority::PAUSED:
+    default:
+      return 1;
+  }
+}
+
+const int64_t MemoryAccount::kMinReadBytes;
+
+const int64_t MemoryGovernor::kDefaultBudget;
+
+MemoryAccount::MemoryAccount(MemoryGovernor* governor) : governor_(governor) {}
+
+MemoryAccount::~MemoryAccount() {
+  governor_->Unregister(this);
+}
+
+void MemoryAccount::AddUsage(std::function<int64_t()> usage) {
+  std::lock_guard<std::mutex> lock(governor_->mutex_);
+  usages_.push_back(std::move(usage));
+}
+
+void MemoryAccount::SetReclaimCallback(std::function<int64_t()> reclaim) {
+  std::lock_guard<std::mutex> lock(governor_->mutex_);
+  reclaim_ = std::move(reclaim);
+}
+
+void MemoryAccount::SetTrimCallback(std::function<void()> trim) {
+  std::lock_guard<std::mutex> lock(governor_->mutex_);
+  trim_ = std::move(trim);
+}
+
+void MemoryAccount::SetPriority(MemoryPriority priority) {
+  std::lock_guard<std::mutex> lock(governor_->mutex_);
+  if (priority_ == priority) {
+    return;
+  }
+  priority_ = priority;
+  governor_->UpdateShares();
+}
+
+int64_t MemoryAccount::GetUsage() const {
+  int64_t usage = 0;
+  for (const auto& source : usages_) {
+    usage += source();
+  }
+  return usage;
+}
+
+bool MemoryAccount::IsOverBudget(int64_t packet_bytes) {
+  auto now = av_gettime_relative();
+  if (now - last_reclaim_check_ > RECLAIM_CHECK_INTERVAL_US) {
+    last_reclaim_check_ = now;
+    governor_->Reclaim();
+  }
+  if (packet_bytes < kMinReadBytes) {
+    return false;
+  }
+  return GetUsage() >= share_;
+}
+
+MemoryGovernor* MemoryGovernor::Get() {
+  // never destroyed, accounts may outlive static destruction.
+  static auto* instance = new MemoryGovernor();
+  return instance;
+}
+
+std::shared_ptr<MemoryAccount> MemoryGovernor::Register() {
+  std::shared_ptr<MemoryAccount> account(new MemoryAccount(this));
+  std::lock_guard<std::mutex> lock(mutex_);
+  accounts_.push_back(account.get());
+  UpdateShares();
+  return account;
+}
+
+void MemoryGovernor::Unregister(MemoryAccount* account) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  accounts_.erase(std::remove(accounts_.begin(), accounts_.end(), account),
+                  accounts_.end());
+  UpdateShares();
+}
+
+void MemoryGovernor::SetBudget(int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = bytes;
+  UpdateShares();
+}
+
+int64_t MemoryGovernor::GetUsage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t usage = 0;
+  for (auto* account : accounts_) {
+    usage += account->GetUsage();
+  }
+  return usage;
+}
+
+void MemoryGovernor::Reclaim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t usage = 0;
+  for (auto* account : accounts_) {
+    usage += account->GetUsage();
+  }
+  if (usage <= budget_) {
+    return;
+  }
+  auto accounts = accounts_;
+  std::stable_sort(accounts.begin(), accounts.end(),
+                   [](MemoryAccount* a, MemoryAccount* b) {
+                     return a->priority_ < b->priority_;
+                   });
+  for (auto* account : accounts) {
+    if (usage <= budget_) {
+      break;
+    }
+    if (account->reclaim_) {
+      auto released = account->reclaim_();
+      usage -= released;
+      av_log(nullptr, AV_LOG_DEBUG,
+             "memory governor: over budget, released %" PRId64
+             " bytes from player %p.\n",
+             released, account);
+    }
+  }
+  for (auto* account : accounts) {
+    if (usage <= budget_ || account->priority_ == MemoryPriority::PLAYING) {
+      break;
+    }
+    if (!account->trim_) {
+      continue;
+    }
+    int64_t share = account->share_;
+    auto excess = account->GetUsage() - share;
+    if (excess <= FFMAX(share / TRIM_SHARE_SLACK_DIVISOR,
+                        MemoryAccount::kMinReadBytes)) {
+      continue;
+    }
+    // released asynchronously, count it as gone so that players of higher
+    // priority are left alone.
+    account->trim_();
+    usage -= excess;
+    av_log(nullptr, AV_LOG_INFO,
+           "memory governor: over budget, trimming %" PRId64
+           " bytes from player %p.\n",
+           excess, account);
+  }
+}
+
+void MemoryGovernor::UpdateShares() {
+  int total_weight = 0;
+  for (auto* account : accounts_) {
+    total_weight += priority_weight(account->priority_);
+  }
+  for (auto* account : accounts_) {
+    account->share_ =
+        budget_ * priority_weight(account->priority_) / total_weight;
+  }
+}
@@ -0,0 +1,131 @@
+//
+// Created by boyan on 2021/3/6.
+//
+
+#ifndef FFPLAYER_MEMORY_GOVERNOR_H
+#define FFPLAYER_MEMORY_GOVERNOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class MemoryPriority { PAUSED = 0, PRELOAD, PLAYING };
+
+class MemoryGovernor;
+
+/**
+ * Memory used by one player. Queues of the player register their usage here,
+ * the governor gives the account a share of the process-wide budget
+ * according to its priority.
+ */
+class MemoryAccount {
+ public:
+  // a player can always buffer this many packet bytes, so it keeps making
+  // progress even if its share is eaten by decoded frames.
+  static const int64_t kMinReadBytes = 1024 * 1024;
+
+  ~MemoryAccount();
+
+  /**
+   * Add a source of memory usage, such as a packet or frame queue. Sources
+   * must be added before the account is used by the read thread.
+   */
+  void AddUsage(std::function<int64_t()> usage);
+
+  /**
+   * Called by the governor to release memory which is not needed for
+   * playback, such as back buffers.
+   *
+   * @param reclaim returns the bytes released.
+   */
+  void SetReclaimCallback(std::function<int64_t()> reclaim);
+
+  /**
+   * Called by the governor when the account holds more than its share and
+   * releasing back buffers was not enough. The player drops its buffered
+   * packets and frames asynchronously, and reads again up to its share.
+   * Only accounts below MemoryPriority::PLAYING are trimmed.
+   */
+  void SetTrimCallback(std::function<void()> trim);
+
+  void SetPriority(MemoryPriority priority);
+
+  MemoryPriority GetPriority() const { return priority_; }
+
+  /** @return bytes currently used by the player. */
+  int64_t GetUsage() const;
+
+  /** @return bytes of the process-wide budget given to the player. */
+  int64_t GetShare() const { return share_; }
+
+  /**
+   * Check whether the player should stop reading packets. Asks the governor
+   * to reclaim memory from lower priority players when the whole process is
+   * over budget.
+   *
+   * @param packet_bytes bytes of packets waiting for the decoders.
+   */
+  bool IsOverBudget(int64_t packet_bytes);
+
+ private:
+  friend class MemoryGovernor;
+
+  MemoryGovernor* governor_;
+  std::vector<std::function<int64_t()>> usages_;
+  std::function<int64_t()> reclaim_;
+  std::function<void()> trim_;
+  std::atomic<MemoryPriority> priority_{MemoryPriority::PAUSED};
+  std::atomic<int64_t> share_{0};
+  std::atomic<int64_t> last_reclaim_check_{0};
+
+  explicit MemoryAccount(MemoryGovernor* governor);
+};
+
+/**
+ * Process-wide memory budget shared by all players.
+ *
+ * The budget is split by priority: a playing player weighs 4, a preloaded one
+ * 2 and a paused one 1. When the process goes over budget, memory is
+ * reclaimed from paused players first.
+ */
+class MemoryGovernor {
+ public:
+  static const int64_t kDefaultBudget = 64 * 1024 * 1024;
+
+  static MemoryGovernor* Get();
+
+  std::shared_ptr<MemoryAccount> Register();
+
+  void SetBudget(int64_t bytes);
+
+  int64_t GetBudget() const { return budget_; }
+
+  /** @return bytes used by all players. */
+  int64_t GetUsage();
+
+  /**
+   * Release reclaimable memory, lowest priority first, until the process is
+   * back under budget: back buffers first, then the buffers of players not
+   * playing which hold more than their share.
+   */
+  void Reclaim();
+
+ private:
+  friend class MemoryAccount;
+
+  std::mutex mutex_;
+  std::vector<MemoryAccount*> accounts_;
+  std::atomic<int64_t> budget_{kDefaultBudget};
+
+  MemoryGovernor() = default;
+
+  void Unregister(MemoryAccount* account);
+
+  // must be called with |mutex_| held.
+  void UpdateShares();
+};
+
+#endif  // FFPLAYER_MEMORY_GOVERNOR_H
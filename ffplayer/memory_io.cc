@@ -0,0 +1,151 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#include "memory_io.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/log.h"
+}
+
+std::shared_ptr<MemorySource> MemorySource::Create(const uint8_t* data,
+                                                   int64_t size,
+                                                   ReleaseCallback release) {
+  auto source = std::make_shared<MemorySource>();
+  source->Append(data, size, std::move(release));
+  source->Finish();
+  return source;
+}
+
+MemorySource::~MemorySource() {
+  for (auto& chunk : chunks_) {
+    if (chunk.release) {
+      chunk.release();
+    }
+  }
+}
+
+int MemorySource::Append(const uint8_t* data,
+                         int64_t size,
+                         ReleaseCallback release) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+      av_log(nullptr, AV_LOG_ERROR, "memory source: append after finish.\n");
+      return -1;
+    }
+    if (size > 0) {
+      chunks_.push_back(Chunk{data, size, size_, std::move(release)});
+      size_ += size;
+      release = nullptr;
+    }
+  }
+  // an empty chunk is not kept, release it at once.
+  if (release) {
+    release();
+  }
+  append_cond_.notify_all();
+  return 0;
+}
+
+void MemorySource::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  append_cond_.notify_all();
+}
+
+int MemorySource::Read(int64_t position,
+                       uint8_t* buf,
+                       int size,
+                       const std::function<bool()>& abort) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (position >= size_) {
+    if (finished_) {
+      return AVERROR_EOF;
+    }
+    if (abort()) {
+      return AVERROR_EXIT;
+    }
+    append_cond_.wait(lock);
+  }
+  // chunks are sorted by offset, find the last one starting at or before.
+  auto it = std::upper_bound(
+      chunks_.begin(), chunks_.end(), position,
+      [](int64_t pos, const Chunk& chunk) { return pos < chunk.offset; });
+  --it;
+  auto chunk_position = position - it->offset;
+  auto bytes = (int)std::min((int64_t)size, it->size - chunk_position);
+  memcpy(buf, it->data + chunk_position, bytes);
+  return bytes;
+}
+
+int64_t MemorySource::GetSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return finished_ ? size_ : -1;
+}
+
+void MemorySource::WakeUp() {
+  // lock so that a reader can not miss the wake up between its abort check
+  // and its wait.
+  std::lock_guard<std::mutex> lock(mutex_);
+  append_cond_.notify_all();
+}
+
+MemoryIO::MemoryIO(std::shared_ptr<MemorySource> source)
+    : source_(std::move(source)) {}
+
+MemoryIO::~MemoryIO() {
+  av_log(nullptr, AV_LOG_DEBUG,
+         "memory io: %" PRId64 " bytes copied for a source of %" PRId64
+         " bytes.\n",
+         bytes_read_, source_->GetSize());
+}
+
+int MemoryIO::Read(uint8_t* buf, int size) {
+  auto ret = source_->Read(position_, buf, size,
+                           [this]() -> bool { return abort_; });
+  if (ret > 0) {
+    position_ += ret;
+    bytes_read_ += ret;
+  }
+  return ret;
+}
+
+int64_t MemoryIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  auto size = source_->GetSize();
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return size >= 0 ? size : AVERROR(ENOSYS);
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      if (size < 0) {
+        return AVERROR(ENOSYS);
+      }
+      target = size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  position_ = target;
+  return target;
+}
+
+void MemoryIO::Abort() {
+  abort_ = true;
+  source_->WakeUp();
+}
@@ -0,0 +1,113 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#ifndef FFPLAYER_MEMORY_IO_H
+#define FFPLAYER_MEMORY_IO_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "media_io.h"
+
+/**
+ * Media bytes held by the caller, a single buffer or a stream of chunks
+ * appended while playing. The buffers are referenced, never copied, and are
+ * released once the source and every player reading it are gone.
+ *
+ * Methods can be called from any thread.
+ */
+class MemorySource {
+ public:
+  typedef std::function<void()> ReleaseCallback;
+
+  /**
+   * A source of the single buffer |data|, already finished.
+   */
+  static std::shared_ptr<MemorySource> Create(const uint8_t* data,
+                                              int64_t size,
+                                              ReleaseCallback release);
+
+  MemorySource() = default;
+
+  ~MemorySource();
+
+  /**
+   * Append a chunk to the stream.
+   *
+   * @param release called when |data| is not used anymore, can be null. It
+   * runs on the thread dropping the last reference to the source, or on the
+   * caller if |size| is 0.
+   * @return 0, or -1 if the source is already finished.
+   */
+  int Append(const uint8_t* data, int64_t size, ReleaseCallback release);
+
+  /** Mark the end of the stream, no chunk can be appended after it. */
+  void Finish();
+
+  /**
+   * Copy bytes at |position| to |buf|, waiting for them to be appended.
+   *
+   * @param abort checked while waiting.
+   * @return bytes read, AVERROR_EOF at the end, or AVERROR_EXIT if aborted.
+   */
+  int Read(int64_t position,
+           uint8_t* buf,
+           int size,
+           const std::function<bool()>& abort);
+
+  /** @return size of the stream, negative until it is finished. */
+  int64_t GetSize();
+
+  /** Wake up readers waiting for bytes, so they can check their abort. */
+  void WakeUp();
+
+ private:
+  struct Chunk {
+    const uint8_t* data;
+    int64_t size;
+    // position of the chunk in the stream.
+    int64_t offset;
+    ReleaseCallback release;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable append_cond_;
+  std::vector<Chunk> chunks_;
+  int64_t size_ = 0;
+  bool finished_ = false;
+};
+
+/**
+ * Reads a MemorySource, the only copy is from the caller's buffers into the
+ * buffer of the AVIOContext.
+ */
+class MemoryIO : public MediaIO {
+ public:
+  explicit MemoryIO(std::shared_ptr<MemorySource> source);
+
+  ~MemoryIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+  /** @return bytes copied out of the source so far. */
+  int64_t GetBytesRead() const { return bytes_read_; }
+
+ private:
+  std::shared_ptr<MemorySource> source_;
+  int64_t position_ = 0;
+  std::atomic_bool abort_{false};
+
+  // statistic.
+  int64_t bytes_read_ = 0;
+};
+
+#endif  // FFPLAYER_MEMORY_IO_H
@@ -0,0 +1,132 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#include "mmap_io.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+}
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* a seek further than this from the read position prefetches its target */
+#define MMAP_SEEK_PREFETCH_DISTANCE (512 * 1024)
+#define MMAP_SEEK_PREFETCH_SIZE (2 * 1024 * 1024)
+
+std::unique_ptr<MmapIO> MmapIO::Create(const char* url) {
+#ifdef _WIN32
+  return nullptr;
+#else
+  if (!media_io_is_local_file(url)) {
+    return nullptr;
+  }
+  const char* path = url;
+  av_strstart(url, "file:", &path);
+  auto fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (uint64_t)st.st_size > SIZE_MAX) {
+    close(fd);
+    return nullptr;
+  }
+  auto* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps the file referenced.
+  close(fd);
+  if (data == MAP_FAILED) {
+    av_log(nullptr, AV_LOG_INFO, "can not map %s: %s.\n", path,
+           strerror(errno));
+    return nullptr;
+  }
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  std::unique_ptr<MmapIO> io(new MmapIO());
+  io->data_ = static_cast<uint8_t*>(data);
+  io->size_ = st.st_size;
+  return io;
+#endif
+}
+
+MmapIO::~MmapIO() {
+#ifndef _WIN32
+  if (data_) {
+    munmap(data_, (size_t)size_);
+  }
+#endif
+  av_log(nullptr, AV_LOG_DEBUG,
+         "mmap io: read %" PRId64 " KB of %" PRId64 " KB, %d seeks.\n",
+         bytes_read_ / 1024, size_ / 1024, seek_count_);
+}
+
+int MmapIO::Read(uint8_t* buf, int size) {
+  if (abort_) {
+    return AVERROR_EXIT;
+  }
+  if (position_ >= size_) {
+    return AVERROR_EOF;
+  }
+  auto bytes = (int)FFMIN((int64_t)size, size_ - position_);
+  memcpy(buf, data_ + position_, bytes);
+  position_ += bytes;
+  bytes_read_ += bytes;
+  return bytes;
+}
+
+int64_t MmapIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return size_;
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      target = size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  if (FFABS(target - position_) > MMAP_SEEK_PREFETCH_DISTANCE) {
+    seek_count_++;
+    AdviseWillNeed(target);
+  }
+  position_ = target;
+  return target;
+}
+
+void MmapIO::Abort() {
+  abort_ = true;
+}
+
+void MmapIO::AdviseWillNeed(int64_t position) {
+#ifndef _WIN32
+  if (position >= size_) {
+    return;
+  }
+  static const int64_t page_size = sysconf(_SC_PAGESIZE);
+  auto start = position / page_size * page_size;
+  auto length = FFMIN(position + MMAP_SEEK_PREFETCH_SIZE, size_) - start;
+  madvise(data_ + start, (size_t)length, MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,55 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#ifndef FFPLAYER_MMAP_IO_H
+#define FFPLAYER_MMAP_IO_H
+
+#include <atomic>
+#include <memory>
+
+#include "media_io.h"
+
+/**
+ * Reads a local file through a read-only memory mapping, so reads cost a
+ * memcpy instead of a syscall and a copy from the page cache.
+ *
+ * The whole file is advised as sequential, seeks far from the read position
+ * prefetch the pages around their target. Not available on windows.
+ *
+ * A file truncated while mapped raises SIGBUS on the next read of the lost
+ * pages, and reads blocked in page faults can not be aborted, so it is only
+ * used when the player is configured to.
+ */
+class MmapIO : public MediaIO {
+ public:
+  /**
+   * @return null if |url| is not a regular local file or can not be mapped,
+   * for example a file larger than the address space.
+   */
+  static std::unique_ptr<MmapIO> Create(const char* url);
+
+  ~MmapIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+ private:
+  uint8_t* data_ = nullptr;
+  int64_t size_ = 0;
+  int64_t position_ = 0;
+  std::atomic_bool abort_{false};
+
+  // statistic.
+  int64_t bytes_read_ = 0;
+  int seek_count_ = 0;
+
+  MmapIO() = default;
+
+  void AdviseWillNeed(int64_t position);
+};
+
+#endif  // FFPLAYER_MMAP_IO_H
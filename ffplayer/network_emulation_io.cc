@@ -0,0 +1,296 @@
+//
+// Created by boyan on 2021/3/17.
+//
+
+#include "network_emulation_io.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/dict.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define URL_PREFIX "netem:"
+
+/* reads of a capped link return about this long of transfer at most, so that
+ * the pacing stays smooth */
+#define PACE_CHUNK_US 50000
+#define PACE_MIN_CHUNK_BYTES 512
+
+/* an idle link does not bank more than this much bandwidth for a burst */
+#define PACE_MAX_BURST_US 100000
+
+static bool load_preset(const char* name, NetworkProfile* profile) {
+  NetworkProfile preset;
+  if (!strcmp(name, "2g")) {
+    preset.bandwidth = 32000;
+    preset.latency_ms = 400;
+    preset.jitter_ms = 100;
+  } else if (!strcmp(name, "3g")) {
+    preset.bandwidth = 200000;
+    preset.latency_ms = 150;
+    preset.jitter_ms = 50;
+    preset.stall_interval_ms = 20000;
+    preset.stall_ms = 1500;
+  } else if (!strcmp(name, "4g")) {
+    preset.bandwidth = 1500000;
+    preset.latency_ms = 50;
+    preset.jitter_ms = 20;
+  } else if (!strcmp(name, "wifi")) {
+    preset.bandwidth = 4000000;
+    preset.latency_ms = 10;
+    preset.jitter_ms = 5;
+  } else if (!strcmp(name, "flaky")) {
+    preset.bandwidth = 500000;
+    preset.latency_ms = 100;
+    preset.jitter_ms = 80;
+    preset.stall_interval_ms = 10000;
+    preset.stall_ms = 3000;
+    preset.disconnect_interval_ms = 15000;
+  } else {
+    return false;
+  }
+  *profile = preset;
+  return true;
+}
+
+int NetworkProfile::Parse(const std::string& options, NetworkProfile* profile) {
+  AVDictionary* dict = nullptr;
+  auto ret = av_dict_parse_string(&dict, options.c_str(), "=", ",", 0);
+  if (ret < 0) {
+    av_log(nullptr, AV_LOG_ERROR, "netem: can not parse \"%s\".\n",
+           options.c_str());
+    av_dict_free(&dict);
+    return ret;
+  }
+  NetworkProfile result;
+  auto* preset = av_dict_get(dict, "profile", nullptr, 0);
+  if (preset && !load_preset(preset->value, &result)) {
+    av_log(nullptr, AV_LOG_ERROR, "netem: unknown profile %s.\n",
+           preset->value);
+    ret = AVERROR(EINVAL);
+  }
+  int64_t seed = result.seed;
+  struct {
+    const char* key;
+    int64_t* value;
+  } fields[] = {
+      {"bandwidth", &result.bandwidth},
+      {"latency_ms", &result.latency_ms},
+      {"jitter_ms", &result.jitter_ms},
+      {"stall_interval_ms", &result.stall_interval_ms},
+      {"stall_ms", &result.stall_ms},
+      {"disconnect_interval_ms", &result.disconnect_interval_ms},
+      {"seed", &seed},
+  };
+  AVDictionaryEntry* entry = nullptr;
+  while (ret >= 0 &&
+         (entry = av_dict_get(dict, "", entry, AV_DICT_IGNORE_SUFFIX))) {
+    if (!strcmp(entry->key, "profile")) {
+      continue;
+    }
+    int64_t* field = nullptr;
+    for (auto& item : fields) {
+      if (!strcmp(entry->key, item.key)) {
+        field = item.value;
+      }
+    }
+    char* end;
+    auto value = strtoll(entry->value, &end, 10);
+    if (!field || *end || end == entry->value || value < 0) {
+      av_log(nullptr, AV_LOG_ERROR, "netem: invalid option %s=%s.\n",
+             entry->key, entry->value);
+      ret = AVERROR(EINVAL);
+      break;
+    }
+    *field = value;
+  }
+  av_dict_free(&dict);
+  if (ret < 0) {
+    return ret;
+  }
+  result.seed = (uint32_t)seed;
+  *profile = result;
+  return 0;
+}
+
+NetworkEmulator::NetworkEmulator(const NetworkProfile& profile)
+    : profile_(profile) {
+  av_lfg_init(&lfg_, profile.seed);
+  stall_interval_bytes_ = profile.bandwidth * profile.stall_interval_ms / 1000;
+  if (profile.stall_ms <= 0) {
+    stall_interval_bytes_ = 0;
+  }
+  disconnect_interval_bytes_ =
+      profile.bandwidth * profile.disconnect_interval_ms / 1000;
+  next_stall_ = stall_interval_bytes_ > 0 ? stall_interval_bytes_ : INT64_MAX;
+  next_disconnect_ =
+      disconnect_interval_bytes_ > 0 ? disconnect_interval_bytes_ : INT64_MAX;
+}
+
+NetworkEmulator::~NetworkEmulator() {
+  av_log(nullptr, AV_LOG_INFO,
+         "netem: %" PRId64
+         " bytes in %d requests, %d stalls, %d disconnects.\n",
+         delivered_, requests_, stalls_, disconnects_);
+}
+
+int64_t NetworkEmulator::NextLatency() {
+  auto latency = profile_.latency_ms;
+  if (profile_.jitter_ms > 0) {
+    auto range = (uint32_t)(2 * profile_.jitter_ms + 1);
+    latency += (int64_t)(av_lfg_get(&lfg_) % range) - profile_.jitter_ms;
+  }
+  return FFMAX(latency, 0) * 1000;
+}
+
+std::unique_ptr<NetworkEmulationIO> NetworkEmulationIO::Create(
+    std::unique_ptr<MediaIO> source,
+    std::shared_ptr<NetworkEmulator> emulator) {
+  return std::unique_ptr<NetworkEmulationIO>(
+      new NetworkEmulationIO(std::move(source), std::move(emulator)));
+}
+
+NetworkEmulationIO::NetworkEmulationIO(
+    std::unique_ptr<MediaIO> source,
+    std::shared_ptr<NetworkEmulator> emulator)
+    : source_(std::move(source)), emulator_(std::move(emulator)) {}
+
+NetworkEmulationIO::~NetworkEmulationIO() = default;
+
+bool NetworkEmulationIO::Wait(int64_t delay_us) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (delay_us > 0) {
+    cond_.wait_for(lock, std::chrono::microseconds(delay_us),
+                   [this]() { return abort_; });
+  }
+  return !abort_;
+}
+
+bool NetworkEmulationIO::Pace(int bytes) {
+  auto bandwidth = emulator_->profile_.bandwidth;
+  if (bandwidth <= 0) {
+    return true;
+  }
+  auto now = av_gettime_relative();
+  if (now - pace_start_ - paced_bytes_ * 1000000 / bandwidth >
+      PACE_MAX_BURST_US) {
+    pace_start_ = now;
+    paced_bytes_ = 0;
+  }
+  paced_bytes_ += bytes;
+  return Wait(pace_start_ + paced_bytes_ * 1000000 / bandwidth - now);
+}
+
+int NetworkEmulationIO::Read(uint8_t* buf, int size) {
+  if (reset_) {
+    return AVERROR(ECONNRESET);
+  }
+  if (request_pending_) {
+    request_pending_ = false;
+    int64_t latency;
+    {
+      std::lock_guard<std::mutex> lock(emulator_->mutex_);
+      emulator_->requests_++;
+      latency = emulator_->NextLatency();
+    }
+    if (!Wait(latency)) {
+      return AVERROR_EXIT;
+    }
+    pace_start_ = av_gettime_relative();
+    paced_bytes_ = 0;
+  }
+  int64_t stall_us = 0;
+  {
+    std::lock_guard<std::mutex> lock(emulator_->mutex_);
+    auto& emulator = *emulator_;
+    if (emulator.delivered_ >= emulator.next_disconnect_) {
+      emulator.next_disconnect_ += emulator.disconnect_interval_bytes_;
+      emulator.disconnects_++;
+      reset_ = true;
+      av_log(nullptr, AV_LOG_INFO, "netem: connection reset at %" PRId64 ".\n",
+             position_);
+      return AVERROR(ECONNRESET);
+    }
+    if (emulator.delivered_ >= emulator.next_stall_) {
+      emulator.next_stall_ += emulator.stall_interval_bytes_;
+      emulator.stalls_++;
+      stall_us = emulator.profile_.stall_ms * 1000;
+    }
+    // stop at the next event, so that it hits the same byte on every run.
+    auto next_event = FFMIN(emulator.next_stall_, emulator.next_disconnect_);
+    size = (int)FFMIN((int64_t)size, next_event - emulator.delivered_);
+  }
+  if (stall_us) {
+    if (!Wait(stall_us)) {
+      return AVERROR_EXIT;
+    }
+    pace_start_ = av_gettime_relative();
+    paced_bytes_ = 0;
+  }
+  auto bandwidth = emulator_->profile_.bandwidth;
+  if (bandwidth > 0) {
+    auto chunk = FFMAX(bandwidth * PACE_CHUNK_US / 1000000,
+                       (int64_t)PACE_MIN_CHUNK_BYTES);
+    size = (int)FFMIN((int64_t)size, chunk);
+  }
+  auto ret = source_->Read(buf, size);
+  if (ret <= 0) {
+    return ret;
+  }
+  position_ += ret;
+  {
+    std::lock_guard<std::mutex> lock(emulator_->mutex_);
+    emulator_->delivered_ += ret;
+  }
+  if (!Pace(ret)) {
+    return AVERROR_EXIT;
+  }
+  return ret;
+}
+
+int64_t NetworkEmulationIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  if (whence == AVSEEK_SIZE) {
+    return source_->Seek(offset, whence);
+  }
+  if (reset_) {
+    return AVERROR(ECONNRESET);
+  }
+  auto ret = source_->Seek(offset, whence);
+  if (ret >= 0 && ret != position_) {
+    // a new range request.
+    position_ = ret;
+    request_pending_ = true;
+  }
+  return ret;
+}
+
+void NetworkEmulationIO::Abort() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abort_ = true;
+  }
+  cond_.notify_all();
+  source_->Abort();
+}
+
+const char* network_emulation_strip_url(const char* url,
+                                        std::string* options) {
+  if (strncmp(url, URL_PREFIX, strlen(URL_PREFIX)) != 0) {
+    return nullptr;
+  }
+  auto* separator = strchr(url, '|');
+  if (!separator) {
+    return nullptr;
+  }
+  options->assign(url + strlen(URL_PREFIX), separator);
+  return separator + 1;
+}
@@ -0,0 +1,146 @@
+//
+// Created by boyan on 2021/3/17.
+//
+
+#ifndef FFPLAYER_NETWORK_EMULATION_IO_H
+#define FFPLAYER_NETWORK_EMULATION_IO_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "media_io.h"
+
+extern "C" {
+#include "libavutil/lfg.h"
+}
+
+/**
+ * Conditions of an emulated network link.
+ *
+ * Stalls and disconnects are placed by bytes delivered, at the capped
+ * bandwidth, so they hit the same bytes of the file on every run whatever
+ * the machine. They are ignored if the bandwidth is not capped.
+ */
+struct NetworkProfile {
+  // bytes per second, 0 for unlimited.
+  int64_t bandwidth = 0;
+  // before the first byte of every request: the open and each seek.
+  int64_t latency_ms = 0;
+  // the latency varies by up to this much either way.
+  int64_t jitter_ms = 0;
+  // the link stalls for |stall_ms| after every this long of transfer.
+  int64_t stall_interval_ms = 0;
+  int64_t stall_ms = 0;
+  // the connection is reset after every this long of transfer.
+  int64_t disconnect_interval_ms = 0;
+  // of the jitter.
+  uint32_t seed = 0;
+
+  /**
+   * Parse "key=value" pairs separated by ",", such as
+   * "profile=3g,latency_ms=300,seed=7". "profile" loads one of the presets
+   * 2g, 3g, 4g, wifi and flaky, the other keys override it.
+   *
+   * @return 0 on success, a negative AVERROR code on error.
+   */
+  static int Parse(const std::string& options, NetworkProfile* profile);
+};
+
+/**
+ * State of an emulated link, shared by the connections opened on it, so that
+ * stalls, disconnects and the jitter sequence carry on across reconnects.
+ */
+class NetworkEmulator {
+ public:
+  explicit NetworkEmulator(const NetworkProfile& profile);
+
+  ~NetworkEmulator();
+
+  const NetworkProfile& GetProfile() const { return profile_; }
+
+ private:
+  friend class NetworkEmulationIO;
+
+  NetworkProfile profile_;
+  int64_t stall_interval_bytes_;
+  int64_t disconnect_interval_bytes_;
+
+  std::mutex mutex_;
+  AVLFG lfg_;
+  // bytes delivered by all the connections.
+  int64_t delivered_ = 0;
+  int64_t next_stall_;
+  int64_t next_disconnect_;
+
+  // statistic.
+  int requests_ = 0;
+  int stalls_ = 0;
+  int disconnects_ = 0;
+
+  // @return latency of the next request in microseconds.
+  int64_t NextLatency();
+};
+
+/**
+ * Reads a source as if it came over the network link of |emulator|: the
+ * reads are paced to the bandwidth on the real clock, every request waits
+ * for the latency, the link stalls and drops the connection as the profile
+ * says. A dropped connection fails with AVERROR(ECONNRESET), to be reopened
+ * by ReconnectIO like a real one.
+ *
+ * Makes buffering changes measurable on a local file, with no live service
+ * involved.
+ */
+class NetworkEmulationIO : public MediaIO {
+ public:
+  static std::unique_ptr<NetworkEmulationIO> Create(
+      std::unique_ptr<MediaIO> source,
+      std::shared_ptr<NetworkEmulator> emulator);
+
+  ~NetworkEmulationIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+ private:
+  std::unique_ptr<MediaIO> source_;
+  std::shared_ptr<NetworkEmulator> emulator_;
+  int64_t position_ = 0;
+  // the next read starts a request and waits for the latency.
+  bool request_pending_ = true;
+  // the connection was reset, reads fail until it is reopened.
+  bool reset_ = false;
+
+  // pacing of the bandwidth.
+  int64_t pace_start_ = 0;
+  int64_t paced_bytes_ = 0;
+
+  std::mutex mutex_;
+  // signaled on abort.
+  std::condition_variable cond_;
+  bool abort_ = false;
+
+  NetworkEmulationIO(std::unique_ptr<MediaIO> source,
+                     std::shared_ptr<NetworkEmulator> emulator);
+
+  // @return false if aborted while waiting.
+  bool Wait(int64_t delay_us);
+
+  // wait until |bytes| more are due at the capped bandwidth.
+  bool Pace(int bytes);
+};
+
+/**
+ * Split an url of the form "netem:<options>|<url>".
+ *
+ * @param options set to the NetworkProfile options of the url.
+ * @return the url to read, null if |url| has no emulation prefix.
+ */
+const char* network_emulation_strip_url(const char* url, std::string* options);
+
+#endif  // FFPLAYER_NETWORK_EMULATION_IO_H
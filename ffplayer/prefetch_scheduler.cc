@@ -0,0 +1,254 @@
+//
+// Created by boyan on 2021/3/15.
+//
+
+#include "prefetch_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <thread>
+
+#include "ffp_utils.h"
+#include "http_io.h"
+#include "media_cache.h"
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define FETCH_CHUNK_SIZE (64 * 1024)
+
+/* the bandwidth budget bursts up to a second worth of bytes */
+#define BUDGET_BURST_US 1000000
+
+const int PrefetchScheduler::kDefaultMaxConcurrent;
+const int64_t PrefetchScheduler::kDefaultMaxBytesPerSecond;
+const int64_t PrefetchScheduler::kDefaultBytesPerUrl;
+
+PrefetchScheduler* PrefetchScheduler::Get() {
+  static auto* instance = new PrefetchScheduler();
+  return instance;
+}
+
+void PrefetchScheduler::Configure(int max_concurrent,
+                                  int64_t max_bytes_per_second,
+                                  int64_t bytes_per_url) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_concurrent_ = FFMAX(max_concurrent, 0);
+  max_bytes_per_second_ = FFMAX(max_bytes_per_second, 0);
+  bytes_per_url_ = FFMAX(bytes_per_url, 0);
+  StartWorkers();
+  cond_.notify_all();
+}
+
+void PrefetchScheduler::SetQueue(const std::vector<PrefetchRequest>& requests) {
+  if (!requests.empty() && !MediaCache::Get()->IsEnabled()) {
+    av_log(nullptr, AV_LOG_WARNING,
+           "prefetch: the cache is disabled, nothing is prefetched.\n");
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::shared_ptr<Job>> jobs;
+  for (auto& request : requests) {
+    auto it = std::find_if(jobs_.begin(), jobs_.end(),
+                           [&](const std::shared_ptr<Job>& job) {
+                             return job->url == request.url;
+                           });
+    std::shared_ptr<Job> job;
+    if (it != jobs_.end()) {
+      job = *it;
+    } else {
+      job = std::make_shared<Job>();
+      job->url = request.url;
+    }
+    job->priority = request.priority;
+    jobs.push_back(std::move(job));
+  }
+  for (auto& job : jobs_) {
+    if (std::find(jobs.begin(), jobs.end(), job) == jobs.end()) {
+      job->cancelled = true;
+      wasted_bytes_ += job->bytes;
+    }
+  }
+  jobs_ = std::move(jobs);
+  StartWorkers();
+  cond_.notify_all();
+}
+
+void PrefetchScheduler::OnSourceOpened(const std::string& url) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      jobs_.begin(), jobs_.end(),
+      [&](const std::shared_ptr<Job>& job) { return job->url == url; });
+  if (it == jobs_.end()) {
+    return;
+  }
+  auto& job = *it;
+  // the source fetches the rest itself.
+  job->cancelled = true;
+  if (job->bytes) {
+    saved_time_ += job->fetch_time;
+    av_log(nullptr, AV_LOG_INFO,
+           "prefetch: %s played, %" PRId64 " bytes prefetched, %.1f ms "
+           "saved. %" PRId64 " bytes prefetched, %" PRId64 " wasted in all.\n",
+           url.c_str(), job->bytes, (double)job->fetch_time / 1000,
+           prefetched_bytes_, wasted_bytes_);
+  }
+  jobs_.erase(it);
+  cond_.notify_all();
+}
+
+void PrefetchScheduler::SetSourceStarving(const void* source, bool starving) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (starving) {
+    starving_sources_.insert(source);
+  } else {
+    starving_sources_.erase(source);
+    cond_.notify_all();
+  }
+}
+
+int64_t PrefetchScheduler::GetPrefetchedBytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return prefetched_bytes_;
+}
+
+int64_t PrefetchScheduler::GetWastedBytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return wasted_bytes_;
+}
+
+int64_t PrefetchScheduler::GetSavedTimeUs() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return saved_time_;
+}
+
+void PrefetchScheduler::StartWorkers() {
+  while (workers_ < max_concurrent_ && workers_ < (int)jobs_.size()) {
+    workers_++;
+    std::thread(&PrefetchScheduler::WorkerThread, this).detach();
+  }
+}
+
+void PrefetchScheduler::WorkerThread() {
+  update_thread_name("prefetch");
+  std::unique_lock<std::mutex> lock(mutex_);
+  // idle workers leave, the next queue starts them again.
+  while (workers_ <= max_concurrent_) {
+    auto job = PickJob();
+    if (!job) {
+      break;
+    }
+    job->running = true;
+    lock.unlock();
+    Fetch(job);
+    lock.lock();
+    job->running = false;
+    job->done = true;
+  }
+  workers_--;
+}
+
+std::shared_ptr<PrefetchScheduler::Job> PrefetchScheduler::PickJob() {
+  std::shared_ptr<Job> picked;
+  for (auto& job : jobs_) {
+    if (job->running || job->done || job->cancelled) {
+      continue;
+    }
+    if (!picked || job->priority > picked->priority) {
+      picked = job;
+    }
+  }
+  return picked;
+}
+
+bool PrefetchScheduler::WaitToFetch(Job* job, int bytes) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (job->cancelled || workers_ > max_concurrent_) {
+      return false;
+    }
+    if (!starving_sources_.empty()) {
+      // until the sources played recover.
+      cond_.wait(lock);
+      continue;
+    }
+    if (!max_bytes_per_second_) {
+      return true;
+    }
+    auto now = av_gettime_relative();
+    auto elapsed = FFMIN(now - budget_time_, BUDGET_BURST_US);
+    budget_bytes_ = FFMIN(
+        budget_bytes_ + elapsed * max_bytes_per_second_ / 1000000,
+        max_bytes_per_second_ * BUDGET_BURST_US / 1000000);
+    budget_time_ = now;
+    if (budget_bytes_ >= bytes) {
+      budget_bytes_ -= bytes;
+      return true;
+    }
+    auto wait_us = (bytes - budget_bytes_) * 1000000 / max_bytes_per_second_;
+    cond_.wait_for(lock, std::chrono::microseconds(wait_us));
+  }
+}
+
+void PrefetchScheduler::Fetch(const std::shared_ptr<Job>& job) {
+  int64_t bytes_per_url;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_per_url = bytes_per_url_;
+  }
+  auto entry = MediaCache::Get()->Open(job->url);
+  if (!entry || entry->IsComplete()) {
+    return;
+  }
+  auto position = entry->GetCachedForwards(0);
+  if (bytes_per_url && position >= bytes_per_url) {
+    return;
+  }
+  AVIOInterruptCB interrupt_cb = {
+      [](void* opaque) -> int {
+        return static_cast<Job*>(opaque)->cancelled;
+      },
+      job.get()};
+  bool seekable = false;
+  auto io =
+      http_io_open(job->url.c_str(), &interrupt_cb, bytes_per_url, nullptr,
+                   &seekable);
+  if (!io) {
+    return;
+  }
+  auto size = io->Seek(0, AVSEEK_SIZE);
+  if (size <= 0) {
+    // live streams are not cached.
+    return;
+  }
+  entry->SetContentSize(size);
+  auto target = bytes_per_url ? FFMIN(size, bytes_per_url) : size;
+  if (position > 0 && (!seekable || io->Seek(position, SEEK_SET) < 0)) {
+    position = 0;
+  }
+  std::vector<uint8_t> buffer(FETCH_CHUNK_SIZE);
+  while (position < target) {
+    auto chunk = (int)FFMIN(FETCH_CHUNK_SIZE, target - position);
+    if (!WaitToFetch(job.get(), chunk)) {
+      break;
+    }
+    auto fetch_start = av_gettime_relative();
+    auto ret = io->Read(buffer.data(), chunk);
+    if (ret <= 0 || entry->Write(position, buffer.data(), ret) < 0) {
+      break;
+    }
+    position += ret;
+    std::lock_guard<std::mutex> lock(mutex_);
+    job->bytes += ret;
+    job->fetch_time += av_gettime_relative() - fetch_start;
+    prefetched_bytes_ += ret;
+  }
+  av_log(nullptr, AV_LOG_DEBUG,
+         "prefetch: %s, %" PRId64 " bytes in %.1f ms%s.\n", job->url.c_str(),
+         job->bytes, (double)job->fetch_time / 1000,
+         job->cancelled ? ", cancelled" : "");
+}
@@ -0,0 +1,124 @@
+//
+// Created by boyan on 2021/3/15.
+//
+
+#ifndef FFPLAYER_PREFETCH_SCHEDULER_H
+#define FFPLAYER_PREFETCH_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+struct PrefetchRequest {
+  std::string url;
+  // higher is fetched first.
+  int priority = 0;
+};
+
+/**
+ * Downloads the start of the tracks queued to play next into the MediaCache,
+ * under a global bandwidth and concurrency budget.
+ *
+ * Prefetching yields whenever a network source being played runs low, its
+ * buffer below the level needed to play, and resumes once it recovered.
+ * Tracks are fetched by priority through the HttpConnectionPool, so the
+ * player opening them later reuses the connection too.
+ */
+class PrefetchScheduler {
+ public:
+  static const int kDefaultMaxConcurrent = 2;
+  static const int64_t kDefaultMaxBytesPerSecond = 2 * 1024 * 1024;
+  static const int64_t kDefaultBytesPerUrl = 4 * 1024 * 1024;
+
+  static PrefetchScheduler* Get();
+
+  /**
+   * @param max_concurrent urls fetched at once, 0 stops prefetching.
+   * @param max_bytes_per_second shared by all fetches, 0 for no limit.
+   * @param bytes_per_url bytes fetched from the start of each url, 0 for the
+   * whole file.
+   */
+  void Configure(int max_concurrent,
+                 int64_t max_bytes_per_second,
+                 int64_t bytes_per_url);
+
+  /**
+   * Replace the urls to prefetch. Urls no longer listed are cancelled, their
+   * prefetched bytes count as wasted unless they were played.
+   */
+  void SetQueue(const std::vector<PrefetchRequest>& requests);
+
+  /** Called by sources opening |url|, its prefetch is done or cancelled. */
+  void OnSourceOpened(const std::string& url);
+
+  /** Called by network sources when their buffer runs low or recovers. */
+  void SetSourceStarving(const void* source, bool starving);
+
+  /** @return bytes written to the cache by prefetching. */
+  int64_t GetPrefetchedBytes();
+
+  /** @return prefetched bytes of urls dropped from the queue unplayed. */
+  int64_t GetWastedBytes();
+
+  /**
+   * @return time spent fetching the bytes of urls which were then played,
+   * their sources did not wait for it.
+   */
+  int64_t GetSavedTimeUs();
+
+ private:
+  struct Job {
+    std::string url;
+    int priority = 0;
+    bool running = false;
+    bool done = false;
+    std::atomic<bool> cancelled{false};
+    int64_t bytes = 0;
+    int64_t fetch_time = 0;
+  };
+
+  std::mutex mutex_;
+  // signaled when jobs are queued, the budget refills or sources recover.
+  std::condition_variable cond_;
+  int max_concurrent_ = kDefaultMaxConcurrent;
+  int64_t max_bytes_per_second_ = kDefaultMaxBytesPerSecond;
+  int64_t bytes_per_url_ = kDefaultBytesPerUrl;
+  std::vector<std::shared_ptr<Job>> jobs_;
+  std::set<const void*> starving_sources_;
+  int workers_ = 0;
+
+  // token bucket of the bandwidth budget.
+  int64_t budget_bytes_ = 0;
+  int64_t budget_time_ = 0;
+
+  // statistic.
+  int64_t prefetched_bytes_ = 0;
+  int64_t wasted_bytes_ = 0;
+  int64_t saved_time_ = 0;
+
+  PrefetchScheduler() = default;
+
+  // must be called with |mutex_| held.
+  void StartWorkers();
+
+  void WorkerThread();
+
+  // must be called with |mutex_| held, null if nothing is pending.
+  std::shared_ptr<Job> PickJob();
+
+  void Fetch(const std::shared_ptr<Job>& job);
+
+  /**
+   * Wait until |bytes| fit in the budget and no source is starving.
+   *
+   * @return false if |job| was cancelled meanwhile.
+   */
+  bool WaitToFetch(Job* job, int bytes);
+};
+
+#endif  // FFPLAYER_PREFETCH_SCHEDULER_H
@@ -0,0 +1,104 @@
+//
+// Created by boyan on 2021/3/12.
+//
+
+#include "prepared_source_pool.h"
+
+#include "memory_governor.h"
+
+extern "C" {
+#include "libavutil/log.h"
+}
+
+const int PreparedSourcePool::kDefaultMaxSources;
+const int64_t PreparedSourcePool::kDefaultMaxBytes;
+const int64_t PreparedSourcePool::kDefaultBufferMs;
+
+PreparedSourcePool* PreparedSourcePool::Get() {
+  static auto* instance = new PreparedSourcePool();
+  return instance;
+}
+
+void PreparedSourcePool::Configure(int max_sources,
+                                   int64_t max_bytes,
+                                   int64_t buffer_ms) {
+  std::list<Entry> dropped;
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_sources_ = max_sources;
+  max_bytes_ = max_bytes;
+  buffer_ms_ = buffer_ms;
+  Trim(&dropped);
+}
+
+void PreparedSourcePool::Prepare(const std::string& url,
+                                 const PlayerConfiguration& configuration) {
+  std::list<Entry> dropped;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (max_sources_ <= 0) {
+    return;
+  }
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->url == url && it->video_disable == configuration.video_disable) {
+      entries_.splice(entries_.begin(), entries_, it);
+      return;
+    }
+  }
+
+  std::unique_ptr<DataSource> source(new DataSource(url.c_str(), nullptr));
+  source->configuration = configuration;
+  source->memory_account = MemoryGovernor::Get()->Register();
+  source->memory_account->SetPriority(MemoryPriority::PRELOAD);
+  // every source gets its part of the budget, so the sum never exceeds it.
+  if (source->Prepare(buffer_ms_, max_bytes_ / max_sources_) < 0) {
+    return;
+  }
+  entries_.push_front({url, (bool)configuration.video_disable,
+                       std::move(source)});
+  Trim(&dropped);
+}
+
+std::unique_ptr<DataSource> PreparedSourcePool::Take(const std::string& url,
+                                                     bool video_disable) {
+  std::unique_ptr<DataSource> source;
+  // destroyed without the lock, it may be blocked opening.
+  std::unique_ptr<DataSource> unready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->url == url && it->video_disable == video_disable) {
+        source = std::move(it->source);
+        entries_.erase(it);
+        break;
+      }
+    }
+    if (source && !source->IsPrepared()) {
+      // still opening or failed, starting over is not slower.
+      unready = std::move(source);
+      misses_++;
+    } else if (source) {
+      hits_++;
+    } else {
+      misses_++;
+    }
+    av_log(nullptr, AV_LOG_INFO,
+           "prepared source pool: %s for %s, %d of %d starts served.\n",
+           source ? "hit" : "miss", url.c_str(), hits_, hits_ + misses_);
+  }
+  return source;
+}
+
+int PreparedSourcePool::GetHitCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+int PreparedSourcePool::GetMissCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+void PreparedSourcePool::Trim(std::list<Entry>* dropped) {
+  while (!entries_.empty() && (int)entries_.size() > max_sources_) {
+    dropped->splice(dropped->begin(), entries_, std::prev(entries_.end()));
+  }
+}
@@ -0,0 +1,86 @@
+//
+// Created by boyan on 2021/3/12.
+//
+
+#ifndef FFPLAYER_PREPARED_SOURCE_POOL_H
+#define FFPLAYER_PREPARED_SOURCE_POOL_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "data_source.h"
+#include "ffplayer.h"
+
+/**
+ * Sources of the tracks likely to play next, opened and buffered in the
+ * background so that they start at once.
+ *
+ * A prepared source has its format opened, its streams selected, its codecs
+ * opened and its first seconds of packets buffered, without any decoder
+ * thread or output device. MediaPlayer::OpenDataSource() adopts it when its
+ * url was prepared.
+ */
+class PreparedSourcePool {
+ public:
+  static const int kDefaultMaxSources = 2;
+  static const int64_t kDefaultMaxBytes = 16 * 1024 * 1024;
+  static const int64_t kDefaultBufferMs = 3000;
+
+  static PreparedSourcePool* Get();
+
+  /**
+   * @param max_sources sources kept at most, the least recently prepared
+   * are dropped first. 0 disables the pool.
+   * @param max_bytes packet bytes buffered by all sources at most.
+   * @param buffer_ms media duration buffered by each source.
+   */
+  void Configure(int max_sources, int64_t max_bytes, int64_t buffer_ms);
+
+  /**
+   * Start preparing |url| in the background, does nothing if it already is.
+   */
+  void Prepare(const std::string& url,
+               const PlayerConfiguration& configuration);
+
+  /**
+   * Take the prepared source of |url| out of the pool.
+   *
+   * @param video_disable whether the player renders video, the source must
+   * have been prepared the same way.
+   * @return null if |url| is not prepared or not ready yet.
+   */
+  std::unique_ptr<DataSource> Take(const std::string& url, bool video_disable);
+
+  /** @return starts served from the pool. */
+  int GetHitCount();
+
+  /** @return starts which found nothing ready in the pool. */
+  int GetMissCount();
+
+ private:
+  struct Entry {
+    std::string url;
+    bool video_disable;
+    std::unique_ptr<DataSource> source;
+  };
+
+  std::mutex mutex_;
+  int max_sources_ = kDefaultMaxSources;
+  int64_t max_bytes_ = kDefaultMaxBytes;
+  int64_t buffer_ms_ = kDefaultBufferMs;
+  // most recently prepared first.
+  std::list<Entry> entries_;
+  int hits_ = 0;
+  int misses_ = 0;
+
+  PreparedSourcePool() = default;
+
+  // must be called with |mutex_| held, dropped entries are moved to
+  // |dropped| to be destroyed without the lock.
+  void Trim(std::list<Entry>* dropped);
+};
+
+#endif  // FFPLAYER_PREPARED_SOURCE_POOL_H
@@ -0,0 +1,300 @@
+//
+// Created by boyan on 2021/3/10.
+//
+
+#include "probe_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "media_io.h"
+
+extern "C" {
+#include "libavutil/avstring.h"
+}
+
+#define PROBE_CACHE_MAX_RESULTS 256
+#define PROBE_CACHE_VERSION "v1"
+
+static bool get_file_stamp(const char* url,
+                           int64_t* file_size,
+                           int64_t* modify_time) {
+  if (!media_io_is_local_file(url)) {
+    return false;
+  }
+  const char* path = url;
+  av_strstart(url, "file:", &path);
+#ifdef _WIN32
+  struct _stat64 st = {};
+  if (_stat64(path, &st) < 0) {
+    return false;
+  }
+#else
+  struct stat st = {};
+  if (stat(path, &st) < 0) {
+    return false;
+  }
+#endif
+  *file_size = st.st_size;
+  *modify_time = st.st_mtime;
+  return true;
+}
+
+static void write_result(std::ostream& out, const ProbeResult& result) {
+  out << PROBE_CACHE_VERSION << " " << result.file_size << " "
+      << result.modify_time << " " << result.format_name << " "
+      << result.start_time << " " << result.duration << " " << result.bit_rate
+      << " " << result.streams.size();
+  for (auto& st : result.streams) {
+    out << " " << st.codec_type << " " << st.codec_id << " " << st.format
+        << " " << st.bit_rate << " " << st.bits_per_raw_sample << " "
+        << st.profile << " " << st.width << " " << st.height << " "
+        << st.sample_aspect_ratio.num << " " << st.sample_aspect_ratio.den
+        << " " << st.channel_layout << " " << st.channels << " "
+        << st.sample_rate << " " << st.frame_size << " "
+        << st.avg_frame_rate.num << " " << st.avg_frame_rate.den << " "
+        << st.r_frame_rate.num << " " << st.r_frame_rate.den << " "
+        << st.start_time << " " << st.duration;
+  }
+  // last, it may contain spaces.
+  out << " " << result.url << "\n";
+}
+
+static bool read_result(const std::string& line, ProbeResult* result) {
+  std::istringstream in(line);
+  std::string version;
+  size_t stream_count;
+  if (!(in >> version) || version != PROBE_CACHE_VERSION) {
+    return false;
+  }
+  if (!(in >> result->file_size >> result->modify_time >>
+        result->format_name >> result->start_time >> result->duration >>
+        result->bit_rate >> stream_count)) {
+    return false;
+  }
+  for (size_t i = 0; i < stream_count; i++) {
+    ProbeStreamInfo st;
+    int codec_type, codec_id;
+    if (!(in >> codec_type >> codec_id >> st.format >> st.bit_rate >>
+          st.bits_per_raw_sample >> st.profile >> st.width >> st.height >>
+          st.sample_aspect_ratio.num >> st.sample_aspect_ratio.den >>
+          st.channel_layout >> st.channels >> st.sample_rate >>
+          st.frame_size >> st.avg_frame_rate.num >> st.avg_frame_rate.den >>
+          st.r_frame_rate.num >> st.r_frame_rate.den >> st.start_time >>
+          st.duration)) {
+      return false;
+    }
+    st.codec_type = (AVMediaType)codec_type;
+    st.codec_id = (AVCodecID)codec_id;
+    result->streams.push_back(st);
+  }
+  in.get();
+  std::getline(in, result->url);
+  return !result->url.empty();
+}
+
+ProbeCache* ProbeCache::Get() {
+  static auto* instance = new ProbeCache();
+  return instance;
+}
+
+void ProbeCache::SetStoragePath(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  storage_path_ = path;
+  Load();
+}
+
+bool ProbeCache::Find(const char* url, ProbeResult* result) {
+  int64_t file_size, modify_time;
+  if (!get_file_stamp(url, &file_size, &modify_time)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = results_.begin(); it != results_.end(); ++it) {
+    if (it->url != url) {
+      continue;
+    }
+    if (it->file_size != file_size || it->modify_time != modify_time) {
+      results_.erase(it);
+      return false;
+    }
+    results_.splice(results_.begin(), results_, it);
+    *result = results_.front();
+    return true;
+  }
+  return false;
+}
+
+ProbeCache::HeaderInfo ProbeCache::GetHeaderInfo(AVFormatContext* format_ctx) {
+  HeaderInfo info;
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* par = format_ctx->streams[i]->codecpar;
+    info.emplace_back(par->codec_id, par->extradata_size);
+  }
+  return info;
+}
+
+void ProbeCache::Put(const char* url,
+                     AVFormatContext* format_ctx,
+                     const HeaderInfo& header_info) {
+  ProbeResult result;
+  if (!get_file_stamp(url, &result.file_size, &result.modify_time)) {
+    return;
+  }
+  if (GetHeaderInfo(format_ctx) != header_info) {
+    av_log(nullptr, AV_LOG_DEBUG,
+           "probe cache: %s needs find_stream_info, not cached.\n", url);
+    return;
+  }
+  result.url = url;
+  std::string names = format_ctx->iformat->name;
+  result.format_name = names.substr(0, names.find(','));
+  result.start_time = format_ctx->start_time;
+  result.duration = format_ctx->duration;
+  result.bit_rate = format_ctx->bit_rate;
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* stream = format_ctx->streams[i];
+    auto* par = stream->codecpar;
+    ProbeStreamInfo st;
+    st.codec_type = par->codec_type;
+    st.codec_id = par->codec_id;
+    st.format = par->format;
+    st.bit_rate = par->bit_rate;
+    st.bits_per_raw_sample = par->bits_per_raw_sample;
+    st.profile = par->profile;
+    st.width = par->width;
+    st.height = par->height;
+    st.sample_aspect_ratio = par->sample_aspect_ratio;
+    st.channel_layout = par->channel_layout;
+    st.channels = par->channels;
+    st.sample_rate = par->sample_rate;
+    st.frame_size = par->frame_size;
+    st.avg_frame_rate = stream->avg_frame_rate;
+    st.r_frame_rate = stream->r_frame_rate;
+    st.start_time = stream->start_time;
+    st.duration = stream->duration;
+    result.streams.push_back(st);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  results_.remove_if(
+      [url](const ProbeResult& item) { return item.url == url; });
+  results_.push_front(std::move(result));
+  if (results_.size() > PROBE_CACHE_MAX_RESULTS) {
+    results_.pop_back();
+  }
+  Save();
+}
+
+bool ProbeCache::Apply(const ProbeResult& result,
+                       AVFormatContext* format_ctx) {
+  if (format_ctx->nb_streams != result.streams.size()) {
+    return false;
+  }
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* par = format_ctx->streams[i]->codecpar;
+    if (par->codec_type != result.streams[i].codec_type ||
+        par->codec_id != result.streams[i].codec_id) {
+      return false;
+    }
+  }
+  // only fill in what the headers left unknown.
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    auto* stream = format_ctx->streams[i];
+    auto* par = stream->codecpar;
+    auto& st = result.streams[i];
+    if (par->format < 0) {
+      par->format = st.format;
+    }
+    if (!par->bit_rate) {
+      par->bit_rate = st.bit_rate;
+    }
+    if (!par->bits_per_raw_sample) {
+      par->bits_per_raw_sample = st.bits_per_raw_sample;
+    }
+    if (par->profile == FF_PROFILE_UNKNOWN) {
+      par->profile = st.profile;
+    }
+    if (!par->width && !par->height) {
+      par->width = st.width;
+      par->height = st.height;
+    }
+    if (!par->sample_aspect_ratio.num) {
+      par->sample_aspect_ratio = st.sample_aspect_ratio;
+    }
+    if (!par->channels) {
+      par->channels = st.channels;
+      par->channel_layout = st.channel_layout;
+    }
+    if (!par->sample_rate) {
+      par->sample_rate = st.sample_rate;
+    }
+    if (!par->frame_size) {
+      par->frame_size = st.frame_size;
+    }
+    if (!stream->avg_frame_rate.num) {
+      stream->avg_frame_rate = st.avg_frame_rate;
+    }
+    if (!stream->r_frame_rate.num) {
+      stream->r_frame_rate = st.r_frame_rate;
+    }
+    if (stream->start_time == AV_NOPTS_VALUE) {
+      stream->start_time = st.start_time;
+    }
+    if (stream->duration == AV_NOPTS_VALUE) {
+      stream->duration = st.duration;
+    }
+  }
+  if (format_ctx->start_time == AV_NOPTS_VALUE) {
+    format_ctx->start_time = result.start_time;
+  }
+  if (format_ctx->duration == AV_NOPTS_VALUE) {
+    format_ctx->duration = result.duration;
+  }
+  if (!format_ctx->bit_rate) {
+    format_ctx->bit_rate = result.bit_rate;
+  }
+  return true;
+}
+
+void ProbeCache::Load() {
+  std::ifstream in(storage_path_);
+  std::string line;
+  while (std::getline(in, line) &&
+         results_.size() < PROBE_CACHE_MAX_RESULTS) {
+    ProbeResult result;
+    if (!read_result(line, &result)) {
+      continue;
+    }
+    auto exists = false;
+    for (auto& item : results_) {
+      exists |= item.url == result.url;
+    }
+    if (!exists) {
+      results_.push_back(std::move(result));
+    }
+  }
+}
+
+void ProbeCache::Save() {
+  if (storage_path_.empty()) {
+    return;
+  }
+  auto temp_path = storage_path_ + ".tmp";
+  {
+    std::ofstream out(temp_path, std::ios::trunc);
+    for (auto& result : results_) {
+      write_result(out, result);
+    }
+    if (!out) {
+      av_log(nullptr, AV_LOG_ERROR, "probe cache: can not write %s.\n",
+             temp_path.c_str());
+      return;
+    }
+  }
+  std::remove(storage_path_.c_str());
+  std::rename(temp_path.c_str(), storage_path_.c_str());
+}
@@ -0,0 +1,118 @@
+//
+// Created by boyan on 2021/3/10.
+//
+
+#ifndef FFPLAYER_PROBE_CACHE_H
+#define FFPLAYER_PROBE_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+/* What avformat_find_stream_info() found for one stream. */
+struct ProbeStreamInfo {
+  AVMediaType codec_type = AVMEDIA_TYPE_UNKNOWN;
+  AVCodecID codec_id = AV_CODEC_ID_NONE;
+  int format = -1;
+  int64_t bit_rate = 0;
+  int bits_per_raw_sample = 0;
+  int profile = FF_PROFILE_UNKNOWN;
+  int width = 0;
+  int height = 0;
+  AVRational sample_aspect_ratio = {0, 1};
+  uint64_t channel_layout = 0;
+  int channels = 0;
+  int sample_rate = 0;
+  int frame_size = 0;
+  AVRational avg_frame_rate = {0, 1};
+  AVRational r_frame_rate = {0, 1};
+  int64_t start_time = AV_NOPTS_VALUE;
+  int64_t duration = AV_NOPTS_VALUE;
+};
+
+/* Probe result of one file. */
+struct ProbeResult {
+  std::string url;
+  int64_t file_size = -1;
+  int64_t modify_time = 0;
+
+  // first name of the input format.
+  std::string format_name;
+  int64_t start_time = AV_NOPTS_VALUE;
+  int64_t duration = AV_NOPTS_VALUE;
+  int64_t bit_rate = 0;
+  std::vector<ProbeStreamInfo> streams;
+};
+
+/**
+ * Remembers the input format and stream parameters of local files, keyed by
+ * path, size and modification time, so that opening them again skips format
+ * probing and avformat_find_stream_info().
+ *
+ * Only files whose demuxer gives every codec id and extradata from the
+ * headers are cached, what is restored then only fills parameters left
+ * unknown by the headers.
+ */
+class ProbeCache {
+ public:
+  static ProbeCache* Get();
+
+  /**
+   * Persist the cache to |path|, loading what it already holds. The cache
+   * only lives in memory until this is called.
+   */
+  void SetStoragePath(const std::string& path);
+
+  /**
+   * @return true if |url| is a local file probed before and not modified
+   * since.
+   */
+  bool Find(const char* url, ProbeResult* result);
+
+  /* Codec id and extradata size of each stream. */
+  typedef std::vector<std::pair<AVCodecID, int>> HeaderInfo;
+
+  /**
+   * @return what the headers give, to be taken before
+   * avformat_find_stream_info().
+   */
+  static HeaderInfo GetHeaderInfo(AVFormatContext* format_ctx);
+
+  /**
+   * Record the probe result of |format_ctx| after avformat_find_stream_info().
+   * Nothing is recorded if it found streams, codecs or extradata that
+   * |header_info| did not have.
+   */
+  void Put(const char* url,
+           AVFormatContext* format_ctx,
+           const HeaderInfo& header_info);
+
+  /**
+   * Restore |result| to the streams of a context opened with its format.
+   *
+   * @return false if the streams do not match, find_stream_info is needed.
+   */
+  static bool Apply(const ProbeResult& result, AVFormatContext* format_ctx);
+
+ private:
+  std::mutex mutex_;
+  std::string storage_path_;
+  // most recently used first.
+  std::list<ProbeResult> results_;
+
+  ProbeCache() = default;
+
+  // must be called with |mutex_| held.
+  void Load();
+
+  // must be called with |mutex_| held.
+  void Save();
+};
+
+#endif  // FFPLAYER_PROBE_CACHE_H
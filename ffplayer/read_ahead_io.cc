@@ -0,0 +1,605 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#include "read_ahead_io.h"
+
+#include <cstring>
+
+#include "ffp_utils.h"
+
+extern "C" {
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+}
+
+#ifdef LYCHEE_HAVE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#define READ_AHEAD_BLOCK_SIZE (256 * 1024)
+
+/* blocks fetched with one io_uring submission */
+#define READ_AHEAD_MAX_BATCH 16
+
+namespace {
+
+/* Reads blocks one after another through a MediaIO. */
+class MediaIOFetcher : public ReadAheadFetcher {
+ public:
+  explicit MediaIOFetcher(std::unique_ptr<MediaIO> source)
+      : source_(std::move(source)) {}
+
+  void Fetch(ReadAheadBlock** blocks, int count) override {
+    for (int i = 0; i < count; i++) {
+      auto* block = blocks[i];
+      if (position_ != block->offset) {
+        auto ret = source_->Seek(block->offset, SEEK_SET);
+        if (ret < 0) {
+          block->error = (int)ret;
+          continue;
+        }
+        position_ = block->offset;
+      }
+      while (block->size < (int)block->data.size()) {
+        auto ret = source_->Read(block->data.data() + block->size,
+                                 (int)block->data.size() - block->size);
+        if (ret == AVERROR_EOF) {
+          break;
+        }
+        if (ret < 0) {
+          block->error = ret;
+          break;
+        }
+        block->size += ret;
+        position_ += ret;
+      }
+    }
+  }
+
+  int64_t Size() override { return source_->Seek(0, AVSEEK_SIZE); }
+
+  void Abort() override { source_->Abort(); }
+
+  const char* Name() const override { return "sequential"; }
+
+ private:
+  std::unique_ptr<MediaIO> source_;
+  int64_t position_ = 0;
+};
+
+#ifdef LYCHEE_HAVE_IO_URING
+
+/* Reads a batch of blocks of a local file with a single io_uring submission. */
+class IoUringFetcher : public ReadAheadFetcher {
+ public:
+  static std::unique_ptr<IoUringFetcher> Create(const char* path) {
+    std::unique_ptr<IoUringFetcher> fetcher(new IoUringFetcher());
+    fetcher->file_fd_ = open(path, O_RDONLY | O_CLOEXEC);
+    if (fetcher->file_fd_ < 0) {
+      return nullptr;
+    }
+    struct stat st = {};
+    if (fstat(fetcher->file_fd_, &st) < 0 || !S_ISREG(st.st_mode)) {
+      return nullptr;
+    }
+    fetcher->file_size_ = st.st_size;
+    if (fetcher->SetupRing() < 0) {
+      return nullptr;
+    }
+    return fetcher;
+  }
+
+  ~IoUringFetcher() override {
+    CloseRing();
+    if (file_fd_ >= 0) {
+      close(file_fd_);
+    }
+  }
+
+  void Fetch(ReadAheadBlock** blocks, int count) override {
+    for (int i = 0; i < count; i += (int)sq_entries_) {
+      auto batch = FFMIN(count - i, (int)sq_entries_);
+      if (ring_fd_ < 0) {
+        // the ring was closed by a failure, see FetchBatch().
+        for (int j = i; j < i + batch; j++) {
+          ReadRemaining(blocks[j]);
+        }
+        continue;
+      }
+      FetchBatch(blocks + i, batch);
+    }
+  }
+
+  int64_t Size() override { return file_size_; }
+
+  void Abort() override {}
+
+  const char* Name() const override { return "io_uring"; }
+
+ private:
+  int file_fd_ = -1;
+  int64_t file_size_ = 0;
+
+  int ring_fd_ = -1;
+  unsigned sq_entries_ = 0;
+  void* sq_ptr_ = nullptr;
+  size_t sq_len_ = 0;
+  void* cq_ptr_ = nullptr;
+  size_t cq_len_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_len_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  iovec iovecs_[READ_AHEAD_MAX_BATCH] = {};
+
+  IoUringFetcher() = default;
+
+  void FetchBatch(ReadAheadBlock** blocks, int count) {
+    auto start = *sq_tail_;
+    auto tail = start;
+    for (int i = 0; i < count; i++) {
+      auto index = tail & *sq_mask_;
+      auto* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      iovecs_[i].iov_base = blocks[i]->data.data();
+      iovecs_[i].iov_len = blocks[i]->data.size();
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = file_fd_;
+      sqe->addr = (uint64_t)&iovecs_[i];
+      sqe->len = 1;
+      sqe->off = (uint64_t)blocks[i]->offset;
+      sqe->user_data = (uint64_t)i;
+      sq_array_[index] = index;
+      tail++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    int completed = 0;
+    while (completed < count) {
+      auto ret = (int)syscall(__NR_io_uring_enter, ring_fd_, count - submitted,
+                              1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        av_log(nullptr, AV_LOG_WARNING,
+               "io_uring: %s, reading synchronously.\n", strerror(errno));
+        // take back the entries the kernel did not consume, and wait for the
+        // ones in flight, the kernel writes their buffers until they complete.
+        submitted = (int)(__atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) - start);
+        __atomic_store_n(sq_tail_, start + submitted, __ATOMIC_RELEASE);
+        if (Drain(blocks, submitted, completed) < 0) {
+          // closing the ring cancels what is still in flight.
+          CloseRing();
+        }
+        for (int i = 0; i < count; i++) {
+          if (!blocks[i]->error) {
+            ReadRemaining(blocks[i]);
+          }
+        }
+        return;
+      }
+      submitted += ret;
+      completed += Reap(blocks);
+    }
+  }
+
+  // @return completions taken from the ring.
+  int Reap(ReadAheadBlock** blocks) {
+    int completed = 0;
+    auto head = *cq_head_;
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      auto* cqe = &cqes_[head & *cq_mask_];
+      auto* block = blocks[cqe->user_data];
+      if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+        block->error = AVERROR(-cqe->res);
+      } else {
+        block->size = FFMAX(cqe->res, 0);
+        ReadRemaining(block);
+      }
+      head++;
+      completed++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return completed;
+  }
+
+  // wait until the |submitted| requests of |blocks| have completed.
+  int Drain(ReadAheadBlock** blocks, int submitted, int completed) {
+    while (completed < submitted) {
+      auto ret = (int)syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                              IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR) {
+        av_log(nullptr, AV_LOG_ERROR, "io_uring: can not drain: %s.\n",
+               strerror(errno));
+        return -1;
+      }
+      completed += Reap(blocks);
+    }
+    return 0;
+  }
+
+  void CloseRing() {
+    if (sqes_) {
+      munmap(sqes_, sqes_len_);
+      sqes_ = nullptr;
+    }
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+      munmap(cq_ptr_, cq_len_);
+    }
+    cq_ptr_ = nullptr;
+    if (sq_ptr_) {
+      munmap(sq_ptr_, sq_len_);
+      sq_ptr_ = nullptr;
+    }
+    if (ring_fd_ >= 0) {
+      close(ring_fd_);
+      ring_fd_ = -1;
+    }
+  }
+
+  int SetupRing() {
+    io_uring_params params = {};
+    ring_fd_ = (int)syscall(__NR_io_uring_setup, READ_AHEAD_MAX_BATCH, &params);
+    if (ring_fd_ < 0) {
+      av_log(nullptr, AV_LOG_INFO, "io_uring not available: %s.\n",
+             strerror(errno));
+      return -1;
+    }
+    sq_entries_ = FFMIN(params.sq_entries, (unsigned)READ_AHEAD_MAX_BATCH);
+    sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_len_ = cq_len_ = FFMAX(sq_len_, cq_len_);
+    }
+    sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+      sq_ptr_ = nullptr;
+      return -1;
+    }
+    if (single_mmap) {
+      cq_ptr_ = sq_ptr_;
+    } else {
+      cq_ptr_ = mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ptr_ == MAP_FAILED) {
+        cq_ptr_ = nullptr;
+        return -1;
+      }
+    }
+    sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+    auto* sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      return -1;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<uint8_t*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto* cq = static_cast<uint8_t*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return 0;
+  }
+
+  // complete a short read, which only ends at the end of the file.
+  void ReadRemaining(ReadAheadBlock* block) const {
+    auto capacity = (int)block->data.size();
+    while (block->size < capacity &&
+           block->offset + block->size < file_size_) {
+      auto ret = pread(file_fd_, block->data.data() + block->size,
+                       capacity - block->size, block->offset + block->size);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret < 0) {
+        block->error = AVERROR(errno);
+        return;
+      }
+      if (ret == 0) {
+        return;
+      }
+      block->size += (int)ret;
+    }
+  }
+};
+
+#endif  // LYCHEE_HAVE_IO_URING
+
+}  // namespace
+
+std::unique_ptr<ReadAheadIO> ReadAheadIO::Create(
+    const char* url,
+    const AVIOInterruptCB* interrupt_cb,
+    int64_t window_bytes) {
+#ifdef LYCHEE_HAVE_IO_URING
+  if (media_io_is_local_file(url)) {
+    const char* path = url;
+    av_strstart(url, "file:", &path);
+    auto fetcher = IoUringFetcher::Create(path);
+    if (fetcher) {
+      return std::unique_ptr<ReadAheadIO>(
+          new ReadAheadIO(std::move(fetcher), window_bytes));
+    }
+  }
+#endif
+  auto source = UrlIO::Open(url, interrupt_cb, nullptr);
+  if (!source) {
+    return nullptr;
+  }
+  return Create(std::move(source), window_bytes);
+}
+
+std::unique_ptr<ReadAheadIO> ReadAheadIO::Create(
+    std::unique_ptr<MediaIO> source,
+    int64_t window_bytes) {
+  std::unique_ptr<ReadAheadFetcher> fetcher(
+      new MediaIOFetcher(std::move(source)));
+  return std::unique_ptr<ReadAheadIO>(
+      new ReadAheadIO(std::move(fetcher), window_bytes));
+}
+
+ReadAheadIO::ReadAheadIO(std::unique_ptr<ReadAheadFetcher> fetcher,
+                         int64_t window_bytes)
+    : fetcher_(std::move(fetcher)),
+      window_bytes_(FFMAX(window_bytes, (int64_t)READ_AHEAD_BLOCK_SIZE)),
+      size_(fetcher_->Size()) {
+  prefetch_thread_ = new std::thread(&ReadAheadIO::PrefetchThread, this);
+}
+
+ReadAheadIO::~ReadAheadIO() {
+  Abort();
+  if (prefetch_thread_->joinable()) {
+    prefetch_thread_->join();
+  }
+  delete prefetch_thread_;
+  av_log(nullptr, AV_LOG_INFO,
+         "read ahead(%s): read %" PRId64 " KB, fetched %" PRId64
+         " KB at %.1f MB/s, waited %" PRId64
+         " ms. seeks: %d, %d served from window, %.2f ms to first byte.\n",
+         fetcher_->Name(), bytes_read_ / 1024, bytes_fetched_ / 1024,
+         fetch_time_ ? (double)bytes_fetched_ / (double)fetch_time_ : 0.0,
+         read_wait_time_ / 1000, seek_count_, seek_hits_,
+         seek_count_ ? seek_wait_time_ / 1000.0 / seek_count_ : 0.0);
+}
+
+void ReadAheadIO::Abort() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abort_ = true;
+  }
+  fetcher_->Abort();
+  fetched_cond_.notify_all();
+  read_cond_.notify_all();
+}
+
+void ReadAheadIO::PrefetchThread() {
+  update_thread_name("read_ahead");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!abort_) {
+    auto ahead = fetch_position_ - read_position_;
+    auto at_end = size_ >= 0 && fetch_position_ >= size_;
+    if (!blocks_.empty() && blocks_.back()->ready) {
+      // a short or failed block ends the source until the next seek.
+      auto& last = blocks_.back();
+      at_end |= last->error < 0 || last->size < (int)last->data.size();
+    }
+    if (at_end || ahead >= window_bytes_) {
+      read_cond_.wait(lock);
+      continue;
+    }
+
+    auto count = (int)FFMIN(
+        (window_bytes_ - ahead + READ_AHEAD_BLOCK_SIZE - 1) /
+            READ_AHEAD_BLOCK_SIZE,
+        READ_AHEAD_MAX_BATCH);
+    std::shared_ptr<ReadAheadBlock> batch[READ_AHEAD_MAX_BATCH];
+    ReadAheadBlock* blocks[READ_AHEAD_MAX_BATCH];
+    int fetch_count = 0;
+    for (; fetch_count < count; fetch_count++) {
+      if (size_ >= 0 && fetch_position_ >= size_) {
+        break;
+      }
+      auto block = std::make_shared<ReadAheadBlock>();
+      block->offset = fetch_position_;
+      if (!spare_buffers_.empty()) {
+        block->data = std::move(spare_buffers_.back());
+        spare_buffers_.pop_back();
+      }
+      fetch_position_ += READ_AHEAD_BLOCK_SIZE;
+      blocks_.push_back(block);
+      blocks[fetch_count] = block.get();
+      batch[fetch_count] = std::move(block);
+    }
+    auto generation = generation_;
+
+    lock.unlock();
+    for (int i = 0; i < fetch_count; i++) {
+      blocks[i]->data.resize(READ_AHEAD_BLOCK_SIZE);
+    }
+    auto start = av_gettime_relative();
+    fetcher_->Fetch(blocks, fetch_count);
+    auto fetch_time = av_gettime_relative() - start;
+    lock.lock();
+
+    fetch_time_ += fetch_time;
+    for (int i = 0; i < fetch_count; i++) {
+      bytes_fetched_ += blocks[i]->size;
+      blocks[i]->ready = true;
+    }
+    if (generation != generation_) {
+      // the window was dropped while fetching.
+      continue;
+    }
+    fetched_cond_.notify_all();
+  }
+}
+
+int ReadAheadIO::Read(uint8_t* buf, int size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  int64_t wait_start = 0;
+  while (!abort_) {
+    if (size_ >= 0 && read_position_ >= size_) {
+      return AVERROR_EOF;
+    }
+    auto block = FindBlock(read_position_);
+    if (!block && !blocks_.empty() && blocks_.back()->ready) {
+      // past a short or failed last block, nothing more will be fetched.
+      auto& last = blocks_.back();
+      if (last->error < 0) {
+        return last->error;
+      }
+      if (last->size < (int)last->data.size()) {
+        return AVERROR_EOF;
+      }
+    }
+    if (!block || !block->ready) {
+      if (!wait_start) {
+        wait_start = av_gettime_relative();
+      }
+      fetched_cond_.wait(lock);
+      continue;
+    }
+    if (block->error < 0) {
+      return block->error;
+    }
+    auto available = block->offset + block->size - read_position_;
+    if (available <= 0) {
+      return AVERROR_EOF;
+    }
+    auto bytes = (int)FFMIN(available, (int64_t)size);
+    memcpy(buf, block->data.data() + (read_position_ - block->offset), bytes);
+    read_position_ += bytes;
+    bytes_read_ += bytes;
+
+    auto now = av_gettime_relative();
+    if (wait_start) {
+      read_wait_time_ += now - wait_start;
+    }
+    if (seek_time_) {
+      seek_wait_time_ += now - seek_time_;
+      seek_time_ = 0;
+    }
+    DropBlocksBehind();
+    read_cond_.notify_one();
+    return bytes;
+  }
+  return AVERROR_EXIT;
+}
+
+int64_t ReadAheadIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  if (whence == AVSEEK_SIZE) {
+    return size_ >= 0 ? size_ : AVERROR(ENOSYS);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t target;
+  switch (whence) {
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = read_position_ + offset;
+      break;
+    case SEEK_END:
+      if (size_ < 0) {
+        return AVERROR(ENOSYS);
+      }
+      target = size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+
+  seek_count_++;
+  seek_time_ = av_gettime_relative();
+  DropFailedBlocks();
+  auto window_start =
+      blocks_.empty() ? fetch_position_ : blocks_.front()->offset;
+  if (target >= window_start && target <= fetch_position_) {
+    seek_hits_++;
+  } else {
+    generation_++;
+    for (auto& block : blocks_) {
+      DropBlock(block);
+    }
+    blocks_.clear();
+    fetch_position_ = target;
+  }
+  read_position_ = target;
+  DropBlocksBehind();
+  read_cond_.notify_one();
+  return target;
+}
+
+std::shared_ptr<ReadAheadBlock> ReadAheadIO::FindBlock(int64_t position) {
+  if (blocks_.empty() || position < blocks_.front()->offset) {
+    return nullptr;
+  }
+  auto index = (position - blocks_.front()->offset) / READ_AHEAD_BLOCK_SIZE;
+  if (index >= (int64_t)blocks_.size()) {
+    return nullptr;
+  }
+  return blocks_[index];
+}
+
+void ReadAheadIO::DropBlocksBehind() {
+  // keep a quarter of the window behind for short backward seeks.
+  auto keep_from = read_position_ - window_bytes_ / 4;
+  while (!blocks_.empty() &&
+         blocks_.front()->offset + READ_AHEAD_BLOCK_SIZE <= keep_from) {
+    DropBlock(blocks_.front());
+    blocks_.pop_front();
+  }
+}
+
+void ReadAheadIO::DropFailedBlocks() {
+  // a failed block ends the source until a seek, which fetches it again.
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    if (blocks_[i]->ready && blocks_[i]->error < 0) {
+      fetch_position_ = blocks_[i]->offset;
+      while (blocks_.size() > i) {
+        DropBlock(blocks_.back());
+        blocks_.pop_back();
+      }
+      return;
+    }
+  }
+}
+
+void ReadAheadIO::DropBlock(const std::shared_ptr<ReadAheadBlock>& block) {
+  // blocks still being fetched are released by the prefetch thread.
+  if (block->ready) {
+    spare_buffers_.push_back(std::move(block->data));
+  }
+}
@@ -0,0 +1,139 @@
+//
+// Created by boyan on 2021/3/7.
+//
+
+#ifndef FFPLAYER_READ_AHEAD_IO_H
+#define FFPLAYER_READ_AHEAD_IO_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "media_io.h"
+
+/* A block of the read-ahead window. */
+struct ReadAheadBlock {
+  int64_t offset = 0;
+  std::vector<uint8_t> data;
+  // bytes filled, less than the capacity at the end of the source.
+  int size = 0;
+  // negative AVERROR if the block could not be read.
+  int error = 0;
+  bool ready = false;
+};
+
+/**
+ * Reads blocks for ReadAheadIO on its prefetch thread.
+ */
+class ReadAheadFetcher {
+ public:
+  virtual ~ReadAheadFetcher() = default;
+
+  /**
+   * Fill |count| contiguous blocks. Each block is read from its offset up to
+   * its capacity, or up to the end of the source.
+   */
+  virtual void Fetch(ReadAheadBlock** blocks, int count) = 0;
+
+  /** @return size of the source, negative if unknown. */
+  virtual int64_t Size() = 0;
+
+  virtual void Abort() = 0;
+
+  /** @return name for the statistic log. */
+  virtual const char* Name() const = 0;
+};
+
+/**
+ * Keeps a window of bytes ahead of the read position, filled by a dedicated
+ * prefetch thread, so that demuxing never waits for the disk while the
+ * window holds data.
+ *
+ * Local files on linux are fetched with batched io_uring reads when the
+ * kernel allows it, other sources are read block by block through a
+ * MediaIO. Seeks landing in the window, or in the quarter of it kept behind
+ * the read position, are served without touching the source.
+ */
+class ReadAheadIO : public MediaIO {
+ public:
+  /**
+   * @param url read with io_uring if it is a local file and the kernel
+   * allows it, through the ffmpeg protocols otherwise.
+   * @param interrupt_cb checked by blocking protocol calls, can be null.
+   * @param window_bytes bytes kept ahead of the read position.
+   * @return null if |url| can not be opened.
+   */
+  static std::unique_ptr<ReadAheadIO> Create(
+      const char* url,
+      const AVIOInterruptCB* interrupt_cb,
+      int64_t window_bytes);
+
+  /**
+   * Read ahead of any |source|, block by block.
+   */
+  static std::unique_ptr<ReadAheadIO> Create(std::unique_ptr<MediaIO> source,
+                                             int64_t window_bytes);
+
+  ~ReadAheadIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+ private:
+  std::unique_ptr<ReadAheadFetcher> fetcher_;
+  int64_t window_bytes_;
+  int64_t size_;
+
+  std::mutex mutex_;
+  // signaled when blocks are fetched.
+  std::condition_variable fetched_cond_;
+  // signaled when the read position moves.
+  std::condition_variable read_cond_;
+  std::thread* prefetch_thread_ = nullptr;
+
+  std::deque<std::shared_ptr<ReadAheadBlock>> blocks_;
+  // data of dropped blocks, reused for the next ones.
+  std::vector<std::vector<uint8_t>> spare_buffers_;
+  int64_t read_position_ = 0;
+  int64_t fetch_position_ = 0;
+  // bumped when the window is dropped, blocks of an older generation being
+  // fetched are discarded.
+  int generation_ = 0;
+  bool abort_ = false;
+
+  // statistic.
+  int64_t bytes_read_ = 0;
+  int64_t bytes_fetched_ = 0;
+  int64_t fetch_time_ = 0;
+  int64_t read_wait_time_ = 0;
+  int seek_count_ = 0;
+  int seek_hits_ = 0;
+  int64_t seek_wait_time_ = 0;
+  // time of the last seek until its first byte is read, 0 if none pending.
+  int64_t seek_time_ = 0;
+
+  ReadAheadIO(std::unique_ptr<ReadAheadFetcher> fetcher, int64_t window_bytes);
+
+  void PrefetchThread();
+
+  // must be called with |mutex_| held, null if |position| is not in window.
+  std::shared_ptr<ReadAheadBlock> FindBlock(int64_t position);
+
+  // must be called with |mutex_| held.
+  void DropBlocksBehind();
+
+  // drop the window from the first failed block on, so that it is fetched
+  // again. Must be called with |mutex_| held.
+  void DropFailedBlocks();
+
+  // must be called with |mutex_| held.
+  void DropBlock(const std::shared_ptr<ReadAheadBlock>& block);
+};
+
+#endif  // FFPLAYER_READ_AHEAD_IO_H
@@ -0,0 +1,29 @@
+//
+// Created by boyan on 2021/3/11.
+//
+
+#include "read_event.h"
+
+#include <chrono>
+
+void ReadEvent::Notify() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  signaled_ = true;
+  cond_.notify_one();
+}
+
+void ReadEvent::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this]() { return signaled_; });
+  signaled_ = false;
+  wakeups_++;
+}
+
+bool ReadEvent::WaitFor(int64_t timeout_us) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto signaled = cond_.wait_for(lock, std::chrono::microseconds(timeout_us),
+                                 [this]() { return signaled_; });
+  signaled_ = false;
+  wakeups_++;
+  return signaled;
+}
@@ -0,0 +1,44 @@
+//
+// Created by boyan on 2021/3/11.
+//
+
+#ifndef FFPLAYER_READ_EVENT_H
+#define FFPLAYER_READ_EVENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Wakes the DataSource read thread: a packet queue drained below its
+ * watermark, a decoder ran dry, a seek, pause or abort was requested.
+ *
+ * A notification is kept until the read thread waits, so none is lost
+ * between the checks of the thread and its sleep.
+ */
+class ReadEvent {
+ public:
+  void Notify();
+
+  /** Block until notified. */
+  void Wait();
+
+  /**
+   * Block until notified or |timeout_us| elapsed.
+   *
+   * @return false on timeout.
+   */
+  bool WaitFor(int64_t timeout_us);
+
+  /** @return times Wait() or WaitFor() returned. */
+  int64_t GetWakeupCount() const { return wakeups_; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool signaled_ = false;
+  std::atomic<int64_t> wakeups_{0};
+};
+
+#endif  // FFPLAYER_READ_EVENT_H
@@ -0,0 +1,226 @@
+//
+// Created by boyan on 2021/3/16.
+//
+
+#include "reconnect_io.h"
+
+#include <chrono>
+#include <cinttypes>
+
+#include "ffp_utils.h"
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+/* the first attempt is immediate, the next ones wait from this, doubled on
+ * each failure */
+#define RECONNECT_MIN_DELAY_US 100000
+#define RECONNECT_MAX_DELAY_US 5000000
+
+std::unique_ptr<ReconnectIO> ReconnectIO::Create(SourceFactory open_source,
+                                                 int64_t timeout_us) {
+  std::unique_ptr<ReconnectIO> io(
+      new ReconnectIO(std::move(open_source), timeout_us));
+  io->source_ = io->open_source_();
+  if (!io->source_) {
+    return nullptr;
+  }
+  io->size_ = io->source_->Seek(0, AVSEEK_SIZE);
+  return io;
+}
+
+ReconnectIO::ReconnectIO(SourceFactory open_source, int64_t timeout_us)
+    : open_source_(std::move(open_source)), timeout_us_(timeout_us) {}
+
+ReconnectIO::~ReconnectIO() {
+  if (reconnects_) {
+    av_log(nullptr, AV_LOG_INFO, "reconnect: %d reconnections.\n",
+           reconnects_.load());
+  }
+}
+
+bool ReconnectIO::CanRetry(int error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (abort_) {
+    return false;
+  }
+  switch (error) {
+    case AVERROR_EXIT:
+      // the source was aborted by ReconnectNow().
+      return reconnect_now_;
+    case AVERROR(ENOSYS):
+    case AVERROR(EINVAL):
+    case AVERROR_HTTP_BAD_REQUEST:
+    case AVERROR_HTTP_UNAUTHORIZED:
+    case AVERROR_HTTP_FORBIDDEN:
+    case AVERROR_HTTP_NOT_FOUND:
+    case AVERROR_HTTP_OTHER_4XX:
+      return false;
+    default:
+      return true;
+  }
+}
+
+int ReconnectIO::Reconnect(int error) {
+  if (!failure_time_) {
+    failure_time_ = av_gettime_relative();
+    attempts_ = 0;
+    av_log(nullptr, AV_LOG_WARNING,
+           "reconnect: source failed at %" PRId64 ": %s, reconnecting.\n",
+           position_, av_err_to_str(error));
+  }
+  std::unique_ptr<MediaIO> source;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    source = std::move(source_);
+  }
+  for (;;) {
+    // the failed or rejected source is closed without the lock.
+    source.reset();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto delay =
+          attempts_ ? FFMIN((int64_t)RECONNECT_MIN_DELAY_US
+                                << FFMIN(attempts_ - 1, 16),
+                            (int64_t)RECONNECT_MAX_DELAY_US)
+                    : 0;
+      if (delay && !reconnect_now_) {
+        cond_.wait_for(lock, std::chrono::microseconds(delay),
+                       [this]() { return abort_ || reconnect_now_; });
+      }
+      reconnect_now_ = false;
+      if (abort_) {
+        return AVERROR_EXIT;
+      }
+    }
+    if (av_gettime_relative() - failure_time_ > timeout_us_) {
+      av_log(nullptr, AV_LOG_ERROR,
+             "reconnect: gave up after %d attempts in %.1f s.\n", attempts_,
+             (double)(av_gettime_relative() - failure_time_) / 1000000);
+      return error;
+    }
+    attempts_++;
+    source = open_source_();
+    if (!source) {
+      continue;
+    }
+    if (position_ > 0) {
+      auto position = source->Seek(position_, SEEK_SET);
+      if (position == AVERROR(ENOSYS)) {
+        av_log(nullptr, AV_LOG_ERROR,
+               "reconnect: the source can not resume at %" PRId64 ".\n",
+               position_);
+        return error;
+      }
+      if (position != position_) {
+        continue;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (abort_) {
+      return AVERROR_EXIT;
+    }
+    source_ = std::move(source);
+    reconnects_++;
+    return 0;
+  }
+}
+
+int ReconnectIO::Read(uint8_t* buf, int size) {
+  for (;;) {
+    auto ret = source_ ? source_->Read(buf, size) : AVERROR(EIO);
+    if (ret >= 0) {
+      position_ += ret;
+      if (ret > 0 && failure_time_) {
+        av_log(nullptr, AV_LOG_INFO,
+               "reconnect: resumed at %" PRId64
+               " after %d attempts, %.1f ms without data.\n",
+               position_ - ret, attempts_,
+               (double)(av_gettime_relative() - failure_time_) / 1000);
+        failure_time_ = 0;
+      }
+      return ret;
+    }
+    if (ret == AVERROR_EOF && (size_ < 0 || position_ >= size_)) {
+      return ret;
+    }
+    if (!CanRetry(ret)) {
+      return ret;
+    }
+    // a connection dropped before the end reads as an early end too.
+    ret = Reconnect(ret);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+}
+
+int64_t ReconnectIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return size_ >= 0 ? size_ : AVERROR(ENOSYS);
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      if (size_ < 0) {
+        return AVERROR(ENOSYS);
+      }
+      target = size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  auto ret = source_ ? source_->Seek(target, SEEK_SET) : AVERROR(EIO);
+  if (ret >= 0) {
+    position_ = ret;
+    return ret;
+  }
+  if (!CanRetry((int)ret)) {
+    return ret;
+  }
+  // the new source starts at |target|.
+  auto position = position_;
+  position_ = target;
+  auto err = Reconnect((int)ret);
+  if (err < 0) {
+    position_ = position;
+    return err;
+  }
+  // the new source reached |target|, the failure is over, the next one
+  // gets its own timeout.
+  av_log(nullptr, AV_LOG_INFO,
+         "reconnect: resumed at %" PRId64 " after %d attempts, %.1f ms.\n",
+         target, attempts_,
+         (double)(av_gettime_relative() - failure_time_) / 1000);
+  failure_time_ = 0;
+  return target;
+}
+
+void ReconnectIO::Abort() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  abort_ = true;
+  if (source_) {
+    source_->Abort();
+  }
+  cond_.notify_all();
+}
+
+void ReconnectIO::ReconnectNow() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reconnect_now_ = true;
+  if (source_) {
+    // its pending read fails, and the source is reopened.
+    source_->Abort();
+  }
+  cond_.notify_all();
+}
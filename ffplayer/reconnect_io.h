@@ -0,0 +1,82 @@
+//
+// Created by boyan on 2021/3/16.
+//
+
+#ifndef FFPLAYER_RECONNECT_IO_H
+#define FFPLAYER_RECONNECT_IO_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "media_io.h"
+
+/**
+ * Reopens a network source that failed, and resumes at the byte it had
+ * reached, so that the demuxer, the decoders and the queues never notice.
+ *
+ * Reads and seeks failing with a retryable error reopen the source with an
+ * exponential backoff, then seek the new one to the read position, a range
+ * request over http. Errors such as 404 are returned at once.
+ */
+class ReconnectIO : public MediaIO {
+ public:
+  typedef std::function<std::unique_ptr<MediaIO>()> SourceFactory;
+
+  /**
+   * @param open_source opens the source, returns null on failure.
+   * @param timeout_us give up reconnecting after this long.
+   * @return null if the source can not be opened the first time.
+   */
+  static std::unique_ptr<ReconnectIO> Create(SourceFactory open_source,
+                                             int64_t timeout_us);
+
+  ~ReconnectIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+  /**
+   * Drop the connection and reconnect at once, skipping any backoff. Useful
+   * when the network changed. Can be called from any thread.
+   */
+  void ReconnectNow();
+
+  /** @return reconnections so far. */
+  int GetReconnectCount() const { return reconnects_; }
+
+ private:
+  SourceFactory open_source_;
+  int64_t timeout_us_;
+  int64_t size_ = -1;
+  int64_t position_ = 0;
+
+  // guards the members below, |source_| is only replaced with it held.
+  std::mutex mutex_;
+  // signaled on abort and on ReconnectNow().
+  std::condition_variable cond_;
+  std::unique_ptr<MediaIO> source_;
+  bool abort_ = false;
+  bool reconnect_now_ = false;
+
+  // statistic.
+  std::atomic<int> reconnects_{0};
+  // of the failure being recovered, 0 if none.
+  int64_t failure_time_ = 0;
+  int attempts_ = 0;
+
+  ReconnectIO(SourceFactory open_source, int64_t timeout_us);
+
+  // @return true if the source should be reopened after |error|.
+  bool CanRetry(int error);
+
+  // reopen the source at |position_| after |error|.
+  int Reconnect(int error);
+};
+
+#endif  // FFPLAYER_RECONNECT_IO_H
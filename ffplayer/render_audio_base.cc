@@ -24,8 +24,9 @@ void AudioRenderBase::Init(const std::shared_ptr<PacketQueue>& audio_queue,
                            std::shared_ptr<MediaClock> clock_ctx,
                            std::shared_ptr<MessageContext> message_context) {
   clock_ctx_ = std::move(clock_ctx);
-  sample_queue = std::make_unique<FrameQueue>();
-  sample_queue->Init(audio_queue.get(), SAMPLE_QUEUE_SIZE, 1);
+  sample_queue = std::make_unique<SampleQueue>();
+  sample_queue->Init(audio_queue.get(), 1);
+  sample_queue->SetLimits(buffer_duration_ms_, 0);
   message_context_ = std::move(message_context);
 }
 
@@ -82,26 +83,53 @@ int AudioRenderBase::PushFrame(AVFrame* frame, int pkt_serial) {
   af->pos = frame->pkt_pos;
   af->serial = pkt_serial;
   af->duration = frame->nb_samples / (double)frame->sample_rate;
-  av_frame_move_ref(af->frame, frame);
+  av_frame_move_ref(af->frame.get(), frame);
   sample_queue->Push();
   return 0;
 }
 
+void AudioRenderBase::SetBufferLimits(int64_t duration_ms, int64_t max_bytes) {
+  if (duration_ms <= 0 && max_bytes <= 0) {
+    // the queue would be bounded by slots only.
+    duration_ms = kDefaultBufferDurationMs;
+  }
+  buffer_duration_ms_ = duration_ms;
+  buffer_max_bytes_ = max_bytes;
+  sample_queue->SetLimits(duration_ms, max_bytes);
+}
+
+double AudioRenderBase::GetBufferedDurationMs() const {
+  return sample_queue->PendingDurationMs() + pending_buf_us_ / 1000.0;
+}
+
+bool AudioRenderBase::IsBufferedEnough() const {
+  if (sample_queue->IsFull()) {
+    return true;
+  }
+  // only the limits that are set count, a byte cap alone leaves the duration
+  // unbounded.
+  return (buffer_duration_ms_ > 0 &&
+          GetBufferedDurationMs() >= buffer_duration_ms_ / 2.0) ||
+         (buffer_max_bytes_ > 0 &&
+          sample_queue->QueuedBytes() >= buffer_max_bytes_ / 2);
+}
+
 int AudioRenderBase::AudioDecodeFrame() {
   if (paused_) {
     return -1;
   }
-  Frame* af;
+  AudioFrame* af;
   int resampled_data_size;
   do {
     if (OnBeforeDecodeFrame() < 0) {
       return -1;
     }
-    if (!(af = sample_queue->PeekReadable())) {
+    if (!(af = sample_queue->TryPeekReadable())) {
       return -1;
     }
     sample_queue->Next();
-  } while (af->serial != *audio_queue_serial);
+  } while (af->serial !=
+           audio_queue_serial->load(std::memory_order_acquire));
 
   auto data_size = av_samples_get_buffer_size(
       nullptr, (int)af->frame->channel_layout, af->frame->nb_samples,
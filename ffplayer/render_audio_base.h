@@ -5,6 +5,8 @@
 #ifndef ANDROID_RENDER_AUDIO_BASE_H
 #define ANDROID_RENDER_AUDIO_BASE_H
 
+#include <atomic>
+
 #include "ffp_frame_queue.h"
 #include "ffp_msg_queue.h"
 #include "media_clock.h"
@@ -23,6 +25,9 @@ struct AudioParams {
 };
 
 class AudioRenderBase : public BaseRender {
+ public:
+  static const int kDefaultBufferDurationMs = 200;
+
  protected:
   int audio_hw_buf_size = 0;
   uint8_t* audio_buf = nullptr;
@@ -39,6 +44,9 @@ class AudioRenderBase : public BaseRender {
   struct SwrContext* swr_ctx = nullptr;
 
   int audio_write_buf_size = 0;
+  // duration of the decoded audio in |audio_buf| not written to the device
+  // yet, in microseconds. updated by the audio thread, read by the player.
+  std::atomic<int64_t> pending_buf_us_{0};
   int audio_buf_size = 0;
   int audio_buf_index = 0;
 
@@ -51,12 +59,15 @@ class AudioRenderBase : public BaseRender {
   std::shared_ptr<MediaClock> clock_ctx_;
   std::shared_ptr<MessageContext> message_context_;
 
-  std::unique_ptr<FrameQueue> sample_queue;
+  std::unique_ptr<SampleQueue> sample_queue;
+
+  int64_t buffer_duration_ms_ = kDefaultBufferDurationMs;
+  int64_t buffer_max_bytes_ = 0;
 
   bool paused_ = false;
 
  public:
-  int* audio_queue_serial = nullptr;
+  const std::atomic<int>* audio_queue_serial = nullptr;
 
  protected:
   /**
@@ -91,6 +102,29 @@ class AudioRenderBase : public BaseRender {
 
   int PushFrame(AVFrame* frame, int pkt_serial);
 
+  /**
+   * Bound the decoded audio kept ahead of the audio device.
+   *
+   * @param duration_ms max duration of decoded audio, 0 for no limit.
+   * @param max_bytes max bytes of decoded audio, 0 for no limit.
+   */
+  void SetBufferLimits(int64_t duration_ms, int64_t max_bytes);
+
+  /**
+   * @return milliseconds of decoded audio not played yet, including what is
+   * left of the frame being played.
+   */
+  double GetBufferedDurationMs() const;
+
+  /**
+   * @return true if enough audio is decoded to leave buffering, that is half
+   * of the buffer duration or bytes limit, or a full buffer.
+   */
+  bool IsBufferedEnough() const;
+
+  /** @return bytes of decoded audio held by the render. */
+  int64_t GetQueuedBytes() const { return sample_queue->QueuedBytes(); }
+
   void Abort() override;
 
   virtual bool IsMute() const = 0;
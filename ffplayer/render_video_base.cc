@@ -27,7 +27,7 @@
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
 
 VideoRenderBase::VideoRenderBase() {
-  picture_queue = std::make_unique<FrameQueue>();
+  picture_queue = std::make_unique<PictureQueue>();
 }
 
 void VideoRenderBase::Init(const std::shared_ptr<PacketQueue> &video_queue,
@@ -35,12 +35,12 @@ void VideoRenderBase::Init(const std::shared_ptr<PacketQueue> &video_queue,
                            std::shared_ptr<MessageContext> msg_ctx) {
   clock_context = std::move(clock_ctx);
   msg_ctx_ = std::move(msg_ctx);
-  picture_queue->Init(video_queue.get(), VIDEO_PICTURE_QUEUE_SIZE, 1);
+  picture_queue->Init(video_queue.get(), 1);
 }
 
 VideoRenderBase::~VideoRenderBase() = default;
 
-double VideoRenderBase::VideoPictureDuration(Frame *vp, Frame *next_vp) const {
+double VideoRenderBase::VideoPictureDuration(VideoFrame *vp, VideoFrame *next_vp) const {
   if (vp->serial == next_vp->serial) {
     double duration = next_vp->pts - vp->pts;
     if (isnan(duration) || duration <= 0 || duration > max_frame_duration) {
@@ -124,7 +124,7 @@ int VideoRenderBase::PushFrame(AVFrame *src_frame, double pts, double duration,
     msg_ctx_->NotifyMsg(FFP_MSG_VIDEO_FRAME_LOADED, vp->width, vp->height);
   }
 
-  av_frame_move_ref(vp->frame, src_frame);
+  av_frame_move_ref(vp->frame.get(), src_frame);
   picture_queue->Push();
   return 0;
 }
@@ -143,6 +143,13 @@ double VideoRenderBase::DrawFrame() {
   double remaining_time = REFRESH_RATE;
 
   if (paused_ && !force_refresh_) {
+    // pictures of an old serial, such as after the buffers were trimmed,
+    // would hold their memory until playback resumes.
+    auto serial = picture_queue->pktq->serial.load(std::memory_order_acquire);
+    while (picture_queue->NbRemaining() > 0 &&
+           picture_queue->Peek()->serial != serial) {
+      picture_queue->Next();
+    }
     NotifyRenderProceed();
     return remaining_time;
   }
@@ -161,7 +168,8 @@ double VideoRenderBase::DrawFrame() {
     double last_duration, duration, delay, time;
     auto last_vp = picture_queue->PeekLast();
     auto vp = picture_queue->Peek();
-    if (vp->serial != picture_queue->queue->serial) {
+    if (vp->serial !=
+        picture_queue->pktq->serial.load(std::memory_order_acquire)) {
       picture_queue->Next();
       goto retry;
     }
@@ -190,13 +198,10 @@ double VideoRenderBase::DrawFrame() {
       frame_timer = time;
     }
 
-    {
-      std::lock_guard<std::recursive_mutex> lock(picture_queue->mutex);
-      if (!isnan(vp->pts)) {
-        // update_video_pts
-        clock_context->GetVideoClock()->SetClock(vp->pts, vp->serial);
-        clock_context->GetExtClock()->Sync(clock_context->GetVideoClock());
-      }
+    if (!isnan(vp->pts)) {
+      // update_video_pts
+      clock_context->GetVideoClock()->SetClock(vp->pts, vp->serial);
+      clock_context->GetExtClock()->Sync(clock_context->GetVideoClock());
     }
 
     if (picture_queue->NbRemaining() > 1) {
@@ -255,7 +260,7 @@ void VideoRenderBase::Stop() {
 }
 
 void VideoRenderBase::DumpDebugInformation() {
-  av_log(nullptr, AV_LOG_INFO, "video_render, frame: %d/%d.\n", picture_queue->NbRemaining(), picture_queue->max_size);
+  av_log(nullptr, AV_LOG_INFO, "video_render, frame: %d/%d.\n", picture_queue->NbRemaining(), PictureQueue::max_size);
 }
 
 static void check_external_clock_speed() {
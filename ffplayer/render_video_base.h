@@ -39,7 +39,7 @@ class VideoRenderBase : public BaseRender {
  private:
 
   // Compute the duration in vp and next_vp.
-  double VideoPictureDuration(Frame *vp, Frame *next_vp) const;
+  double VideoPictureDuration(VideoFrame *vp, VideoFrame *next_vp) const;
 
   // Compute target frame display delay. For Clock Sync.
   double ComputeTargetDelay(double delay) const;
@@ -48,13 +48,13 @@ class VideoRenderBase : public BaseRender {
   bool ShouldDropFrames() const;
 
  protected:
-  std::unique_ptr<FrameQueue> picture_queue;
+  std::unique_ptr<PictureQueue> picture_queue;
   int framedrop = -1;
 
   std::shared_ptr<MediaClock> clock_context;
   std::shared_ptr<MessageContext> msg_ctx_;
 
-  virtual void RenderPicture(Frame &frame) = 0;
+  virtual void RenderPicture(VideoFrame &frame) = 0;
 
  public:
 
@@ -91,6 +91,9 @@ class VideoRenderBase : public BaseRender {
 
   bool IsReady() override;
 
+  /** @return bytes of decoded pictures held by the render. */
+  int64_t GetQueuedBytes() const { return picture_queue->QueuedBytes(); }
+
   void Start();
 
   void Stop();
@@ -0,0 +1,304 @@
+//
+// Created by boyan on 2021/3/13.
+//
+
+#include "segmented_io.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+#include "ffp_utils.h"
+#include "http_io.h"
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/dict.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define SEGMENT_SIZE (1024 * 1024)
+
+/* bytes read by a worker between checks that its segment is still wanted */
+#define FETCH_CHUNK_SIZE (64 * 1024)
+
+/* files smaller than this many segments are fetched with one connection */
+#define MIN_SEGMENT_COUNT 4
+
+/* segments kept from the read position on, at least two per connection */
+#define WINDOW_SEGMENTS 8
+
+std::unique_ptr<MediaIO> SegmentedIO::Open(const char* url,
+                                           const AVIOInterruptCB* interrupt_cb,
+                                           const AVDictionary* options,
+                                           int connections) {
+  bool seekable = false;
+  // requests of a segment each, seeking to another one keeps a pooled
+  // connection open.
+  auto io = http_io_open(url, interrupt_cb, SEGMENT_SIZE, options, &seekable);
+  if (!io) {
+    return nullptr;
+  }
+  auto size = io->Seek(0, AVSEEK_SIZE);
+  if (connections <= 1 || size < MIN_SEGMENT_COUNT * SEGMENT_SIZE ||
+      !seekable) {
+    av_log(nullptr, AV_LOG_INFO,
+           "segmented io: %s is fetched with one connection.\n", url);
+    return io;
+  }
+  std::unique_ptr<SegmentedIO> segmented(
+      new SegmentedIO(url, interrupt_cb, options, size, connections));
+  // the connection opened above fetches too, the others open on demand.
+  segmented->workers_.emplace_back(&SegmentedIO::WorkerThread,
+                                   segmented.get(), std::move(io));
+  for (int i = 1; i < connections; i++) {
+    segmented->workers_.emplace_back(&SegmentedIO::WorkerThread,
+                                     segmented.get(), nullptr);
+  }
+  av_log(nullptr, AV_LOG_INFO,
+         "segmented io: %s, %" PRId64 " bytes over %d connections.\n", url,
+         size, connections);
+  return segmented;
+}
+
+SegmentedIO::SegmentedIO(const char* url,
+                         const AVIOInterruptCB* interrupt_cb,
+                         const AVDictionary* options,
+                         int64_t size,
+                         int connections)
+    : url_(url),
+      size_(size),
+      segment_count_((size + SEGMENT_SIZE - 1) / SEGMENT_SIZE),
+      window_segments_(FFMAX(WINDOW_SEGMENTS, 2 * connections)),
+      open_time_(av_gettime_relative()) {
+  if (interrupt_cb) {
+    interrupt_cb_ = *interrupt_cb;
+  }
+  av_dict_copy(&options_, options, 0);
+}
+
+SegmentedIO::~SegmentedIO() {
+  Abort();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  av_dict_free(&options_);
+  auto seconds = (double)(av_gettime_relative() - open_time_) / 1000000;
+  av_log(nullptr, AV_LOG_INFO,
+         "segmented io: fetched %" PRId64 " bytes in %d segments over "
+         "%.1f s, %.2f MB/s while fetching, %d segments dropped by seeks, "
+         "read waited %.1f ms.\n",
+         bytes_fetched_, segments_fetched_, seconds,
+         fetch_time_ ? bytes_fetched_ / (fetch_time_ / 1000000.0) / 1048576
+                     : 0.0,
+         segments_dropped_, read_wait_time_ / 1000.0);
+}
+
+void SegmentedIO::WorkerThread(std::unique_ptr<MediaIO> io) {
+  update_thread_name("segment_fetch");
+  // unknown after an error, the next segment seeks.
+  int64_t io_position = io ? 0 : -1;
+  if (io) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(io.get());
+  }
+  for (;;) {
+    int64_t index = -1;
+    std::shared_ptr<Segment> segment;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [&]() {
+        return abort_ || (index = PickSegment()) >= 0;
+      });
+      if (abort_) {
+        break;
+      }
+      segment = segments_[index];
+    }
+    if (!io) {
+      io = http_io_open(url_.c_str(), &interrupt_cb_, SEGMENT_SIZE, options_,
+                        nullptr);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!io || abort_) {
+        // leave the segment to the other workers.
+        auto it = segments_.find(index);
+        if (it != segments_.end() && it->second == segment) {
+          segments_.erase(it);
+        }
+        cond_.notify_all();
+        if (!io) {
+          av_log(nullptr, AV_LOG_WARNING,
+                 "segmented io: can not open another connection.\n");
+        }
+        return;
+      }
+      connections_.push_back(io.get());
+    }
+    Fetch(io.get(), &io_position, index, segment);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  connections_.erase(
+      std::remove(connections_.begin(), connections_.end(), io.get()),
+      connections_.end());
+}
+
+void SegmentedIO::Fetch(MediaIO* io,
+                        int64_t* io_position,
+                        int64_t index,
+                        const std::shared_ptr<Segment>& segment) {
+  auto fetch_start = av_gettime_relative();
+  auto start = index * SEGMENT_SIZE;
+  auto capacity = (int)FFMIN((int64_t)SEGMENT_SIZE, size_ - start);
+  segment->data.resize(capacity);
+
+  int ret = 0;
+  if (*io_position != start) {
+    // a range request, unless the connection is already there.
+    auto seek_ret = io->Seek(start, SEEK_SET);
+    if (seek_ret < 0) {
+      ret = (int)seek_ret;
+    }
+    *io_position = seek_ret < 0 ? -1 : start;
+  }
+  int filled = 0;
+  while (ret >= 0 && filled < capacity) {
+    ret = io->Read(segment->data.data() + filled,
+                   FFMIN(FETCH_CHUNK_SIZE, capacity - filled));
+    if (ret <= 0) {
+      // the file is shorter than announced.
+      ret = ret ? ret : AVERROR_EOF;
+      *io_position = -1;
+      break;
+    }
+    *io_position += ret;
+    filled += ret;
+    std::lock_guard<std::mutex> lock(mutex_);
+    segment->filled = filled;
+    bytes_fetched_ += ret;
+    cond_.notify_all();
+    auto it = segments_.find(index);
+    if (it == segments_.end() || it->second != segment) {
+      // dropped by a seek, fetch what is wanted now.
+      segments_dropped_++;
+      fetch_time_ += av_gettime_relative() - fetch_start;
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ret < 0) {
+    segment->error = ret;
+  } else {
+    segments_fetched_++;
+  }
+  fetch_time_ += av_gettime_relative() - fetch_start;
+  cond_.notify_all();
+}
+
+int64_t SegmentedIO::PickSegment() {
+  auto first = position_ / SEGMENT_SIZE;
+  auto last = FFMIN(first + window_segments_, segment_count_);
+  for (auto index = first; index < last; index++) {
+    if (!segments_.count(index)) {
+      segments_[index] = std::make_shared<Segment>();
+      return index;
+    }
+  }
+  return -1;
+}
+
+void SegmentedIO::DropSegments() {
+  auto first = position_ / SEGMENT_SIZE;
+  for (auto it = segments_.begin(); it != segments_.end();) {
+    if (it->first < first || it->first >= first + window_segments_) {
+      it = segments_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int SegmentedIO::Read(uint8_t* buf, int size) {
+  std::shared_ptr<Segment> segment;
+  int offset, bytes;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (abort_) {
+      return AVERROR_EXIT;
+    }
+    if (position_ >= size_) {
+      return AVERROR_EOF;
+    }
+    auto index = position_ / SEGMENT_SIZE;
+    offset = (int)(position_ % SEGMENT_SIZE);
+    auto wait_start = av_gettime_relative();
+    cond_.wait(lock, [&]() {
+      if (abort_) {
+        return true;
+      }
+      auto it = segments_.find(index);
+      return it != segments_.end() &&
+             (it->second->filled > offset || it->second->error);
+    });
+    read_wait_time_ += av_gettime_relative() - wait_start;
+    if (abort_) {
+      return AVERROR_EXIT;
+    }
+    segment = segments_[index];
+    if (segment->filled <= offset) {
+      // fetched again on the next read.
+      segments_.erase(index);
+      cond_.notify_all();
+      return segment->error;
+    }
+    bytes = FFMIN(size, segment->filled - offset);
+  }
+  // bytes below |filled| are never written again.
+  memcpy(buf, segment->data.data() + offset, bytes);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  position_ += bytes;
+  if (position_ % SEGMENT_SIZE == 0) {
+    // the window moved, the workers can go further.
+    DropSegments();
+    cond_.notify_all();
+  }
+  return bytes;
+}
+
+int64_t SegmentedIO::Seek(int64_t offset, int whence) {
+  whence &= ~AVSEEK_FORCE;
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t target;
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return size_;
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position_ + offset;
+      break;
+    case SEEK_END:
+      target = size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  position_ = target;
+  DropSegments();
+  cond_.notify_all();
+  return target;
+}
+
+void SegmentedIO::Abort() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  abort_ = true;
+  for (auto* connection : connections_) {
+    connection->Abort();
+  }
+  cond_.notify_all();
+}
@@ -0,0 +1,106 @@
+//
+// Created by boyan on 2021/3/13.
+//
+
+#ifndef FFPLAYER_SEGMENTED_IO_H
+#define FFPLAYER_SEGMENTED_IO_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "media_io.h"
+
+/**
+ * Fetches a remote file over several connections at once, so that startup
+ * and seeks do not wait on the slow start of a single one.
+ *
+ * The file is split into segments fetched with range requests by a few
+ * worker threads, each with its own connection, and read back in order.
+ * Workers always take the first missing segment from the read position, so
+ * the segment being played comes first and the following ones are
+ * prefetched by the idle workers, up to a window ahead.
+ */
+class SegmentedIO : public MediaIO {
+ public:
+  /**
+   * @param interrupt_cb checked by blocking protocol calls, can be null.
+   * @param options of the http protocol, see http_io_open(). Can be null.
+   * @param connections connections to fetch with.
+   * @return a single connection if the server does not support ranges, or
+   * the file is too small to be worth it. Null if |url| can not be opened.
+   */
+  static std::unique_ptr<MediaIO> Open(const char* url,
+                                       const AVIOInterruptCB* interrupt_cb,
+                                       const AVDictionary* options,
+                                       int connections);
+
+  ~SegmentedIO() override;
+
+  int Read(uint8_t* buf, int size) override;
+
+  int64_t Seek(int64_t offset, int whence) override;
+
+  void Abort() override;
+
+ private:
+  struct Segment {
+    std::vector<uint8_t> data;
+    // bytes of |data| fetched, readable without the lock below it.
+    int filled = 0;
+    // negative AVERROR if the segment could not be fetched.
+    int error = 0;
+  };
+
+  std::string url_;
+  AVIOInterruptCB interrupt_cb_{nullptr, nullptr};
+  AVDictionary* options_ = nullptr;
+  int64_t size_;
+  int64_t segment_count_;
+  int64_t window_segments_;
+
+  std::mutex mutex_;
+  // signaled when a segment is filled, the position moves or on abort.
+  std::condition_variable cond_;
+  std::vector<std::thread> workers_;
+  // connections of the workers, for Abort().
+  std::vector<MediaIO*> connections_;
+  // segments in the window, fetched or being fetched, by index.
+  std::map<int64_t, std::shared_ptr<Segment>> segments_;
+  int64_t position_ = 0;
+  bool abort_ = false;
+
+  // statistic.
+  int64_t bytes_fetched_ = 0;
+  int64_t fetch_time_ = 0;
+  int64_t read_wait_time_ = 0;
+  int segments_fetched_ = 0;
+  int segments_dropped_ = 0;
+  int64_t open_time_;
+
+  SegmentedIO(const char* url,
+              const AVIOInterruptCB* interrupt_cb,
+              const AVDictionary* options,
+              int64_t size,
+              int connections);
+
+  void WorkerThread(std::unique_ptr<MediaIO> io);
+
+  // fetch segment |index| through |io| positioned at |*io_position|.
+  void Fetch(MediaIO* io,
+             int64_t* io_position,
+             int64_t index,
+             const std::shared_ptr<Segment>& segment);
+
+  // must be called with |mutex_| held, -1 if nothing is left to fetch.
+  int64_t PickSegment();
+
+  // must be called with |mutex_| held, drops segments out of the window.
+  void DropSegments();
+};
+
+#endif  // FFPLAYER_SEGMENTED_IO_H
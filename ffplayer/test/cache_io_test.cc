@@ -0,0 +1,169 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache_io.h"
+#include "media_cache.h"
+#include "test_util.h"
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+#define CONTENT_SIZE (1024 * 1024 + 123)
+#define READ_SIZE (32 * 1024)
+
+/**
+ * In-memory source standing in for the network, counts how often it is
+ * opened.
+ */
+class FakeSource : public MediaIO {
+ public:
+  FakeSource(const std::vector<uint8_t>* content, bool known_size)
+      : content_(content), known_size_(known_size) {}
+
+  int Read(uint8_t* buf, int size) override {
+    if (position_ >= (int64_t)content_->size()) {
+      return AVERROR_EOF;
+    }
+    auto bytes =
+        (int)std::min((int64_t)size, (int64_t)content_->size() - position_);
+    memcpy(buf, content_->data() + position_, bytes);
+    position_ += bytes;
+    return bytes;
+  }
+
+  int64_t Seek(int64_t offset, int whence) override {
+    switch (whence & ~AVSEEK_FORCE) {
+      case AVSEEK_SIZE:
+        return known_size_ ? (int64_t)content_->size() : AVERROR(ENOSYS);
+      case SEEK_SET:
+        position_ = offset;
+        return position_;
+      default:
+        return AVERROR(ENOSYS);
+    }
+  }
+
+  void Abort() override {}
+
+ private:
+  const std::vector<uint8_t>* content_;
+  bool known_size_;
+  int64_t position_ = 0;
+};
+
+static std::vector<uint8_t> make_content() {
+  std::vector<uint8_t> content(CONTENT_SIZE);
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = (uint8_t)(i * 13 + i / 251);
+  }
+  return content;
+}
+
+// an url cached by no earlier run, the manifest outlives the test.
+static std::string make_url(const char* name) {
+  return "http://cache-io-test/" + std::to_string(av_gettime()) + "/" + name;
+}
+
+static std::vector<uint8_t> read_all(MediaIO* io) {
+  std::vector<uint8_t> bytes;
+  uint8_t buf[READ_SIZE];
+  int ret;
+  while ((ret = io->Read(buf, READ_SIZE)) > 0) {
+    bytes.insert(bytes.end(), buf, buf + ret);
+  }
+  EXPECT_EQ(AVERROR_EOF, ret);
+  return bytes;
+}
+
+static void test_sized_source() {
+  auto content = make_content();
+  auto url = make_url("sized");
+  int opens = 0;
+  auto open_source = [&content, &opens]() -> std::unique_ptr<MediaIO> {
+    opens++;
+    return std::unique_ptr<MediaIO>(new FakeSource(&content, true));
+  };
+
+  std::unique_ptr<MediaIO> uncached_source;
+  auto io = CacheIO::Create(url.c_str(), open_source, &uncached_source);
+  EXPECT_TRUE(io != nullptr);
+  EXPECT_TRUE(uncached_source == nullptr);
+  if (!io) {
+    return;
+  }
+  EXPECT_EQ(1, opens);
+  EXPECT_EQ(content.size(), io->Seek(0, AVSEEK_SIZE));
+  // the second half first, the first half is then fetched up to it.
+  EXPECT_EQ(CONTENT_SIZE / 2, io->Seek(CONTENT_SIZE / 2, SEEK_SET));
+  auto tail = read_all(io.get());
+  EXPECT_EQ(0, io->Seek(0, SEEK_SET));
+  EXPECT_TRUE(read_all(io.get()) == content);
+  EXPECT_TRUE(std::equal(tail.begin(), tail.end(),
+                         content.begin() + CONTENT_SIZE / 2));
+  EXPECT_EQ(1, opens);
+  EXPECT_EQ(content.size(), io->GetCachedBytes());
+  io.reset();
+
+  // fully cached, the source is not opened again.
+  io = CacheIO::Create(url.c_str(), open_source, &uncached_source);
+  EXPECT_TRUE(io != nullptr);
+  if (!io) {
+    return;
+  }
+  EXPECT_TRUE(read_all(io.get()) == content);
+  EXPECT_EQ(1, opens);
+}
+
+static void test_unsized_source() {
+  auto content = make_content();
+  auto url = make_url("unsized");
+  int opens = 0;
+  MediaIO* opened = nullptr;
+  auto open_source = [&]() -> std::unique_ptr<MediaIO> {
+    opens++;
+    opened = new FakeSource(&content, false);
+    return std::unique_ptr<MediaIO>(opened);
+  };
+
+  std::unique_ptr<MediaIO> uncached_source;
+  auto io = CacheIO::Create(url.c_str(), open_source, &uncached_source);
+  EXPECT_TRUE(io == nullptr);
+  EXPECT_EQ(1, opens);
+  // the opened source is handed back, not closed.
+  EXPECT_TRUE(uncached_source != nullptr);
+  EXPECT_TRUE(uncached_source.get() == opened);
+  if (uncached_source) {
+    EXPECT_TRUE(read_all(uncached_source.get()) == content);
+  }
+}
+
+static void test_failed_source() {
+  auto url = make_url("failed");
+  int opens = 0;
+  auto open_source = [&opens]() -> std::unique_ptr<MediaIO> {
+    opens++;
+    return nullptr;
+  };
+  std::unique_ptr<MediaIO> uncached_source;
+  auto io = CacheIO::Create(url.c_str(), open_source, &uncached_source);
+  EXPECT_TRUE(io == nullptr);
+  EXPECT_TRUE(uncached_source == nullptr);
+  EXPECT_EQ(1, opens);
+}
+
+int main() {
+  // ctest runs the test in its build directory.
+  MediaCache::Get()->SetDirectory(".", 0);
+  test_sized_source();
+  test_unsized_source();
+  test_failed_source();
+  return TestResult("cache io");
+}
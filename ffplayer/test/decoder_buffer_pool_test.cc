@@ -0,0 +1,205 @@
+//
+// Created by boyan on 2021/2/14.
+//
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#include "decoder_buffer_pool.h"
+#include "test_util.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+}
+
+#define WIDTH 320
+#define HEIGHT 240
+#define FRAME_COUNT 60
+#define GOP_SIZE 12
+
+// frames decoded before the pools reach their size.
+#define WARM_UP_FRAMES 10
+
+// frames the render holds before unref'ing them, as the frame queue does.
+#define HELD_FRAMES 3
+
+struct DecodeResult {
+  int frames = 0;
+  // of the visible pixels of every frame, to compare both allocators.
+  uint32_t checksum = 0;
+  int64_t requests = 0;
+  int64_t allocations_after_warm_up = -1;
+  int64_t allocations = 0;
+};
+
+// a clip with moving gradients, so that frames differ.
+static std::vector<AVPacket*> encode_clip(AVCodecID codec_id) {
+  std::vector<AVPacket*> packets;
+  auto* codec = avcodec_find_encoder(codec_id);
+  if (!codec) {
+    return packets;
+  }
+  auto* codec_ctx = avcodec_alloc_context3(codec);
+  auto* frame = av_frame_alloc();
+  codec_ctx->width = WIDTH;
+  codec_ctx->height = HEIGHT;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec_ctx->time_base = {1, 25};
+  codec_ctx->gop_size = GOP_SIZE;
+  codec_ctx->max_b_frames = 2;
+  frame->width = WIDTH;
+  frame->height = HEIGHT;
+  frame->format = AV_PIX_FMT_YUV420P;
+  if (avcodec_open2(codec_ctx, codec, nullptr) < 0 ||
+      av_frame_get_buffer(frame, 0) < 0) {
+    av_frame_free(&frame);
+    avcodec_free_context(&codec_ctx);
+    return packets;
+  }
+
+  auto receive_packets = [&]() {
+    auto* pkt = av_packet_alloc();
+    while (avcodec_receive_packet(codec_ctx, pkt) >= 0) {
+      packets.push_back(pkt);
+      pkt = av_packet_alloc();
+    }
+    av_packet_free(&pkt);
+  };
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    av_frame_make_writable(frame);
+    for (int plane = 0; plane < 3; plane++) {
+      auto height = plane ? HEIGHT / 2 : HEIGHT;
+      auto width = plane ? WIDTH / 2 : WIDTH;
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+          frame->data[plane][y * frame->linesize[plane] + x] =
+              (uint8_t)(x + y * (plane + 1) + i * 3);
+        }
+      }
+    }
+    frame->pts = i;
+    if (avcodec_send_frame(codec_ctx, frame) >= 0) {
+      receive_packets();
+    }
+  }
+  avcodec_send_frame(codec_ctx, nullptr);
+  receive_packets();
+  av_frame_free(&frame);
+  avcodec_free_context(&codec_ctx);
+  return packets;
+}
+
+static uint32_t checksum_frame(uint32_t checksum, const AVFrame* frame) {
+  for (int plane = 0; plane < 3; plane++) {
+    auto height = plane ? frame->height / 2 : frame->height;
+    auto width = plane ? frame->width / 2 : frame->width;
+    for (int y = 0; y < height; y++) {
+      const uint8_t* line = frame->data[plane] + y * frame->linesize[plane];
+      for (int x = 0; x < width; x++) {
+        checksum = checksum * 31 + line[x];
+      }
+    }
+  }
+  return checksum;
+}
+
+/**
+ * Decode |packets| as the decoder thread does, the render unref'ing the
+ * frames |HELD_FRAMES| frames later.
+ *
+ * @param install decode into a DecoderBufferPool.
+ */
+static DecodeResult decode_clip(AVCodecID codec_id,
+                                const std::vector<AVPacket*>& packets,
+                                bool install) {
+  DecodeResult result;
+  auto* codec = avcodec_find_decoder(codec_id);
+  auto* codec_ctx = avcodec_alloc_context3(codec);
+  if (install) {
+    DecoderBufferPool::Install(codec_ctx, codec);
+    EXPECT_TRUE(DecoderBufferPool::Get(codec_ctx) != nullptr);
+  }
+  auto ret = avcodec_open2(codec_ctx, codec, nullptr);
+  EXPECT_EQ(0, ret);
+  if (ret < 0) {
+    DecoderBufferPool::FreeContext(&codec_ctx);
+    return result;
+  }
+
+  std::deque<AVFrame*> held;
+  auto receive_frames = [&]() {
+    auto* frame = av_frame_alloc();
+    while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
+      result.checksum = checksum_frame(result.checksum, frame);
+      if (++result.frames == WARM_UP_FRAMES) {
+        auto* pool = DecoderBufferPool::Get(codec_ctx);
+        if (pool) {
+          result.allocations_after_warm_up = pool->GetBufferAllocations();
+        }
+      }
+      held.push_back(frame);
+      frame = av_frame_alloc();
+      if (held.size() > HELD_FRAMES) {
+        av_frame_free(&held.front());
+        held.pop_front();
+      }
+    }
+    av_frame_free(&frame);
+  };
+  for (auto* pkt : packets) {
+    if (avcodec_send_packet(codec_ctx, pkt) >= 0) {
+      receive_frames();
+    }
+  }
+  avcodec_send_packet(codec_ctx, nullptr);
+  receive_frames();
+
+  auto* pool = DecoderBufferPool::Get(codec_ctx);
+  if (pool) {
+    result.requests = pool->GetBufferRequests();
+    result.allocations = pool->GetBufferAllocations();
+  }
+  for (auto* frame : held) {
+    av_frame_free(&frame);
+  }
+  DecoderBufferPool::FreeContext(&codec_ctx);
+  return result;
+}
+
+static void test_codec(AVCodecID codec_id) {
+  if (!avcodec_find_decoder(codec_id)) {
+    printf("%s: no decoder, skipped.\n", avcodec_get_name(codec_id));
+    return;
+  }
+  auto packets = encode_clip(codec_id);
+  if (packets.empty()) {
+    printf("%s: no encoder, skipped.\n", avcodec_get_name(codec_id));
+    return;
+  }
+
+  auto pooled = decode_clip(codec_id, packets, true);
+  auto unpooled = decode_clip(codec_id, packets, false);
+  EXPECT_EQ(FRAME_COUNT, pooled.frames);
+  EXPECT_EQ(FRAME_COUNT, unpooled.frames);
+  // the pools do not change what is decoded.
+  EXPECT_EQ(unpooled.checksum, pooled.checksum);
+
+  EXPECT_TRUE(pooled.requests >= FRAME_COUNT);
+  EXPECT_TRUE(pooled.allocations_after_warm_up > 0);
+  // every buffer after the warm-up is reused.
+  EXPECT_EQ(pooled.allocations_after_warm_up, pooled.allocations);
+  printf("%s: %" PRId64 " buffers requested, %" PRId64 " allocated.\n",
+         avcodec_get_name(codec_id), pooled.requests, pooled.allocations);
+
+  for (auto* pkt : packets) {
+    av_packet_free(&pkt);
+  }
+}
+
+int main() {
+  test_codec(AV_CODEC_ID_MPEG4);
+  test_codec(AV_CODEC_ID_MPEG2VIDEO);
+  return TestResult("decoder buffer pool");
+}
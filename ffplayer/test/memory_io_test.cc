@@ -0,0 +1,115 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "media_io.h"
+#include "memory_io.h"
+#include "test_util.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavutil/dict.h"
+}
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define DURATION_SECONDS 3
+#define CHUNK_SIZE (64 * 1024)
+
+static std::vector<uint8_t> make_pcm() {
+  std::vector<uint8_t> pcm((size_t)SAMPLE_RATE * CHANNELS * 2 *
+                           DURATION_SECONDS);
+  for (size_t i = 0; i < pcm.size(); i++) {
+    pcm[i] = (uint8_t)(i * 7);
+  }
+  return pcm;
+}
+
+/**
+ * Demux |source| to the end through MemoryIO, as a player does.
+ *
+ * @param bytes_copied set to the bytes MemoryIO copied out of |source|.
+ * @return bytes of the packets demuxed, negative on error.
+ */
+static int64_t play(const std::shared_ptr<MemorySource>& source,
+                    int64_t* bytes_copied) {
+  auto* format_ctx = avformat_alloc_context();
+  auto* io_ctx = CreateAVIOContext(
+      std::unique_ptr<MediaIO>(new MemoryIO(source)));
+  if (!format_ctx || !io_ctx) {
+    avformat_free_context(format_ctx);
+    FreeAVIOContext(&io_ctx);
+    return AVERROR(ENOMEM);
+  }
+  format_ctx->pb = io_ctx;
+  format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  AVDictionary* options = nullptr;
+  av_dict_set_int(&options, "sample_rate", SAMPLE_RATE, 0);
+  av_dict_set_int(&options, "channels", CHANNELS, 0);
+  auto ret = avformat_open_input(&format_ctx, nullptr,
+                                 av_find_input_format("s16le"), &options);
+  av_dict_free(&options);
+  if (ret < 0) {
+    FreeAVIOContext(&io_ctx);
+    return ret;
+  }
+  int64_t packet_bytes = 0;
+  AVPacket packet;
+  while ((ret = av_read_frame(format_ctx, &packet)) >= 0) {
+    packet_bytes += packet.size;
+    av_packet_unref(&packet);
+  }
+  *bytes_copied =
+      static_cast<MemoryIO*>(GetMediaIO(io_ctx))->GetBytesRead();
+  avformat_close_input(&format_ctx);
+  FreeAVIOContext(&io_ctx);
+  return ret == AVERROR_EOF ? packet_bytes : ret;
+}
+
+static void test_single_buffer() {
+  auto pcm = make_pcm();
+  std::atomic<int> releases{0};
+  auto source = MemorySource::Create(pcm.data(), (int64_t)pcm.size(),
+                                     [&releases]() { releases++; });
+  int64_t bytes_copied = 0;
+  EXPECT_EQ(pcm.size(), play(source, &bytes_copied));
+  EXPECT_EQ(pcm.size(), bytes_copied);
+  EXPECT_EQ(0, releases);
+  source.reset();
+  EXPECT_EQ(1, releases);
+}
+
+static void test_streamed_chunks() {
+  auto pcm = make_pcm();
+  std::atomic<int> releases{0};
+  auto source = std::make_shared<MemorySource>();
+  int chunks = 0;
+  std::thread producer([&]() {
+    for (size_t offset = 0; offset < pcm.size(); offset += CHUNK_SIZE) {
+      auto size = std::min((size_t)CHUNK_SIZE, pcm.size() - offset);
+      source->Append(pcm.data() + offset, (int64_t)size,
+                     [&releases]() { releases++; });
+      chunks++;
+    }
+    source->Finish();
+  });
+  int64_t bytes_copied = 0;
+  EXPECT_EQ(pcm.size(), play(source, &bytes_copied));
+  producer.join();
+  EXPECT_EQ(pcm.size(), bytes_copied);
+  source.reset();
+  EXPECT_EQ(chunks, releases);
+}
+
+int main() {
+  test_single_buffer();
+  test_streamed_chunks();
+  return TestResult("memory io");
+}
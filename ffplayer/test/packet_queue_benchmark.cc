@@ -0,0 +1,191 @@
+//
+// Created by boyan on 2021/2/6.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ffp_packet_queue.h"
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+#define PACKET_COUNT 1000000
+
+/**
+ * The mutex guarded linked list PacketQueue was before the ring, kept as the
+ * reference: one av_malloc() per packet, one lock per put and per get.
+ */
+class LinkedPacketQueue {
+ public:
+  ~LinkedPacketQueue() {
+    while (first_) {
+      auto* next = first_->next;
+      av_packet_unref(&first_->pkt);
+      av_free(first_);
+      first_ = next;
+    }
+  }
+
+  int Put(AVPacket* pkt) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* node = (Node*)av_malloc(sizeof(Node));
+    if (!node) {
+      return -1;
+    }
+    node->pkt = *pkt;
+    node->next = nullptr;
+    node->serial = serial_;
+    if (!last_) {
+      first_ = node;
+    } else {
+      last_->next = node;
+    }
+    last_ = node;
+    nb_packets_++;
+    size_ += node->pkt.size + (int)sizeof(*node);
+    duration_ += node->pkt.duration;
+    cond_.notify_all();
+    return 0;
+  }
+
+  int Get(AVPacket* pkt, int* pkt_serial) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!first_) {
+      cond_.wait(lock);
+    }
+    auto* node = first_;
+    first_ = node->next;
+    if (!first_) {
+      last_ = nullptr;
+    }
+    nb_packets_--;
+    size_ -= node->pkt.size + (int)sizeof(*node);
+    duration_ -= node->pkt.duration;
+    *pkt = node->pkt;
+    *pkt_serial = node->serial;
+    av_free(node);
+    return 1;
+  }
+
+ private:
+  struct Node {
+    AVPacket pkt;
+    Node* next;
+    int serial;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  Node* first_ = nullptr;
+  Node* last_ = nullptr;
+  int nb_packets_ = 0;
+  int size_ = 0;
+  int64_t duration_ = 0;
+  int serial_ = 1;
+};
+
+struct BenchmarkResult {
+  double packets_per_second = 0;
+  double p50_put_ns = 0;
+  double p99_put_ns = 0;
+  int received = 0;
+};
+
+/**
+ * Put |PACKET_COUNT| packets from this thread while another one takes them.
+ *
+ * @param put puts the packet of the given index, timed.
+ * @param get takes a packet, blocking.
+ */
+template <typename Put, typename Get>
+static BenchmarkResult run(Put put, Get get) {
+  BenchmarkResult result;
+  std::vector<int64_t> put_ns(PACKET_COUNT);
+  std::thread consumer([&]() {
+    for (int i = 0; i < PACKET_COUNT; i++) {
+      if (!get()) {
+        break;
+      }
+      result.received++;
+    }
+  });
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < PACKET_COUNT; i++) {
+    auto put_start = std::chrono::steady_clock::now();
+    put(i);
+    put_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - put_start)
+                    .count();
+  }
+  consumer.join();
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::sort(put_ns.begin(), put_ns.end());
+  result.packets_per_second = PACKET_COUNT / elapsed;
+  result.p50_put_ns = (double)put_ns[PACKET_COUNT / 2];
+  result.p99_put_ns = (double)put_ns[PACKET_COUNT * 99 / 100];
+  return result;
+}
+
+static void print(const char* name, const BenchmarkResult& result) {
+  printf("%-12s %10.0f packets/s, put p50 %6.0f ns, p99 %6.0f ns\n", name,
+         result.packets_per_second, result.p50_put_ns, result.p99_put_ns);
+}
+
+int main() {
+  LinkedPacketQueue linked;
+  auto linked_result = run(
+      [&linked](int i) {
+        AVPacket pkt;
+        av_init_packet(&pkt);
+        pkt.data = nullptr;
+        pkt.size = 0;
+        pkt.pts = i;
+        pkt.duration = 1;
+        linked.Put(&pkt);
+      },
+      [&linked]() {
+        AVPacket pkt;
+        int serial;
+        linked.Get(&pkt, &serial);
+        av_packet_unref(&pkt);
+        return true;
+      });
+
+  PacketQueue ring;
+  ring.Start();
+  // the flush packet of Start().
+  Packet flush;
+  ring.Get(&flush, 1, nullptr, nullptr, nullptr);
+  auto ring_result = run(
+      [&ring](int i) {
+        Packet pkt;
+        pkt->pts = i;
+        pkt->duration = 1;
+        ring.Put(std::move(pkt));
+      },
+      [&ring]() {
+        Packet pkt;
+        int serial;
+        return ring.Get(&pkt, 1, &serial, nullptr, nullptr) > 0;
+      });
+  ring.Abort();
+
+  print("linked list", linked_result);
+  print("ring", ring_result);
+  if (linked_result.received != PACKET_COUNT ||
+      ring_result.received != PACKET_COUNT) {
+    fprintf(stderr, "packets lost: linked list %d, ring %d of %d.\n",
+            linked_result.received, ring_result.received, PACKET_COUNT);
+    return 1;
+  }
+  return 0;
+}
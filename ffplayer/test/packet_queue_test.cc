@@ -0,0 +1,227 @@
+//
+// Created by boyan on 2021/2/6.
+//
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "ffp_packet_queue.h"
+#include "test_util.h"
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+#define PACKET_DURATION 10
+#define GOP_SIZE 10
+
+/* detached packets are released on a background thread, wait that long */
+#define RELEASE_TIMEOUT_MS 5000
+
+static std::atomic<int> buffers_created{0};
+static std::atomic<int> buffers_released{0};
+
+static void release_buffer(void* opaque, uint8_t* data) {
+  av_free(data);
+  buffers_released++;
+}
+
+// a packet whose buffer release is counted.
+static Packet make_counted_packet(int index) {
+  Packet pkt;
+  auto* data = (uint8_t*)av_mallocz(16 + AV_INPUT_BUFFER_PADDING_SIZE);
+  pkt->buf = av_buffer_create(data, 16, release_buffer, nullptr, 0);
+  buffers_created++;
+  pkt->data = data;
+  pkt->size = 16;
+  pkt->pts = pkt->dts = index * PACKET_DURATION;
+  pkt->duration = PACKET_DURATION;
+  if (index % GOP_SIZE == 0) {
+    pkt->flags |= AV_PKT_FLAG_KEY;
+  }
+  return pkt;
+}
+
+// @return true once every counted buffer is released.
+static bool wait_buffers_released() {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(RELEASE_TIMEOUT_MS);
+  while (buffers_released != buffers_created) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+static Packet make_packet(int index) {
+  Packet pkt;
+  av_new_packet(pkt.get(), 16);
+  pkt->pts = pkt->dts = index * PACKET_DURATION;
+  pkt->duration = PACKET_DURATION;
+  if (index % GOP_SIZE == 0) {
+    pkt->flags |= AV_PKT_FLAG_KEY;
+  }
+  return pkt;
+}
+
+struct Received {
+  int flushes = 0;
+  std::vector<int64_t> pts;
+  std::vector<int> serials;
+};
+
+// take what is pending without blocking.
+static Received drain(PacketQueue* queue) {
+  Received received;
+  Packet pkt;
+  int serial;
+  while (queue->Get(&pkt, 0, &serial, nullptr, nullptr) > 0) {
+    if (pkt.IsFlush()) {
+      received.flushes++;
+    } else {
+      received.pts.push_back(pkt->pts);
+    }
+    received.serials.push_back(serial);
+  }
+  return received;
+}
+
+static void test_back_to_back_rewinds() {
+  PacketQueue queue;
+  queue.time_base = {1, 1000};
+  queue.SetBackBuffer(60000, 0);
+  queue.Start();
+  for (int i = 0; i < 100; i++) {
+    queue.Put(make_packet(i));
+  }
+  Packet pkt;
+  int serial;
+  // the flush of Start() and packets 0 to 49.
+  for (int i = 0; i < 51; i++) {
+    queue.Get(&pkt, 0, &serial, nullptr, nullptr);
+  }
+
+  // the second rewind comes before the decoder took the first flush.
+  EXPECT_TRUE(queue.SeekInBuffer(25 * PACKET_DURATION));
+  EXPECT_TRUE(queue.SeekInBuffer(12 * PACKET_DURATION));
+
+  auto received = drain(&queue);
+  EXPECT_EQ(1, received.flushes);
+  EXPECT_TRUE(!received.serials.empty());
+  for (auto packet_serial : received.serials) {
+    EXPECT_EQ(queue.serial.load(), packet_serial);
+  }
+  // from the keyframe before the last target on, without gaps.
+  EXPECT_EQ(90, received.pts.size());
+  for (size_t i = 0; i < received.pts.size(); i++) {
+    EXPECT_EQ((int64_t)(10 + i) * PACKET_DURATION, received.pts[i]);
+  }
+  EXPECT_EQ(0, queue.nb_packets);
+  queue.Abort();
+}
+
+static void test_rewind_then_skip_forward() {
+  PacketQueue queue;
+  queue.time_base = {1, 1000};
+  queue.SetBackBuffer(60000, 0);
+  queue.Start();
+  for (int i = 0; i < 100; i++) {
+    queue.Put(make_packet(i));
+  }
+  Packet pkt;
+  int serial;
+  for (int i = 0; i < 51; i++) {
+    queue.Get(&pkt, 0, &serial, nullptr, nullptr);
+  }
+
+  EXPECT_TRUE(queue.SeekInBuffer(25 * PACKET_DURATION));
+  EXPECT_TRUE(queue.SeekInBuffer(75 * PACKET_DURATION));
+
+  auto received = drain(&queue);
+  EXPECT_EQ(1, received.flushes);
+  EXPECT_EQ(30, received.pts.size());
+  if (!received.pts.empty()) {
+    EXPECT_EQ(70 * PACKET_DURATION, received.pts.front());
+  }
+  queue.Abort();
+}
+
+static void test_packets_released() {
+  {
+    PacketQueue queue;
+    queue.time_base = {1, 1000};
+    queue.SetBackBuffer(60000, 0);
+    queue.Start();
+    int index = 0;
+    for (; index < 200; index++) {
+      queue.Put(make_counted_packet(index));
+    }
+    Packet pkt;
+    int serial;
+    for (int i = 0; i < 101; i++) {
+      queue.Get(&pkt, 0, &serial, nullptr, nullptr);
+    }
+    pkt.Reset();
+
+    // back buffer, replay queue and ring all hold packets when detached.
+    EXPECT_TRUE(queue.SeekInBuffer(55 * PACKET_DURATION));
+    queue.BumpSerial();
+    // only the flush packet of the new serial.
+    EXPECT_EQ(1, queue.nb_packets);
+    EXPECT_EQ(0, queue.GetRetainedBytes());
+    EXPECT_TRUE(wait_buffers_released());
+
+    // packets put after the bump are still served.
+    for (; index < 300; index++) {
+      queue.Put(make_counted_packet(index));
+    }
+    for (int i = 0; i < 51; i++) {
+      queue.Get(&pkt, 0, &serial, nullptr, nullptr);
+    }
+    EXPECT_EQ(queue.serial.load(), serial);
+    EXPECT_EQ(249 * PACKET_DURATION, pkt->pts);
+    pkt.Reset();
+
+    // puts of an aborted queue release the packet, the 50 pending and the
+    // 50 in the back buffer go with the queue.
+    queue.Abort();
+    EXPECT_EQ(-1, queue.Put(make_counted_packet(index++)));
+    EXPECT_EQ(buffers_created - 100, buffers_released);
+  }
+  EXPECT_TRUE(wait_buffers_released());
+  EXPECT_EQ(buffers_created.load(), buffers_released.load());
+}
+
+static void test_packets_released_across_threads() {
+  {
+    PacketQueue queue;
+    queue.Start();
+    std::thread consumer([&queue]() {
+      Packet pkt;
+      int serial;
+      while (queue.Get(&pkt, 1, &serial, nullptr, nullptr) > 0) {
+      }
+    });
+    for (int i = 0; i < 100000; i++) {
+      queue.Put(make_counted_packet(i));
+      if (i % 10000 == 0) {
+        queue.BumpSerial();
+      }
+    }
+    queue.Abort();
+    consumer.join();
+  }
+  EXPECT_TRUE(wait_buffers_released());
+}
+
+int main() {
+  test_back_to_back_rewinds();
+  test_rewind_then_skip_forward();
+  test_packets_released();
+  test_packets_released_across_threads();
+  return TestResult("packet queue");
+}
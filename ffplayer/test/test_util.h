@@ -0,0 +1,44 @@
+//
+// Created by boyan on 2021/3/9.
+//
+
+#ifndef FFPLAYER_TEST_TEST_UTIL_H
+#define FFPLAYER_TEST_TEST_UTIL_H
+
+#include <cinttypes>
+#include <cstdio>
+
+// failed expectations of the test, main() returns TestResult().
+static int test_failures = 0;
+
+#define EXPECT_EQ(expected, actual)                                          \
+  do {                                                                       \
+    auto expected_value = (int64_t)(expected);                               \
+    auto actual_value = (int64_t)(actual);                                   \
+    if (expected_value != actual_value) {                                    \
+      fprintf(stderr, "%s:%d: %s is %" PRId64 ", expected %" PRId64 ".\n",   \
+              __FILE__, __LINE__, #actual, actual_value, expected_value);    \
+      test_failures++;                                                       \
+    }                                                                        \
+  } while (0)
+
+#define EXPECT_TRUE(condition)                                         \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      fprintf(stderr, "%s:%d: %s is false.\n", __FILE__, __LINE__,     \
+              #condition);                                             \
+      test_failures++;                                                 \
+    }                                                                  \
+  } while (0)
+
+/** @return the exit code of the test named |name|. */
+static inline int TestResult(const char* name) {
+  if (test_failures) {
+    fprintf(stderr, "%s: %d failures.\n", name, test_failures);
+    return 1;
+  }
+  printf("%s: all passed.\n", name);
+  return 0;
+}
+
+#endif  // FFPLAYER_TEST_TEST_UTIL_H